@@ -0,0 +1,213 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Input Corpora                 */
+/*                                                                           */
+/* Writes synthetic corpora for bench/stages.c into a directory, one file    */
+/* per shape of input, each holding one expression per line:                 */
+/*                                                                           */
+/*    flat.txt     wide sums and differences of short variable names         */
+/*    deep.txt     a sum buried under many levels of parentheses             */
+/*    power.txt    long right-associative chains of ^                        */
+/*    names.txt    products of very long variable names                      */
+/*    numbers.txt  sums of integers with hundreds of digits                  */
+/*    mixed.txt    random expressions using every operator and parentheses   */
+/*                                                                           */
+/* Every file is about the requested size (4 MB unless -s gives the number   */
+/* of kilobytes) and the same on every run, since the pseudo-random numbers  */
+/* come from a fixed seed. The files are also valid input for simple_parse   */
+/* -b. Build and run from the top of the repository with:                    */
+/*                                                                           */
+/*    make bench                                                             */
+/*                                                                           */
+/* or by hand with:                                                          */
+/*                                                                           */
+/*    cc -O2 -o bench/corpus bench/corpus.c                                  */
+/*    ./bench/corpus [-s kilobytes] directory                                */
+/*                                                                           */
+/*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CORPUS_DEFAULT_KB 4096
+#define CORPUS_PATH_MAX   4096
+
+/* An expression generator writes one line of its corpus to a stream, using */
+/* the state of the pseudo-random number generator next_random.             */
+
+struct corpus {
+   const char *name;
+   void (*line)(FILE *out, unsigned long *seed);
+};
+
+unsigned long next_random(unsigned long *seed);
+void put_name(FILE *out, unsigned long *seed, int len);
+void put_number(FILE *out, unsigned long *seed, int len);
+void put_operator(FILE *out, unsigned long *seed, const char *ops);
+void flat_line(FILE *out, unsigned long *seed);
+void deep_line(FILE *out, unsigned long *seed);
+void power_line(FILE *out, unsigned long *seed);
+void names_line(FILE *out, unsigned long *seed);
+void numbers_line(FILE *out, unsigned long *seed);
+void mixed_line(FILE *out, unsigned long *seed);
+void mixed_expr(FILE *out, unsigned long *seed, int depth);
+int write_corpus(const char *dir, const struct corpus *corpus, long size);
+
+int main(int argc, char **argv) {
+   static const struct corpus corpora[] = {
+      { "flat", flat_line },
+      { "deep", deep_line },
+      { "power", power_line },
+      { "names", names_line },
+      { "numbers", numbers_line },
+      { "mixed", mixed_line }
+   };
+   long size = (long)CORPUS_DEFAULT_KB * 1024;
+   char *dir = NULL;
+   int i;
+
+   for (i = 1; i < argc; ++i) {
+      if (strcmp(argv[i], "-s") == 0 && i + 1 < argc &&
+          atol(argv[i + 1]) > 0)
+         size = atol(argv[++i]) * 1024;
+      else if (dir == NULL && argv[i][0] != '-')
+         dir = argv[i];
+      else
+         dir = NULL, i = argc;
+   }
+   if (dir == NULL) {
+      printf("Usage: %s [-s kilobytes] directory\n", argv[0]);
+      return 1;
+   }
+   for (i = 0; i < (int)(sizeof(corpora) / sizeof(corpora[0])); ++i)
+      if (write_corpus(dir, &corpora[i], size) != 0)
+         return 1;
+   return 0;
+}
+
+int write_corpus(const char *dir, const struct corpus *corpus, long size) {
+   char path[CORPUS_PATH_MAX];
+   unsigned long seed = 12345;
+   FILE *out;
+   snprintf(path, sizeof(path), "%s/%s.txt", dir, corpus->name);
+   out = fopen(path, "w");
+   if (out == NULL) {
+      printf("Failed to create %s!\n", path);
+      return 1;
+   }
+   while (ftell(out) < size) {
+      corpus->line(out, &seed);
+      putc('\n', out);
+   }
+   if (fclose(out) != 0) {
+      printf("Failed to write %s!\n", path);
+      return 1;
+   }
+   return 0;
+}
+
+/* A 64-bit linear congruential generator; only its high bits are random    */
+/* enough to use.                                                           */
+
+unsigned long next_random(unsigned long *seed) {
+   *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+   return (*seed >> 33) & 0x7fffffffUL;
+}
+
+void put_name(FILE *out, unsigned long *seed, int len) {
+   static const char letters[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+   while (len-- > 0)
+      putc(letters[next_random(seed) % (sizeof(letters) - 1)], out);
+}
+
+void put_number(FILE *out, unsigned long *seed, int len) {
+   putc('1' + next_random(seed) % 9, out);
+   while (--len > 0)
+      putc('0' + next_random(seed) % 10, out);
+}
+
+void put_operator(FILE *out, unsigned long *seed, const char *ops) {
+   putc(ops[next_random(seed) % strlen(ops)], out);
+}
+
+void flat_line(FILE *out, unsigned long *seed) {
+   int i;
+   put_name(out, seed, 1 + next_random(seed) % 3);
+   for (i = 0; i < 2000; ++i) {
+      put_operator(out, seed, "+-");
+      put_name(out, seed, 1 + next_random(seed) % 3);
+   }
+}
+
+void deep_line(FILE *out, unsigned long *seed) {
+   int depth = 1000 + next_random(seed) % 1000;
+   int i;
+   for (i = 0; i < depth; ++i)
+      putc('(', out);
+   put_name(out, seed, 2);
+   putc('+', out);
+   put_number(out, seed, 2);
+   for (i = 0; i < depth; ++i)
+      putc(')', out);
+}
+
+void power_line(FILE *out, unsigned long *seed) {
+   int i;
+   put_name(out, seed, 1);
+   for (i = 0; i < 2000; ++i) {
+      putc('^', out);
+      if (next_random(seed) % 2)
+         put_name(out, seed, 1);
+      else
+         put_number(out, seed, 1);
+   }
+}
+
+void names_line(FILE *out, unsigned long *seed) {
+   int i;
+   put_name(out, seed, 1000 + next_random(seed) % 1000);
+   for (i = 0; i < 8; ++i) {
+      put_operator(out, seed, "*+");
+      put_name(out, seed, 1000 + next_random(seed) % 1000);
+   }
+}
+
+void numbers_line(FILE *out, unsigned long *seed) {
+   int i;
+   put_number(out, seed, 200 + next_random(seed) % 300);
+   for (i = 0; i < 16; ++i) {
+      put_operator(out, seed, "+-*/");
+      put_number(out, seed, 200 + next_random(seed) % 300);
+   }
+}
+
+void mixed_line(FILE *out, unsigned long *seed) {
+   int i;
+   mixed_expr(out, seed, 6);
+   for (i = 0; i < 20; ++i) {
+      put_operator(out, seed, "+-*/^");
+      mixed_expr(out, seed, 6);
+   }
+}
+
+void mixed_expr(FILE *out, unsigned long *seed, int depth) {
+   if (depth == 0 || next_random(seed) % 3 == 0) {
+      if (next_random(seed) % 2)
+         put_name(out, seed, 1 + next_random(seed) % 6);
+      else
+         put_number(out, seed, 1 + next_random(seed) % 6);
+      return;
+   }
+   if (next_random(seed) % 3 == 0) {
+      putc('(', out);
+      mixed_expr(out, seed, depth - 1);
+      put_operator(out, seed, "+-*/^");
+      mixed_expr(out, seed, depth - 1);
+      putc(')', out);
+   } else {
+      mixed_expr(out, seed, depth - 1);
+      put_operator(out, seed, "+-*/^");
+      mixed_expr(out, seed, depth - 1);
+   }
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************/
+/*                        Simple Expression Parser Benchmark                 */
+/*                                                                           */
+/* Times input_lexer and expr on expressions of the form ((...(a)...))^b     */
+/* for nesting depths from 10 up to 1000000 and prints the cost per token.   */
+/* With a linear parser the ns/token column stays flat as depth grows. The   */
+/* parser keeps its own stack on the heap, so even the deepest inputs parse  */
+/* on the ordinary C stack. Build and run from the top of the repository     */
+/* with:                                                                     */
+/*                                                                           */
+/*    make bench                                                             */
+/*                                                                           */
+/* or by hand with:                                                          */
+/*                                                                           */
+/*    cc -O2 -o bench/nesting bench/nesting.c -lpthread -lm                  */
+/*    ./bench/nesting                                                        */
+/*                                                                           */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+
+#include <time.h>
+
+#define BENCH_MIN_NS 200000000.0
+
+struct bench_run {
+   int depth;
+   char *input;
+   int num_tokens;
+   int reps;
+   double ns;
+};
+
+double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Builds the input for one depth: depth opening parentheses, the atom a, */
+/* depth closing parentheses, and a trailing ^b.                          */
+
+char *nested_input(int depth) {
+   char *result;
+   int i, j;
+   result = (char *)malloc(2 * depth + 4);
+   if (result == NULL)
+      return NULL;
+   j = 0;
+   for (i = 0; i < depth; ++i)
+      result[j++] = '(';
+   result[j++] = 'a';
+   for (i = 0; i < depth; ++i)
+      result[j++] = ')';
+   result[j++] = '^';
+   result[j++] = 'b';
+   result[j] = '\0';
+   return result;
+}
+
+void run_depth(struct bench_run *run) {
+   struct arena arena;
+   struct token_array tokens;
+   struct token_cursor cur;
+   double start;
+   arena_init(&arena);
+   token_array_init(&tokens);
+   run->reps = 0;
+   start = now_ns();
+   do {
+      arena_reset(&arena);
+      input_lexer(&tokens, run->input, 2 * run->depth + 3);
+      token_cursor_init(&cur, &tokens);
+      expr(&arena, &cur);
+      ++run->reps;
+      run->ns = now_ns() - start;
+   } while (run->ns < BENCH_MIN_NS);
+   arena_free(&arena);
+   token_array_free(&tokens);
+}
+
+int main(void) {
+   static const int depths[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+   struct bench_run run;
+   int i;
+
+   printf("%10s %10s %10s %14s %10s\n",
+          "depth", "tokens", "reps", "ns/parse", "ns/token");
+   for (i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); ++i) {
+      run.depth = depths[i];
+      run.input = nested_input(run.depth);
+      if (run.input == NULL) {
+         printf("Failed to allocate memory for benchmark input!\n");
+         return 1;
+      }
+      run.num_tokens = 2 * run.depth + 3;
+      run_depth(&run);
+      printf("%10d %10d %10d %14.0f %10.1f\n", run.depth, run.num_tokens,
+             run.reps, run.ns / run.reps,
+             run.ns / run.reps / run.num_tokens);
+      free(run.input);
+   }
+   return 0;
+}
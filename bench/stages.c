@@ -0,0 +1,278 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Stage Benchmark               */
+/*                                                                           */
+/* Times every stage of the pipeline separately on the corpora written by    */
+/* bench/corpus.c: input_lexer, expr, compl_par, postfix and prefix, plus    */
+/* direct_forms, which batch mode uses for the postfix and prefix forms      */
+/* alone. Each file given on the command line is worked through line by      */
+/* line, stage by stage, until BENCH_MIN_NS have passed. For every stage the */
+/* program prints the time per byte of input, the number of calls to         */
+/* malloc, realloc and calloc per expression and the number of bytes taken   */
+/* from the arena per expression, followed by the peak resident set size of  */
+/* the whole run. Since buffers are reused from one expression to the next,  */
+/* the allocation counts should stay close to zero; a stage that starts      */
+/* allocating for every expression shows up there before it shows up in the  */
+/* timings. Each corpus is run in a child process of its own so that its     */
+/* peak memory use is not hidden by that of the corpora before it. Build     */
+/* and run from the top of the repository with:                              */
+/*                                                                           */
+/*    make bench                                                             */
+/*                                                                           */
+/* or by hand with:                                                          */
+/*                                                                           */
+/*    cc -O2 -o bench/corpus bench/corpus.c                                  */
+/*    cc -O2 -o bench/stages bench/stages.c -lpthread -lm                    */
+/*    ./bench/corpus bench/data                                              */
+/*    ./bench/stages bench/data/flat.txt bench/data/deep.txt ...             */
+/*                                                                           */
+/*****************************************************************************/
+
+/* The feature test macros only take effect at the first system header, so  */
+/* they are repeated here; _DEFAULT_SOURCE is undefined again afterwards,   */
+/* since simple_parse.c defines it once more.                               */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#undef _DEFAULT_SOURCE
+
+/* The counting wrappers are defined before simple_parse.c is included, so  */
+/* that they call the real allocation functions, while every allocation     */
+/* made by simple_parse.c goes through them.                                */
+
+long bench_allocs;
+
+void *bench_malloc(size_t size) {
+   ++bench_allocs;
+   return malloc(size);
+}
+
+void *bench_realloc(void *ptr, size_t size) {
+   ++bench_allocs;
+   return realloc(ptr, size);
+}
+
+void *bench_calloc(size_t num, size_t size) {
+   ++bench_allocs;
+   return calloc(num, size);
+}
+
+#define malloc(size) bench_malloc(size)
+#define realloc(ptr, size) bench_realloc(ptr, size)
+#define calloc(num, size) bench_calloc(num, size)
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+#undef malloc
+#undef realloc
+#undef calloc
+
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_MIN_NS 500000000.0
+
+#define STAGE_LEX     0
+#define STAGE_PARSE   1
+#define STAGE_PAREN   2
+#define STAGE_POSTFIX 3
+#define STAGE_PREFIX  4
+#define STAGE_DIRECT  5
+#define NUM_STAGES    6
+
+/* A struct stage_total adds up the cost of one stage over all expressions  */
+/* and repetitions of a corpus.                                             */
+
+struct stage_total {
+   double ns;
+   long allocs;
+   double arena_bytes;
+};
+
+struct corpus_run {
+   char *data;
+   size_t size;
+   long num_lines;
+   long reps;
+   struct stage_total stages[NUM_STAGES];
+};
+
+double now_ns(void);
+size_t arena_used(struct arena *arena);
+void stage_begin(double *start, long *allocs, size_t *used,
+                 struct arena *arena);
+void stage_end(struct stage_total *total, double start, long allocs,
+               size_t used, struct arena *arena);
+void run_corpus(struct corpus_run *run);
+int bench_file(char *path);
+
+int main(int argc, char **argv) {
+   int status;
+   int i;
+   pid_t pid;
+
+   if (argc < 2) {
+      printf("Usage: %s corpus...\n", argv[0]);
+      return 1;
+   }
+   printf("%-12s %-8s %10s %12s %14s\n",
+          "corpus", "stage", "ns/byte", "allocs/expr", "arena B/expr");
+   fflush(stdout);
+   for (i = 1; i < argc; ++i) {
+      pid = fork();
+      if (pid < 0) {
+         printf("Failed to start benchmark process!\n");
+         return 1;
+      }
+      if (pid == 0)
+         exit(bench_file(argv[i]));
+      if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != 0)
+         return 1;
+   }
+   return 0;
+}
+
+int bench_file(char *path) {
+   static const char *names[NUM_STAGES] = {
+      "lex", "parse", "paren", "postfix", "prefix", "direct"
+   };
+   struct corpus_run run;
+   struct rusage usage;
+   char *name;
+   double exprs;
+   int s;
+
+   run.data = map_file(path, &run.size);
+   if (run.data == NULL)
+      return 1;
+   run_corpus(&run);
+   exprs = (double)run.num_lines * run.reps;
+   name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+   for (s = 0; s < NUM_STAGES; ++s)
+      printf("%-12s %-8s %10.2f %12.3f %14.0f\n", name, names[s],
+             run.stages[s].ns / ((double)run.size * run.reps),
+             run.stages[s].allocs / exprs,
+             run.stages[s].arena_bytes / exprs);
+   getrusage(RUSAGE_SELF, &usage);
+   printf("%-12s %ld lines, %ld repetitions, peak RSS %ld KB\n",
+          name, run.num_lines, run.reps, (long)usage.ru_maxrss);
+   unmap_file(run.data, run.size);
+   return 0;
+}
+
+/* Works through the corpus until BENCH_MIN_NS have passed, timing each     */
+/* stage on each line on its own; lines are several kilobytes long, so the  */
+/* cost of reading the clock is lost in the noise.                          */
+
+void run_corpus(struct corpus_run *run) {
+   struct arena arena;
+   struct token_array tokens;
+   struct token_cursor cur;
+   struct pt_node *head;
+   struct strbuf out;
+   struct forms forms;
+   char *line;
+   char *end = run->data + run->size;
+   char *newline;
+   double start;
+   double total = 0;
+   long allocs;
+   size_t used;
+   int s;
+
+   arena_init(&arena);
+   token_array_init(&tokens);
+   strbuf_init(&out);
+   forms_init(&forms, (1 << FORM_POSTFIX) | (1 << FORM_PREFIX));
+   for (s = 0; s < NUM_STAGES; ++s) {
+      run->stages[s].ns = 0;
+      run->stages[s].allocs = 0;
+      run->stages[s].arena_bytes = 0;
+   }
+   run->reps = 0;
+   do {
+      run->num_lines = 0;
+      for (line = run->data; line < end; line = newline + 1) {
+         newline = memchr(line, '\n', end - line);
+         if (newline == NULL)
+            newline = end;
+         if (newline == line)
+            continue;
+         ++run->num_lines;
+         arena_reset(&arena);
+
+         stage_begin(&start, &allocs, &used, &arena);
+         input_lexer(&tokens, line, newline - line);
+         stage_end(&run->stages[STAGE_LEX], start, allocs, used, &arena);
+
+         stage_begin(&start, &allocs, &used, &arena);
+         token_cursor_init(&cur, &tokens);
+         head = expr(&arena, &cur);
+         stage_end(&run->stages[STAGE_PARSE], start, allocs, used, &arena);
+         if (head == NULL)
+            continue;
+
+         strbuf_reset(&out);
+         stage_begin(&start, &allocs, &used, &arena);
+         compl_par(head, &out);
+         stage_end(&run->stages[STAGE_PAREN], start, allocs, used, &arena);
+
+         strbuf_reset(&out);
+         stage_begin(&start, &allocs, &used, &arena);
+         postfix(head, &out);
+         stage_end(&run->stages[STAGE_POSTFIX], start, allocs, used, &arena);
+
+         strbuf_reset(&out);
+         stage_begin(&start, &allocs, &used, &arena);
+         prefix(head, &out);
+         stage_end(&run->stages[STAGE_PREFIX], start, allocs, used, &arena);
+
+         forms_reset(&forms);
+         stage_begin(&start, &allocs, &used, &arena);
+         direct_forms(&arena, &tokens, &forms);
+         stage_end(&run->stages[STAGE_DIRECT], start, allocs, used, &arena);
+      }
+      ++run->reps;
+      for (s = 0, total = 0; s < NUM_STAGES; ++s)
+         total += run->stages[s].ns;
+   } while (total < BENCH_MIN_NS && run->num_lines != 0);
+   forms_free(&forms);
+   strbuf_free(&out);
+   token_array_free(&tokens);
+   arena_free(&arena);
+}
+
+void stage_begin(double *start, long *allocs, size_t *used,
+                 struct arena *arena) {
+   *used = arena_used(arena);
+   *allocs = bench_allocs;
+   *start = now_ns();
+}
+
+void stage_end(struct stage_total *total, double start, long allocs,
+               size_t used, struct arena *arena) {
+   total->ns += now_ns() - start;
+   total->allocs += bench_allocs - allocs;
+   total->arena_bytes += arena_used(arena) - used;
+}
+
+double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Blocks after the current one are left over from before the last          */
+/* arena_reset, so only the blocks up to the current one count.             */
+
+size_t arena_used(struct arena *arena) {
+   struct arena_block *block;
+   size_t used = 0;
+   for (block = arena->first; block != NULL; block = block->next) {
+      used += block->used;
+      if (block == arena->current)
+         break;
+   }
+   return used;
+}
@@ -8,15 +8,119 @@
 /* arithmetic operators, expressions may contain exponents as well as        */ 
 /* variable names (strings of letters).                                      */
 /*                                                                           */
+/* With the option -a the expression is parsed into a compact abstract       */
+/* syntax tree instead of a full parse tree; the output is the same.         */
+/* With -d, which implies -a, repeated subexpressions share one tree node.   */
+/* With -s, which implies -a, the forms of the simplified expression result. */
+/* With -w file the tree of the expression is saved, and -r file loads it.   */
+/* With the option -b the program instead reads one expression per line      */
+/* from a file or standard input and writes the three forms for each line.   */
+/* With -j N as well, the lines are worked through by N threads.             */
+/* Without -b, -j N splits a single long expression over N threads.          */
+/* With the option -l it serves the forms to clients over a socket instead.  */
+/* With the option -e the program evaluates an expression for every row of   */
+/* a table of variable values instead (see below).                           */
+/*                                                                           */
+/* Compiled with the macro SIMPLE_PARSE_NO_MAIN defined, the file leaves out */
+/* main, along with batch mode, the server and evaluate, which print their   */
+/* results and errors, and serves as a library with the interface in         */
+/* simple_parse.h.                                                           */
+/*                                                                           */
 /*****************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+#define USE_MMAP
+#define USE_THREADS
+#define USE_JIT
+#define USE_SERVER
+
+#if defined(USE_JIT) && (!defined(__x86_64__) || defined(_WIN32))
+#undef USE_JIT
+#endif
+#if defined(USE_SERVER) && (!defined(__linux__) || !defined(USE_THREADS))
+#undef USE_SERVER
+#endif
+#ifdef USE_JIT
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <limits.h>
 #include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "simple_parse.h"
+
+#if defined(USE_MMAP) || defined(USE_JIT)
+#include <sys/mman.h>
+#endif
+
+#ifdef USE_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef USE_SERVER
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Parse tree nodes are not allocated one by one with malloc; they are      */
+/* carved out of a struct arena, a simple bump allocator. An arena          */
+/* is a chain of large blocks; arena_alloc hands out the next suitably      */
+/* aligned piece of the current block, moving on to (or creating) another   */
+/* block once the current one is full. Nothing allocated from an arena is   */
+/* ever freed individually. Instead arena_reset releases everything at once */
+/* in constant time, keeping the blocks around so that the next expression  */
+/* can reuse them, and arena_free returns the blocks themselves to the      */
+/* system. ARENA_BLOCK_SIZE is the size of a block; requests larger than    */
+/* that get a block of their own. Every piece is aligned to ARENA_ALIGN.    */
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN      16
+#define ARENA_HEADER_SIZE \
+   ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena_block {
+   struct arena_block *next;
+   size_t size;
+   size_t used;
+};
+
+struct arena {
+   struct arena_block *first;
+   struct arena_block *current;
+};
+
+void arena_init(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
 
 #define DEBUG
-#define MAX_CHARS 1000
+#define LINE_CHUNK 4096
 
 #define LPAREN 0
 #define RPAREN 1
@@ -42,38 +146,269 @@
 #define NSUB     12
 #define NATOM    13
 #define NEPSILON 14
-
+#define NTEXT    15
 /* Debugging can be turned off by compiling with the line defining the      */
-/* DEBUG macro removed. MAX_CHARS is the maximum number of characters the   */
-/* user will be allowed to use in an expression input to the program.       */
+/* DEBUG macro removed. Likewise, batch mode reads its input file through   */
+/* stdio instead of mapping it into memory when the program is compiled     */
+/* with the line defining the USE_MMAP macro removed, and the -j option     */
+/* described below is only available while USE_THREADS is defined (the      */
+/* program must then be linked with the POSIX threads library). The server  */
+/* mode, -l, likewise needs USE_SERVER, which is only kept on Linux, since  */
+/* the server waits for its sockets with epoll. Expressions may be of any   */
+/* length: input lines are read with read_line (see below), which fetches   */
+/* them LINE_CHUNK characters at a time straight into a growing buffer.     */
 /* Macros LPAREN through ATOM are defined so that token types can be        */
 /* represented as numbers instead of strings. Similarly, macros NEXPR       */
 /* through NEPSILON are defined so that parse tree nodes can have types     */
-/* represented by numbers. The lexer uses struct tokens to represent the    */
-/* tokens in the user input; it produces a linked list to pass to the       */
-/* parser. The function create_token is used to create struct tokens,       */
-/* dynamically allocating their memory and initializing them.               */
+/* represented by numbers; a leaf of type NTEXT holds text an edit left     */
+/* unparsed (see sp_edit). The lexer uses struct tokens to represent the    */
+/* tokens in the user input. It stores them in a struct token_array, a      */
+/* single contiguous array of tokens which grows as needed and is reused    */
+/* from one expression to the next. A token is kept small: besides its type */
+/* it holds only the offset of its lexeme within the input and the lexeme's */
+/* length, and the token_array remembers where the input starts. Tokens     */
+/* therefore do not copy their lexemes, and the input has to stay in place  */
+/* for as long as the tokens and any tree built from them are used. For the */
+/* same reason input_lexer takes the input as a pointer plus a length       */
+/* rather than as a null-terminated string; it returns the number of        */
+/* tokens. If the input contains an invalid character it returns            */
+/* SP_ERR_CHAR instead, SP_ERR_MEMORY if the array cannot grow and          */
+/* SP_ERR_LENGTH, without looking at the input, if it is longer than        */
+/* INT_MAX bytes, since a token holds its offset and length as ints; the    */
+/* array is then left empty and its member error_offset holds the offset of */
+/* the character at which the lexer stopped, 0 for an input too long. The   */
+/* function create_token is used to append a new token to a token_array and */
+/* initialize it, and token_array_init and token_array_free set up and      */
+/* release an array.                                                        */
+/*                                                                          */
+/* If its member intern is set, the lexer also interns every atom it meets: */
+/* the token_array keeps a symbol table in which each distinct variable     */
+/* name or number gets the next of the dense ids 0, 1, 2 and so on, and an  */
+/* atom holds the id of its lexeme in symbol; every other token holds -1. A */
+/* struct symbol records where a lexeme first occurs in the input, its      */
+/* length, its hash and, for a number, its value, which parse_number works  */
+/* out once per distinct number, and intern_symbol finds it through a hash  */
+/* table of num_buckets buckets chained through next, which symbols_grow    */
+/* enlarges along with the array of symbols, so that the table is never     */
+/* more than half full. The ids only mean something within one input:       */
+/* input_lexer empties the table before it starts, clearing just the        */
+/* buckets its symbols had taken. Only compact trees need the ids, so       */
+/* parsers that build them set intern, and ast_build interns the atoms of   */
+/* tokens lexed without it afterwards, with intern_tokens; plain parse      */
+/* trees and direct_forms do without, and the hashing costs them nothing.   */
+/* Compact trees carry the ids over into their atoms, so that atoms are     */
+/* compared by id rather than by name when subtrees are shared, and         */
+/* bc_compile numbers each variable once per name rather than once per      */
+/* occurrence, keeping its number in an array indexed by id. In a struct    */
+/* number, parse_number sets i to the value of a number if it fits into 64  */
+/* bits and to -1 if not, and d to the double nearest to it, which strtod   */
+/* works out from the digits, up to NUMBER_DIGITS of them once leading      */
+/* zeros are gone; any longer number is beyond the range of a double. The   */
+/* digits themselves stay in the input, so nothing is lost for numbers of   */
+/* any length.                                                              */
 
 struct token {
-   int type;
-   char *string;
-   struct token *prev;
-   struct token *next;
+   int offset;
+   int len;
+   int symbol;
+   unsigned char type;
+};
+
+#define NUMBER_DIGITS 309
+
+struct number {
+   int64_t i;
+   double d;
+};
+
+struct symbol {
+   int offset;
+   int len;
+   int next;
+   uint32_t hash;
+   struct number number;
+};
+
+struct token_array {
+   struct token *tokens;
+   int num_tokens;
+   int cap;
+   char *input;
+   int error_offset;
+   int intern;
+   struct symbol *symbols;
+   int num_symbols;
+   int symbols_cap;
+   int *buckets;
+   int num_buckets;
+};
+
+void token_array_init(struct token_array *array);
+void token_array_free(struct token_array *array);
+struct token *create_token(struct token_array *array, int type,
+                           char *init_char, int token_len);
+int input_lexer(struct token_array *array, char *user_input, size_t len);
+int intern_symbol(struct token_array *array, char *name, int len);
+int intern_tokens(struct token_array *array);
+int symbols_grow(struct token_array *array);
+void parse_number(char *string, int len, struct number *number);
+
+/* input_lexer classifies characters with the table char_class, which maps  */
+/* each of the 256 possible byte values to the token type of a              */
+/* single-character token (LPAREN through SUB), to CC_ALPHA for a letter,   */
+/* to CC_DIGIT for a digit, or to CC_INVALID. Unlike isalpha and isdigit,   */
+/* the table does not depend on the locale. The function skip_run returns   */
+/* the end of the run of letters or digits starting at its first argument.  */
+/* When the compiler targets SSE2 or AVX2 it tests 16 or 32 characters per  */
+/* step with vector instructions, finishing the last few characters of the  */
+/* input one at a time; otherwise it looks up every character in            */
+/* char_class.                                                              */
+
+#define CC_ALPHA   8
+#define CC_DIGIT   9
+#define CC_INVALID 10
+
+extern const unsigned char char_class[256];
+char *skip_run(char *p, char *end, int cls);
+
+/* While DEBUG is defined, the program can also be compiled with the macro  */
+/* DEBUG_STATS defined (with cc -DDEBUG_STATS, for instance) to count what  */
+/* happens on its hot paths: the tokens lexed by input_lexer, the parse     */
+/* tree nodes made by create_node, the bytes handed out by arena_alloc and  */
+/* the bytes strbuf_reserve grows strbufs by, the tokens the parser looks   */
+/* ahead at while parsing an exprpp, and the wall time spent in each stage. */
+/* The stages STAT_LEX through STAT_DIRECT are input_lexer, expr,           */
+/* ast_build, the printing of the forms by all_forms or ast_all_forms, and  */
+/* direct_forms. The macros STAT_ADD, STAT_START and STAT_STOP update the   */
+/* counters and expand to nothing without DEBUG_STATS, so the normal build  */
+/* pays nothing for them.                                                   */
+/*                                                                          */
+/* Each thread counts into a struct debug_stats of its own, debug_stats,    */
+/* kept in thread-local storage, so the counting needs neither locks nor    */
+/* atomic instructions. stats_register links the calling thread's counters  */
+/* into the list stats_threads, and stats_unregister, called before the     */
+/* thread ends, unlinks them again and adds them to stats_total. stats_dump */
+/* writes the sum of stats_total and the counters of every registered       */
+/* thread to standard error as one JSON object; the counters of threads     */
+/* still running are read as they are, so the sum is a snapshot rather than */
+/* an exact figure. stats_init registers the main thread, has stats_dump    */
+/* run at exit and installs stats_signal as the handler for SIGUSR1. Since  */
+/* a signal handler cannot safely write output, stats_signal only sets the  */
+/* flag stats_requested. STAT_POLL, used once per line of batch input and   */
+/* once per block of evaluated rows, then calls stats_poll, which clears    */
+/* the flag and calls stats_dump, if the flag is set.                       */
+
+#ifndef DEBUG
+#undef DEBUG_STATS
+#endif
+
+#define STAT_LEX        0
+#define STAT_PARSE      1
+#define STAT_COMPACT    2
+#define STAT_PRINT      3
+#define STAT_DIRECT     4
+#define NUM_STAT_STAGES 5
+
+#ifdef DEBUG_STATS
+
+#include <signal.h>
+#include <time.h>
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define STATS_THREAD_LOCAL _Thread_local
+#else
+#define STATS_THREAD_LOCAL __thread
+#endif
+
+struct debug_stats {
+   int64_t tokens;
+   int64_t nodes;
+   int64_t arena_bytes;
+   int64_t strbuf_bytes;
+   int64_t lookahead;
+   int64_t stage_ns[NUM_STAT_STAGES];
+   int64_t stage_start[NUM_STAT_STAGES];
+   struct debug_stats *next;
 };
 
-struct token *create_token(int type, char *init_char, int token_len);
-struct token *input_lexer(char *user_input);
+extern STATS_THREAD_LOCAL struct debug_stats debug_stats;
+extern volatile sig_atomic_t stats_requested;
+
+void stats_init(void);
+void stats_register(void);
+void stats_unregister(void);
+void stats_add(struct debug_stats *sum, const struct debug_stats *part);
+void stats_dump(void);
+void stats_poll(void);
+void stats_signal(int sig);
+int64_t stats_now(void);
+
+#define STAT_ADD(counter, n) (debug_stats.counter += (n))
+#define STAT_START(stage) (debug_stats.stage_start[stage] = stats_now())
+#define STAT_STOP(stage) \
+   (debug_stats.stage_ns[stage] += stats_now() - debug_stats.stage_start[stage])
+#define STAT_POLL() (stats_requested ? stats_poll() : (void)0)
+
+#else
+
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_START(stage)    ((void)0)
+#define STAT_STOP(stage)     ((void)0)
+#define STAT_POLL()          ((void)0)
+
+#endif
+
+/* The parser follows the grammar below production by production to build a */
+/* parse tree, whose nodes are struct pt_nodes. The function create_node    */
+/* works similarly to the function create_token. The type member of struct  */
+/* pt_node is used to store the value which the macros defined above        */
+/* associate with the terminal or nonterminal in the grammar represented by */
+/* the node. If the node represents a terminal, the members string and len  */
+/* hold the lexeme of the corresponding token, pointing into the input just */
+/* like the token does. Member num_childs holds the number of children the  */
+/* node has, and width the number of input characters its subtree covers,   */
+/* which only sp_edit sets and keeps up to date. The member child_ptrs      */
+/* holds the pointers to the node's children; it is stored inline at the    */
+/* end of the node, so that a node and its children array take a single     */
+/* allocation from the arena. The function expr parses the lexed input,     */
+/* with the help of the functions lparen through epsilon, which match       */
+/* single terminals; lparen through atom leave the work to terminal, which  */
+/* consumes the next token if it is of the type given and records the error */
+/* status otherwise.                                                        */
+
+/* The parser reads the tokens through a struct token_cursor, which holds   */
+/* the token array, the number of tokens, the index pos of the next token   */
+/* to be consumed, the start of the input and the symbol table. The         */
+/* function token_cursor_init points a cursor at the first token of a       */
+/* token_array, and peek_token returns the next token without consuming it, */
+/* or NULL once every token has been consumed; a token is consumed by       */
+/* incrementing pos.                                                        */
+/*                                                                          */
+/* The parsers do not print anything. When the tokens do not match the      */
+/* grammar, or when memory runs out, they call parse_error, which records   */
+/* one of the error codes of simple_parse.h in the member status of the     */
+/* cursor, along with error_offset, the offset in the input of the token at */
+/* which they stopped, or the end of the last token if they ran out of      */
+/* tokens; only the first error is kept. expr checks status before every    */
+/* step and gives up at the first error, returning NULL. The nodes it has   */
+/* built by then stay in the arena, to be released with everything else in  */
+/* it when the arena is reset, so no clean-up is needed on the way out.     */
+/* Tokens left over once the outermost expr is complete, as in a) or a(b),  */
+/* are an error too, SP_ERR_TOKEN.                                          */
+
+struct token_cursor {
+   struct token *tokens;
+   int num_tokens;
+   int pos;
+   char *input;
+   struct symbol *symbols;
+   int status;
+   int error_offset;
+};
 
-/* The parser uses recursive descent to build a parse tree, whose nodes are */
-/* struct pt_nodes. The function create_node works similarly to the         */
-/* function create_token. The type member of struct pt_node is used to      */
-/* store the value which the macros defined above associate with the        */
-/* terminal or nonterminal in the grammar represented by the node. If the   */
-/* node represents a terminal, the member string holds the lexeme of the    */
-/* corresponding token. Member num_childs holds the number of children the  */
-/* node has. When num_childs is nonzero the member child_ptrs is an array   */
-/* of pointers to the node's children. Functions expr through epsilon are   */
-/* used to parse the lexed input.                                           */
+void token_cursor_init(struct token_cursor *cur, struct token_array *array);
+struct token *peek_token(struct token_cursor *cur);
+void parse_error(struct token_cursor *cur, int status);
 
 /* The function expr constructs a parse tree for expressions of the         */
 /* language defined by the following grammar:                               */
@@ -97,817 +432,6207 @@ struct token *input_lexer(char *user_input);
 
 struct pt_node {
    int type;
+   int width;
    char *string;
+   int len;
    int num_childs;
-   struct pt_node **child_ptrs;
-};
-
-struct pt_node *create_node(int type, char *string, int num_childs);
-struct pt_node *expr(struct token **lexed_in_ptr);
-struct pt_node *Expr(struct token **lexed_in_ptr);
-struct pt_node *exprp(struct token **lexed_in_ptr);
-struct pt_node *Exprp(struct token **lexed_in_ptr);
-struct pt_node *exprpp(struct token **lexed_in_ptr);
-struct pt_node *exprppp(struct token **lexed_in_ptr);
-struct pt_node *lparen(struct token **lexed_in_ptr);
-struct pt_node *rparen(struct token **lexed_in_ptr);
-struct pt_node *expo(struct token **lexed_in_ptr);
-struct pt_node *mul(struct token **lexed_in_ptr);
-struct pt_node *quo(struct token **lexed_in_ptr);
-struct pt_node *add(struct token **lexed_in_ptr);
-struct pt_node *sub(struct token **lexed_in_ptr);
-struct pt_node *atom(struct token **lexed_in_ptr);
-struct pt_node *epsilon(void);
-
-/* The function concat returns the concatenation of str1 and str2 as a new  */
-/* string. The function pre_compl_par takes as argument a pointer to the    */
-/* root node of a parse tree produced by expr and returns a string          */
-/* containing the completely parenthesized form of the expression           */
-/* to which the parse tree corresponds. Since pre_compl_par may return an   */
-/* expression with a pair of parentheses around it, strip_parens can be     */
-/* called on the string returned by pre_compl_par to produce an expression  */
-/* guaranteed to be free of an unnecessary pair of surrounding parentheses. */
-/* The function compl_par is the composition of strip_parens and            */
-/* pre_compl_par, returning the fully-parenthesized form of the input       */
-/* expression without surrounding parentheses.                              */
-
-char *concat(char *str1, char *str2);
-char *pre_compl_par(struct pt_node *head);
-char *strip_parens(char *pre_compl_par);
-char *compl_par(struct pt_node *head);
-
-/* The function postfix takes the parse tree produced by expr for an         */
-/* expression with infix binary operators and returns the same expression    */
-/* with postfix binary operators. The function prefix is similar, returning  */
-/* the expression with prefix binary operators.                              */
-
-char *postfix(struct pt_node *head);
-char *prefix(struct pt_node *head);
-
-int main(void) {
-
-   char user_input[MAX_CHARS];
-   int i;
-   struct token *lexed_input = NULL;
-   struct pt_node *head = NULL;
-
-   printf("\nPlease enter an arithmetic expression in infix form. The expression may\n"
-          "contain integer numbers, variable names, parentheses, and the operators\n"
-          "^ (exponentiation), * (multiplication), / (division), + (addition), and\n"
-          "- (subtraction). Variable names may contain lower-case letters and\n"
-          "upper-case letters, but may not contain any other type of character. The\n"
-          "expression must not contain any spaces.\n"
-          "\nExample:\n"
-          "   (a+3)+var^(b+282*c)\n\n"
-          ">> ");
-   if (fgets(user_input, MAX_CHARS, stdin) == NULL) {
-      printf("Error receiving input!\n");
-      return 1;
-   }
-   for (i = 0; i < MAX_CHARS - 1 && user_input[i] != '\n'; ++i)
-      ;
-   user_input[i] = '\0';
+   struct pt_node *child_ptrs[];
+};
 
-   /* The variable user_input is now a null-terminated array of chars
-      which holds the expression the user has entered.                */
+struct pt_node *create_node(struct arena *arena, int type, char *string,
+                            int len, int num_childs);
+struct pt_node *expr(struct arena *arena, struct token_cursor *cur);
+struct pt_node *lparen(struct arena *arena, struct token_cursor *cur);
+struct pt_node *rparen(struct arena *arena, struct token_cursor *cur);
+struct pt_node *expo(struct arena *arena, struct token_cursor *cur);
+struct pt_node *mul(struct arena *arena, struct token_cursor *cur);
+struct pt_node *quo(struct arena *arena, struct token_cursor *cur);
+struct pt_node *add(struct arena *arena, struct token_cursor *cur);
+struct pt_node *sub(struct arena *arena, struct token_cursor *cur);
+struct pt_node *atom(struct arena *arena, struct token_cursor *cur);
+struct pt_node *epsilon(struct arena *arena);
+struct pt_node *terminal(struct arena *arena, struct token_cursor *cur,
+                         int type, int node_type, int status);
 
-   lexed_input = input_lexer(user_input);
-   head = expr(&lexed_input);
-   printf("\nThe fully-parenthesized form of the expression:\n");
-   printf("     %s\n", compl_par(head));
-   printf("\nThe expression with postfix binary operators:\n");
-   printf("     %s\n", postfix(head));
-   printf("\nThe expression with prefix binary operators:\n");
-   printf("     %s\n\n", prefix(head));
+/* Although expr follows the grammar production by production, it does not  */
+/* recurse. The operator chains of Expr and Exprp and the right-recursive   */
+/* exprpp are built in a loop, the slots of the nodes still to be filled in */
+/* being kept in local variables; only a parenthesized exprppp has to wait  */
+/* for the expr inside it, so its node and those slots are saved in a       */
+/* struct pt_frame on a struct pt_stack until its closing parenthesis is    */
+/* reached. How deeply an expression may nest is therefore bounded by       */
+/* memory rather than by the size of the C stack. The printers below walk a */
+/* tree with the same kind of stack, pushing a frame for every operator     */
+/* chain and exponentiation they are in the middle of; in such a frame,     */
+/* link is the link of the chain reached so far, step tells how far the     */
+/* node has been printed and top is the argument of pre_all_forms of the    */
+/* same name. pt_stack_init prepares an empty stack, whose first            */
+/* PT_STACK_LOCAL frames are kept in the struct itself so that shallow      */
+/* expressions need no memory from the heap. pt_push pushes a frame for a   */
+/* node and returns it, or NULL if memory runs out, calling pt_grow to      */
+/* enlarge the stack when it is full, and pt_stack_free releases the        */
+/* frames. sp_edit also keeps the path from the root of a parse tree down   */
+/* to the group it edited last on such a stack; there, step is the offset   */
+/* at which a node starts and top the number of groups from the root down   */
+/* to it.                                                                   */
 
-   return 0;
-}
+#define PT_STACK_LOCAL 32
 
-struct token *create_token(int type, char *init_char, int token_len) {
+struct pt_frame {
+   struct pt_node *node;
+   struct pt_node *link;
+   struct pt_node **expr_tail;
+   struct pt_node **exprp_tail;
+   struct pt_node **exprpp_slot;
+   int step;
+   int top;
+};
 
-   struct token *result;
+struct pt_stack {
+   struct pt_frame *frames;
+   int depth;
+   int cap;
+   struct pt_frame local[PT_STACK_LOCAL];
+};
+
+void pt_stack_init(struct pt_stack *stack);
+struct pt_frame *pt_push(struct pt_stack *stack, struct pt_node *node);
+int pt_grow(struct pt_stack *stack);
+void pt_stack_free(struct pt_stack *stack);
+
+/* Besides the parse tree, expressions can be parsed into a compact         */
+/* abstract syntax tree. A struct ast keeps its nodes in one contiguous     */
+/* array, nodes, and the nodes refer to their children by index into that   */
+/* array. There is exactly one struct ast_node per atom or operator in the  */
+/* input: the NeXPR/NeXPRP spines and NEPSILON leaves of the parse tree are */
+/* never built, and parentheses only shape the tree. The type member of an  */
+/* ast_node is one of NATOM, NEXP, NMUL, NDIV, NADD and NSUB, the members   */
+/* string and len hold the lexeme, symbol holds the id of the lexeme of an  */
+/* atom (and -1 for an operator or a constant folded by ast_simplify),      */
+/* number holds the value of a number as parse_number found it (and -1 in i */
+/* for any other node), and for operators left and right are the indices of */
+/* the operands (both are -1 for atoms). Because a node is appended only    */
+/* once its operands are complete, the array is in postfix order and the    */
+/* root is its last node. The function ast_build sizes the array from the   */
+/* number of tokens, allocates it from an arena and parses the lexed input  */
+/* into it, recording in num_symbols how many ids the symbol table of the   */
+/* tokens handed out. The function ast_expr parses the same grammar, and    */
+/* like expr it does not recurse, so that only memory bounds how deeply an  */
+/* expression may nest. It reads the operands from left to right, keeping   */
+/* every open parenthesis, and every operator whose right operand is still  */
+/* being read along with its left operand, in a struct ast_frame on a       */
+/* struct ast_stack; there, node is the left operand, op the operator and   */
+/* step its precedence, 1 for + and -, 2 for * and / and 3 for ^, or 0 for  */
+/* a parenthesis. Each operator after an operand first applies the          */
+/* operators on the stack that bind at least as tightly, or only those      */
+/* binding more tightly for the right-associative ^, and a closing          */
+/* parenthesis applies all of them down to its opening one, so that the     */
+/* nodes are appended in the order the grammar gives. ast_expr returns the  */
+/* index of the root, or -1 if the input does not match the grammar,        */
+/* recording why with parse_error. ast_stack_init, ast_push and             */
+/* ast_stack_free work like pt_stack_init, pt_push and pt_stack_free.       */
+/* ast_build also rejects tokens left over after the expression, and copies */
+/* the error code and its offset into the members status and error_offset   */
+/* of the ast, where SP_OK means the tree is complete. ast_node appends a   */
+/* node to the array, taking the value of a number from number, which is    */
+/* NULL for an operator.                                                    */
+/*                                                                          */
+/* With the option -d, which implies -a, ast_build is asked to share        */
+/* structurally identical subtrees, so that the result is a directed        */
+/* acyclic graph rather than a tree: ast_node then looks the node it is     */
+/* about to append up in a hash table, keyed by its type, the indices of    */
+/* its operands and, for an atom, its symbol, or its lexeme if it has none, */
+/* and returns the index of an equal node built before instead of appending */
+/* a second one. A subexpression that occurs many times, like b+282*c, thus */
+/* has a single node, and the array is still in postfix order in the sense  */
+/* that every node follows its operands. The table is made of buckets,      */
+/* num_buckets of them, and of chain, which links the nodes of a bucket;    */
+/* both are allocated from the arena along with the nodes, and buckets is   */
+/* NULL for an unshared tree. spans records, for every node and each of the */
+/* NUM_FORMS output forms (FORM_PAREN, FORM_POSTFIX and FORM_PREFIX), where */
+/* the printer running at the time wrote the text of the node in that form, */
+/* so that a shared node is printed once and later occurrences copy that    */
+/* text. ast_init, called by ast_build, allocates the arrays of an empty    */
+/* AST for up to max_nodes nodes, including the hash table and spans if     */
+/* share is set.                                                            */
+
+struct ast_node {
+   int type;
    char *string;
-   int i;
+   int len;
+   int left;
+   int right;
+   int symbol;
+   struct number number;
+};
 
-   result  = (struct token *)malloc(sizeof(struct token));
-   string = (char *)malloc((token_len + 1) * sizeof(char));
-   if (result == NULL || string == NULL) {
-      printf("Failed to create new token!\n");
-      return NULL;
-   }
-   for (i = 0; i < token_len; ++i)
-      string[i] = init_char[i];
-   string[i] = '\0';
-   
-   result->type = type;
-   result->string = string;
-   result->prev = NULL;
-   result->next = NULL;
+struct ast_span {
+   size_t start;
+   size_t len;
+};
 
-   return result;
-}
+struct ast {
+   struct ast_node *nodes;
+   int num_nodes;
+   int max_nodes;
+   int root;
+   int num_symbols;
+   int *buckets;
+   int *chain;
+   int num_buckets;
+   struct ast_span *spans;
+   int status;
+   int error_offset;
+};
 
-struct token *input_lexer(char *user_input) {
+#define AST_UNPRINTED ((size_t)-1)
 
-   struct token *result = NULL;
-   struct token *new_token_ptr = NULL;
-   int token_len;
-   char *first_char;
+#define FORM_PAREN   SP_FORM_PAREN
+#define FORM_POSTFIX SP_FORM_POSTFIX
+#define FORM_PREFIX  SP_FORM_PREFIX
+#define NUM_FORMS    3
 
-   if (*user_input == '\0')
-      return result;
+struct ast_frame {
+   int node;
+   int step;
+   int top;
+   struct token *op;
+   size_t start[NUM_FORMS];
+};
 
-   while (*user_input != '\0') {
+struct ast_stack {
+   struct ast_frame *frames;
+   int depth;
+   int cap;
+   struct ast_frame local[PT_STACK_LOCAL];
+};
 
-      if (isalpha(*user_input)) {
-         first_char = user_input;
-         ++user_input;
-         while (isalpha(*user_input))
-            ++user_input;
-         token_len = user_input - first_char;
-         new_token_ptr = create_token(ATOM, first_char, token_len);
-         new_token_ptr->prev = result;
-         if (result != NULL)
-            result->next = new_token_ptr;
-         result = new_token_ptr;
-      } else if (isdigit(*user_input)) {
-         first_char = user_input;
-         ++user_input;
-         while (isdigit(*user_input))
-            ++user_input;
-         token_len = user_input - first_char;
-         new_token_ptr = create_token(ATOM, first_char, token_len);
-         new_token_ptr->prev = result;
-         if (result != NULL)
-            result->next = new_token_ptr;
-         result = new_token_ptr;
-      } else {
-         token_len = 1;
-         switch (*user_input) {
-            case '(': new_token_ptr = create_token(LPAREN, user_input, token_len);
-                      break;
-            case ')': new_token_ptr = create_token(RPAREN, user_input, token_len);
-                      break;
-            case '^': new_token_ptr = create_token(EXP, user_input, token_len);
-                      break;
-            case '*': new_token_ptr = create_token(MUL, user_input, token_len);
-                      break;
-            case '/': new_token_ptr = create_token(DIV, user_input, token_len);
-                      break;
-            case '+': new_token_ptr = create_token(ADD, user_input, token_len);
-                      break;
-            case '-': new_token_ptr = create_token(SUB, user_input, token_len);
-                      break;
-            default : printf("Invalid input!\n");
-                      return NULL;
-         }
-      new_token_ptr->prev = result;
-      if (result != NULL)
-         result->next = new_token_ptr;
-      result = new_token_ptr;
-      ++user_input;
-      }
-   }
-
-   while (result->prev != NULL)
-      result = result->prev;
-   return result;
-}
+int ast_build(struct arena *arena, struct token_array *tokens,
+              struct ast *ast, int share);
+int ast_init(struct arena *arena, struct ast *ast, int max_nodes, int share);
+int ast_expr(struct ast *ast, struct token_cursor *cur);
+void ast_stack_init(struct ast_stack *stack);
+struct ast_frame *ast_push(struct ast_stack *stack, int node);
+int ast_grow(struct ast_stack *stack);
+void ast_stack_free(struct ast_stack *stack);
+int ast_node(struct ast *ast, int type, char *string, int len, int left,
+             int right, int symbol, const struct number *number);
 
-struct pt_node *create_node(int type, char *string, int num_childs) {
-   struct pt_node *result;
-   result = (struct pt_node *)malloc(sizeof(struct pt_node));
-   if (result == NULL) {
-      printf("Failed to allocate memory for new node!\n");
-      return NULL;
-   }
-   if (num_childs != 0) {
-      result->child_ptrs = (struct pt_node **)malloc(num_childs * sizeof(struct pt_node *));
-      if (result->child_ptrs == NULL) { 
-         printf("Failed to allocate memory for new node!\n");
-         return NULL;
-      }
-   } else result->child_ptrs = NULL;
-   result->type = type;
-   result->string = string;
-   result->num_childs = num_childs;
-   return result;
-}
+/* The function ast_simplify is an optimization pass over an AST, making a  */
+/* simplified copy of it in result. Every operator whose operands are both  */
+/* constants is folded into a single atom, so that 2*3^2 becomes 18, and    */
+/* the identities x*1, 1*x, x/1, x^1, x-0, x+0 and 0+x are replaced by x.   */
+/* So that the simplified expression has exactly the same value as the      */
+/* original, in double precision as well as in 64-bit integers, only exact  */
+/* results from 0 up to AST_FOLD_LIMIT (2^53) are folded; a subtraction     */
+/* going negative, a division with a remainder or a result too large is     */
+/* left alone (a negative number would not even have a lexeme). If strict   */
+/* is set, x+0 and 0+x are kept as well, since in double precision they     */
+/* turn a negative zero into a positive one. The tree stays shared if it    */
+/* was. ast_constant gives the value of an atom, or -1 if it is not a       */
+/* number within that limit, ast_fold the value of an operator applied to   */
+/* two such constants, or -1 if it is not to be folded, and ast_identity    */
+/* tells which operand, if any, an operator can be replaced by.             */
+/* ast_simplified appends to result, unless that has been done before, the  */
+/* node standing in for a node of the original tree, writing a folded       */
+/* constant out as a new lexeme allocated from the arena.                   */
+/*                                                                          */
+/* Expressions are always simplified before they are compiled, strictly     */
+/* unless -i is given. With the option -s, which implies -a, the forms      */
+/* printed are those of the simplified expression as well.                  */
 
-struct pt_node *expr(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   result = create_node(NEXPR, "", 2);
-   if (result == NULL) {
-      printf("Failed to allocate memory for expr!\n");
-      return NULL;
-   }
-   result->child_ptrs[0] = exprp(lexed_in_ptr);
-   result->child_ptrs[1] = Expr(lexed_in_ptr);
-   return result;
-}
+#define AST_FOLD_LIMIT ((int64_t)1 << 53)
 
-struct pt_node *Expr(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) return NULL;
-   if (*lexed_in_ptr == NULL) {
-      result = create_node(NeXPR, "", 1);
-      if (result == NULL) {
-         printf("Failed to allocate memory for Expr!\n");
-         return NULL;
+int ast_simplify(struct arena *arena, struct ast *ast, int strict,
+                 struct ast *result);
+int64_t ast_constant(struct ast_node *n);
+int64_t ast_fold(int type, int64_t left, int64_t right);
+int ast_identity(int type, int64_t left, int64_t right, int strict);
+int ast_simplified(struct arena *arena, struct ast *ast, int node,
+                   int64_t *values, int *refs, struct ast *result);
+
+/* The printers write their output into a struct strbuf, a growable,        */
+/* null-terminated character buffer. Appending to a strbuf copies only the  */
+/* new characters and grows the buffer geometrically, so producing an       */
+/* output string costs time linear in its length. The function strbuf_init  */
+/* prepares an empty buffer, strbuf_reserve makes room for a given number   */
+/* of additional characters, strbuf_append and strbuf_append_str append a   */
+/* counted or a null-terminated string, strbuf_append_copy appends a copy   */
+/* of text the buffer already holds, strbuf_replace replaces a range of the */
+/* text with a counted string, strbuf_reset empties the buffer while        */
+/* keeping its memory, and strbuf_free releases that memory. If memory runs */
+/* out, the buffer keeps what it held before the failed append and failed   */
+/* is set until it is next reset, so that whoever printed into it can tell  */
+/* that the text is incomplete. The printers also set failed on their       */
+/* output when they run out of memory for their stacks, which stops them    */
+/* early.                                                                   */
+
+struct strbuf {
+   char *data;
+   size_t len;
+   size_t cap;
+   int failed;
+};
+
+void strbuf_init(struct strbuf *buf);
+int strbuf_reserve(struct strbuf *buf, size_t extra);
+void strbuf_append(struct strbuf *buf, const char *str, size_t len);
+void strbuf_append_str(struct strbuf *buf, const char *str);
+void strbuf_append_copy(struct strbuf *buf, size_t start, size_t len);
+void strbuf_replace(struct strbuf *buf, size_t start, size_t deleted,
+                    const char *str, size_t len);
+void strbuf_reset(struct strbuf *buf);
+void strbuf_free(struct strbuf *buf);
+
+/* The function pre_compl_par takes as argument a pointer to the root node  */
+/* of a parse tree produced by expr and appends to a strbuf the completely  */
+/* parenthesized form of the expression to which the parse tree             */
+/* corresponds. Since pre_compl_par may produce an expression with a pair   */
+/* of parentheses around it, strip_parens can be called with the position   */
+/* at which pre_compl_par started writing to remove an unnecessary pair of  */
+/* surrounding parentheses in place. The function compl_par is the          */
+/* composition of strip_parens and pre_compl_par, appending the             */
+/* fully-parenthesized form of the input expression without surrounding     */
+/* parentheses.                                                             */
+
+void pre_compl_par(struct pt_node *head, struct strbuf *out);
+void strip_parens(struct strbuf *out, size_t start);
+void compl_par(struct pt_node *head, struct strbuf *out);
+
+/* The function postfix takes the parse tree produced by expr for an        */
+/* expression with infix binary operators and appends to a strbuf the same  */
+/* expression with postfix binary operators. The function prefix is         */
+/* similar, appending the expression with prefix binary operators. In       */
+/* prefix form the operators of a chain like a-b+c come out in reverse      */
+/* order ("+ - a b c "); prefix_operators writes the operators of such a    */
+/* chain directly into their final positions so that nothing has to be      */
+/* prepended; given a link of the chain as stop, it writes only those of    */
+/* the links before it.                                                     */
+
+void postfix(struct pt_node *head, struct strbuf *out);
+void prefix(struct pt_node *head, struct strbuf *out);
+void prefix_operators(struct pt_node *chain, struct pt_node *stop,
+                      struct strbuf *out);
+
+/* The functions ast_compl_par, ast_postfix and ast_prefix append the       */
+/* fully-parenthesized, postfix and prefix forms of an expression parsed by */
+/* ast_build to a strbuf, producing the same text as compl_par, postfix and */
+/* prefix. Each of them hands the work to ast_pre_all_forms, described      */
+/* below, with only its own form wanted. For a shared tree, the printers    */
+/* first mark every node as AST_UNPRINTED in spans with ast_spans_reset,    */
+/* and ast_pre_all_forms records the span of output each node produced with */
+/* ast_printed; a node met again, and so everything below it, is then       */
+/* printed by ast_print_again with a single copy of the earlier text.       */
+/*                                                                          */
+/* Batch mode needs all three forms of every line, or those chosen with the */
+/* option -f (which interactive mode heeds too), and gets them in a single  */
+/* walk over the tree rather than one walk per form. A struct forms holds a */
+/* strbuf for each form, text, and in out a pointer to the strbuf of every  */
+/* form wanted, or NULL for a form that is not; forms_init, forms_reset and */
+/* forms_free set up, empty and release one, and parse_forms turns the      */
+/* argument of -f, a comma-separated list of the words paren, postfix and   */
+/* prefix, into the set of forms wanted, with bit 1 << f standing for form  */
+/* f, or -1 if it names anything else. all_forms appends the wanted forms   */
+/* of a parse tree to their strbufs, with the help of pre_all_forms, which  */
+/* follows the same paths through the tree as the printers above; its       */
+/* argument top is set while the node is the root of the expression, apart  */
+/* from parentheses, so that the fully-parenthesized form comes out without */
+/* surrounding parentheses and strip_parens is not needed. ast_all_forms    */
+/* and ast_pre_all_forms do the same for a compact tree, the latter writing */
+/* to the strbufs of the forms in out that are not NULL. It walks the tree  */
+/* with a struct ast_stack as well, pushing a frame for every operator it   */
+/* is in the middle of; there, step tells whether the left operand has been */
+/* printed, top is the argument of the same name and start holds where each */
+/* form of the operator began.                                              */
+
+void ast_compl_par(struct ast *ast, struct strbuf *out);
+void ast_postfix(struct ast *ast, int node, struct strbuf *out);
+void ast_prefix(struct ast *ast, int node, struct strbuf *out);
+void ast_spans_reset(struct ast *ast);
+void ast_printed(struct ast *ast, int node, int form, size_t start,
+                 struct strbuf *out);
+int ast_print_again(struct ast *ast, int node, int form, struct strbuf *out);
+
+struct forms {
+   struct strbuf text[NUM_FORMS];
+   struct strbuf *out[NUM_FORMS];
+};
+
+void forms_init(struct forms *forms, int wanted);
+void forms_reset(struct forms *forms);
+void forms_free(struct forms *forms);
+int parse_forms(char *list);
+void all_forms(struct pt_node *head, struct forms *forms);
+void pre_all_forms(struct pt_node *head, struct forms *forms, int top);
+void ast_all_forms(struct ast *ast, struct forms *forms);
+void ast_pre_all_forms(struct ast *ast, int node, struct strbuf **out,
+                       int top);
+
+/* The postfix and prefix forms do not need a tree at all. When only they   */
+/* are wanted, batch mode without -a or -C turns the tokens straight into   */
+/* text with direct_forms, which calls direct_form for each wanted form;    */
+/* direct_form runs the shunting-yard algorithm over the tokens, keeping    */
+/* only a stack of pending operators and left parentheses, taken from the   */
+/* arena, and writing every atom and operator as soon as its place in the   */
+/* output is known. An operator first pops the operators of higher          */
+/* precedence off the stack, and those of equal precedence too unless it is */
+/* ^, which associates to the right. For the prefix form the tokens are     */
+/* read from last to first, with the roles of the parentheses swapped and   */
+/* associativity reversed, which yields the prefix form backwards; it is    */
+/* written from the end of space reserved for it towards the start, just as */
+/* prefix_operators does; direct_token writes a single token in either      */
+/* direction. direct_form returns 0 on success and -1, leaving out as it    */
+/* was, if the tokens are not a well-formed expression, and the line is     */
+/* then parsed as usual so that the parser can report what is wrong with    */
+/* it.                                                                      */
+
+int direct_forms(struct arena *arena, struct token_array *tokens,
+                 struct forms *forms);
+int direct_form(struct arena *arena, struct token_array *tokens, int form,
+                struct strbuf *out);
+size_t direct_token(struct strbuf *out, size_t pos, struct token_array *tokens,
+                    int i, int reverse);
+
+/* An expression parsed by ast_build can also be evaluated. The option -e   */
+/* takes an expression and evaluates it once for every row of a table read  */
+/* from a file or standard input: the first line of the table names the     */
+/* variables, separated by blanks, and every following line holds one value */
+/* per variable in the same order. The value of the expression for each row */
+/* is written on a line of its own, or the word error if the row cannot be  */
+/* read or evaluated. Arithmetic is in double precision, with ^ computed by */
+/* pow, unless the option -i is also given, in which case it is in 64-bit   */
+/* integers: / then truncates, ^ multiplies by repeated squaring and        */
+/* overflow wraps around. For pow the program is linked with the math       */
+/* library.                                                                 */
+/*                                                                          */
+/* A union eval_value holds one number of either kind, and a struct         */
+/* bindings lists the variable names of the table, in column order.         */
+/* number_value gives the value in either kind of the number an atom        */
+/* denotes, taking it from the node, since the lexer parsed it once         */
+/* already; it returns -1 if the number does not fit into 64 bits. eval_pow */
+/* is the integer power.                                                    */
+
+union eval_value {
+   double d;
+   int64_t i;
+};
+
+struct bindings {
+   char **names;
+   int *lens;
+   int num_vars;
+};
+
+int number_value(struct ast_node *n, int integer, union eval_value *value);
+int64_t eval_pow(int64_t base, int64_t exponent);
+
+/* For repeated evaluation, and in the -e mode, an expression is compiled   */
+/* into a struct bytecode for a small stack machine. bc_compile lowers an   */
+/* AST into one by walking it in postfix order from the root, each atom     */
+/* becoming an OP_CONST, which pushes a value from the constant pool        */
+/* consts, or an OP_LOAD, which pushes the value of a variable, and each    */
+/* operator becoming one of OP_ADD through OP_POW, which pop two values and */
+/* push the result; for an unshared tree, the code is simply the nodes in   */
+/* array order. An instruction is a 32-bit word holding the opcode in its   */
+/* low OP_BITS bits and the index of its constant or variable in the bits   */
+/* above, which leaves room for fewer than BC_MAX_INDEX constants,          */
+/* variables and temporaries each; tests/errors.c defines a smaller         */
+/* BC_MAX_INDEX before including simple_parse.c, so that short expressions  */
+/* reach it. The variables are numbered in order of first appearance and    */
+/* their names kept in vars, so a compiled expression does not depend on    */
+/* any particular table; bc_bind maps them by name to the columns of one,   */
+/* returning -1 - i if variable i is not among them. bc_check verifies that */
+/* a program is well formed and works out max_depth, the greatest depth the */
+/* stack reaches, so that bc_run_double and bc_run_int run on a stack       */
+/* allocated once and without bounds checks. They take the values of the    */
+/* variables (in the bytecode's own order), and bc_run_int returns -1 on    */
+/* division by zero. bc_from_expression lexes, parses (sharing subtrees if  */
+/* share is set) and compiles an expression in one go, returning 0, or an   */
+/* error code of sp_parse, SP_ERR_MEMORY or, if an integer program meets a  */
+/* number too large for 64 bits, BC_ERR_NUMBER, with the offset of the      */
+/* culprit in *offset, or BC_ERR_LIMIT, with the offset 0, for a program    */
+/* needing BC_MAX_INDEX constants, variables or temporaries; bc_compile can */
+/* fail with the last three as well, bc_check rejects programs declaring    */
+/* that many constants or variables, and bc_free releases the memory of a   */
+/* bytecode. The function evaluate runs a bytecode for every row of a       */
+/* table, as described below.                                               */
+/*                                                                          */
+/* An operator node of a shared tree that is used more than once is         */
+/* compiled only where the walk first reaches it, followed by an OP_SAVE,   */
+/* which copies the value on top of the stack into the next of num_temps    */
+/* temporaries; every later use becomes an OP_TEMP, which pushes the        */
+/* temporary again. bc_check makes sure that the temporaries are saved in   */
+/* order and only pushed once saved, and counts them: the stack handed to   */
+/* bc_run_double and bc_run_int then needs room for max_depth + num_temps   */
+/* values, the temporaries living above the stack proper.                   */
+/*                                                                          */
+/* With the option -c file, the expression given with -e is compiled and    */
+/* written to the file instead of being evaluated, and the option -x file   */
+/* takes the place of -e, evaluating a bytecode file written that way.      */
+/* bc_write and bc_read store a bytecode as the magic string BC_MAGIC       */
+/* followed by its version, integer flag and the numbers of variables,      */
+/* constants and instructions as 32-bit numbers, then each variable name    */
+/* preceded by its length, the constants as 64-bit numbers and finally the  */
+/* instructions, all in little-endian byte order. bc_read runs bc_check on  */
+/* what it has read, so a damaged file is rejected rather than run.         */
+/* write_u32, write_u64, read_u32 and read_u64 write and read one number.   */
+
+#define OP_CONST 0
+#define OP_LOAD  1
+#define OP_ADD   2
+#define OP_SUB   3
+#define OP_MUL   4
+#define OP_DIV   5
+#define OP_POW   6
+#define OP_SAVE  7
+#define OP_TEMP  8
+#define OP_BITS  8
+
+#define BC_MAGIC   "SPBC"
+#define BC_VERSION 1
+
+#ifndef BC_MAX_INDEX
+#define BC_MAX_INDEX (1 << (32 - OP_BITS))
+#endif
+
+#define BC_ERR_NUMBER -9
+#define BC_ERR_LIMIT  -10
+
+struct bytecode {
+   uint32_t *code;
+   int num_code;
+   union eval_value *consts;
+   int num_consts;
+   struct bindings vars;
+   char *names;
+   int max_depth;
+   int num_temps;
+   int integer;
+};
+
+int bc_from_expression(char *expression, int integer, int share,
+                       struct bytecode *bc, int *offset);
+int bc_compile(struct ast *ast, int integer, struct bytecode *bc);
+int bc_check(struct bytecode *bc);
+int bc_bind(struct bytecode *bc, struct bindings *vars, int *columns);
+double bc_run_double(struct bytecode *bc, const union eval_value *vars,
+                     union eval_value *stack);
+int bc_run_int(struct bytecode *bc, const union eval_value *vars,
+               union eval_value *stack, int64_t *result);
+void bc_free(struct bytecode *bc);
+int bc_write(struct bytecode *bc, FILE *out);
+int bc_read(struct bytecode *bc, FILE *in);
+int write_u32(FILE *out, uint32_t n);
+int write_u64(FILE *out, uint64_t n);
+int read_u32(FILE *in, uint32_t *n);
+int read_u64(FILE *in, uint64_t *n);
+
+/* In double precision a bytecode can also be evaluated a column at a time. */
+/* bc_run_columns takes the values of the variables as a struct of arrays,  */
+/* one array of num_rows doubles per variable of the bytecode (in its own   */
+/* order), and writes the num_rows results to an array out. It runs the     */
+/* program once per block of COLUMN_BLOCK rows rather than once per row:    */
+/* the stack then holds pointers to whole blocks of values, OP_LOAD pushing */
+/* a pointer straight into a column and every other instruction writing a   */
+/* block of its own in the scratch memory, one block per stack level and    */
+/* per temporary. The work per instruction is thus a loop over a block,     */
+/* done by column_kernel, which uses AVX or SSE2 instructions for + - * and */
+/* / where the compiler targets them; ^ calls pow for each element, since a */
+/* vectorized pow would round differently from the one used everywhere      */
+/* else. Dispatch, decoding and stack traffic are paid once per block       */
+/* instead of once per value. bc_run_columns returns -1 if it runs out of   */
+/* memory.                                                                  */
+/*                                                                          */
+/* The function evaluate reads the rows of the table in blocks of           */
+/* EVAL_BLOCK rows, with parse_row, gathers them into columns and, in       */
+/* double precision, evaluates each block with bc_run_columns. Programs in  */
+/* 64-bit integers, and programs compiled to machine code with -J (see      */
+/* below), are run a row at a time instead.                                 */
+
+#define COLUMN_BLOCK 256
+#define EVAL_BLOCK   4096
+
+int bc_run_columns(struct bytecode *bc, double **columns, size_t num_rows,
+                   double *out);
+void column_kernel(int op, double *dst, double *a, double *b, size_t n);
+
+/* With the option -J, double-precision programs are evaluated by machine   */
+/* code generated for them instead of by the interpreter. This is only      */
+/* compiled in while USE_JIT is defined, which is only possible on x86-64   */
+/* with the System V calling convention; elsewhere USE_JIT is undefined     */
+/* again and -J is rejected. jit_compile translates a bytecode into a       */
+/* struct jit_code, whose member run points to a function taking the values */
+/* of the variables (in the bytecode's order) and returning the value of    */
+/* the expression. Every stack level of the program is assigned an SSE      */
+/* register for the whole function, level d living in register xmm(d + 2),  */
+/* so the machine code does no stack traffic and no dispatch at all: each   */
+/* instruction of the bytecode becomes one or two machine instructions.     */
+/* OP_POW becomes a call to pow, around which the live levels below its     */
+/* operands are saved in the native stack frame; the temporaries of OP_SAVE */
+/* and OP_TEMP live in the frame as well, after those JIT_FRAME bytes.      */
+/* Constants are placed after the code and addressed relative to the        */
+/* instruction pointer. Programs deeper than JIT_REGISTERS levels, and      */
+/* integer programs, are not compiled; jit_compile returns 1 for them, and  */
+/* JIT_ERR_MEMORY or JIT_ERR_PROTECT if the memory for the code cannot be   */
+/* had or made executable; the interpreters are then used as before. The    */
+/* code is written into a strbuf by the jit_emit functions, then copied to  */
+/* memory mapped for it, which is made executable (and no longer writable)  */
+/* before it is run; jit_free unmaps it.                                    */
+
+struct jit_code {
+   double (*run)(const union eval_value *vars);
+   void *mem;
+   size_t size;
+};
+
+#ifdef USE_JIT
+
+#define JIT_REGISTERS       14
+#define JIT_FRAME           (8 * JIT_REGISTERS)
+#define JIT_MAX_INSTRUCTION (20 * JIT_REGISTERS + 64)
+#define JIT_RSP             4
+#define JIT_RBX             3
+#define JIT_RIP             (-1)
+
+#define JIT_ERR_MEMORY  -1
+#define JIT_ERR_PROTECT -2
+
+int jit_compile(struct bytecode *bc, struct jit_code *jit);
+void jit_emit_sse(struct strbuf *code, int prefix, int opcode, int reg,
+                  int rm);
+size_t jit_emit_sse_mem(struct strbuf *code, int prefix, int opcode, int reg,
+                        int base, int32_t disp);
+void jit_free(struct jit_code *jit);
+
+#endif
+
+int evaluate(struct bytecode *bc, struct jit_code *jit, FILE *in);
+int parse_row(char *line, int integer, union eval_value *row, int num_vars);
+
+/* Expressions tend to recur in batch input, and with the option -C N batch */
+/* mode keeps the results for up to N distinct input lines in a struct      */
+/* expr_cache, so that a line seen before is answered without being lexed,  */
+/* parsed or printed again. The cache is bounded, evicting the least        */
+/* recently used line when it is full, and counts its hits and misses,      */
+/* which are reported on standard error at the end. Every thread of -j N    */
+/* has a cache of its own. A struct expr_entry holds one expression: its    */
+/* text and its output forms, tab-separated in forms. The entries live in   */
+/* one array; chain links the entries of a bucket of the hash table         */
+/* buckets, and newer and older link all entries in order of use, from      */
+/* newest to oldest.                                                        */
+/*                                                                          */
+/* expr_cache_init prepares a cache for capacity entries, returning -1 if   */
+/* memory runs out, and expr_cache_free releases it. expr_cache_find looks  */
+/* a line up, counting a hit or a miss and making the entry the newest one  */
+/* on a hit. expr_cache_add stores a line together with its rendered forms, */
+/* taking the place of the oldest entry if the cache is full; lines which   */
+/* do not parse are not stored, and their error is reported afresh every    */
+/* time; it returns NULL if memory runs out, and the line then simply stays */
+/* out of the cache. text_hash is the FNV-1a hash used by this cache and by */
+/* shared trees, and expr_cache_unlink takes an entry out of the order of   */
+/* use.                                                                     */
+
+struct expr_entry {
+   struct strbuf text;
+   uint64_t hash;
+   struct strbuf forms;
+   int chain;
+   int newer;
+   int older;
+};
+
+struct expr_cache {
+   struct expr_entry *entries;
+   int capacity;
+   int num_entries;
+   int *buckets;
+   int num_buckets;
+   int newest;
+   int oldest;
+   long hits;
+   long misses;
+};
+
+int expr_cache_init(struct expr_cache *cache, int capacity);
+struct expr_entry *expr_cache_find(struct expr_cache *cache, char *text,
+                                   size_t len);
+struct expr_entry *expr_cache_add(struct expr_cache *cache, char *text,
+                                  size_t len, char *forms, size_t forms_len);
+void expr_cache_unlink(struct expr_cache *cache, int i);
+void expr_cache_report(long hits, long misses);
+void expr_cache_free(struct expr_cache *cache);
+uint64_t text_hash(const char *text, size_t len);
+
+/* The library interface declared in simple_parse.h wraps the stages above  */
+/* in a struct sp_parser. Its arena, tokens and forms are reused from one   */
+/* expression to the next. head or tree points at the parse tree or compact */
+/* tree of the last expression, if one was built, and parsed is set once    */
+/* sp_parse has run; status and error_offset hold what sp_error reports.    */
+/* sp_parse takes the same path through the stages that batch mode always   */
+/* did. With SP_COMPACT it builds a compact tree. Otherwise it uses         */
+/* direct_forms when only the postfix and prefix forms are chosen, and a    */
+/* parse tree when the fully-parenthesized form is chosen, when no form is, */
+/* or when the tokens are malformed, so that the parse tree can tell what   */
+/* is wrong with them. All the chosen forms are written in one walk.        */
+/* render_alone prints a form outside that set into the strbuf alone,       */
+/* parsing the tokens first if the direct path left no tree behind.         */
+/* parser_init and parser_free set up and release a parser that does not    */
+/* live on the heap; sp_parser_new and sp_parser_free wrap them.            */
+/*                                                                          */
+/* sp_parse also remembers its input and its length len, from which         */
+/* edit_text puts an edited expression together, and which sp_edit then     */
+/* keeps up to date. edit_tree applies an edit to the parse tree itself.    */
+/* The member width of every node, set by pt_measure at the first edit,     */
+/* holds the number of characters its subtree covers, and pt_group follows  */
+/* the widths from the root down to the innermost parenthesized group, an   */
+/* Exprppp with three children, whose inside holds the edited range.        */
+/* group_text writes the edited text between its parentheses into scratch.  */
+/* When the parentheses in that text balance, it parses between those of    */
+/* the group exactly when it parses on its own, tokens left over standing   */
+/* where the closing parenthesis was expected. It is therefore lexed and    */
+/* parsed alone, and the subtree it yields takes the place of the old       */
+/* inside of the group, while every other node is kept. A text that closes  */
+/* more groups than it opens takes the group that many levels further out   */
+/* instead, which pt_outer finds. A balanced text that does not parse is    */
+/* kept in an NTEXT leaf, unparsed, with its offset in unparsed_offset, and */
+/* is parsed again along with the next edit.                                */
+/*                                                                          */
+/* So that edits close to one another stay cheap however long the           */
+/* expression, path holds the nodes from the root down to the group edited  */
+/* last, and the next edit climbs only as far up it as the lowest node      */
+/* holding its range as well. Rather than adding the change in length of    */
+/* every edit to the width of every node on the path, edit_tree adds it to  */
+/* pending, which is subtracted from the width of a node as it joins the    */
+/* path and added back as it leaves. An edit in compact mode, one reaching  */
+/* outside every group or making the parentheses of its group unbalanced,   */
+/* and every edit once the text reparsed by edits outweighs the expression  */
+/* go through edit_text, which writes the whole edited text into scratch,   */
+/* swaps it with text and parses it afresh; this also frees the nodes edits */
+/* have replaced. Once an edit has changed the tree, edited is set:         */
+/* sp_render then renders each form alone, those in forms describing the    */
+/* expression as first parsed, and sp_save_tree parses the text afresh      */
+/* first.                                                                   */
+/*                                                                          */
+/* The program itself is a client of this interface. batch_line parses and  */
+/* renders every line through a parser, appending the forms to its output   */
+/* with strbuf_sink. Interactive mode chooses no forms up front and renders */
+/* each one alone after its heading. Both report an expression that cannot  */
+/* be parsed with sp_strerror and the offset sp_error gives, batch_line in  */
+/* place of the forms on its output line. parser_init takes threads from    */
+/* SP_THREADS in the options, 1 if it is not given; beyond 1, sp_parse can  */
+/* split a long expression over that many threads with split_parse, which   */
+/* keeps the pieces in split. Interactive mode passes the number given with */
+/* -j. Batch mode and the server spread their lines and requests over their */
+/* threads instead, so each of their parsers keeps to one.                  */
+
+struct sp_parser {
+   int options;
+   int parsed;
+   int status;
+   int error_offset;
+   struct arena arena;
+   struct token_array tokens;
+   struct forms forms;
+   struct pt_node *head;
+   struct ast ast;
+   struct ast simple;
+   struct ast *tree;
+   struct strbuf alone;
+   char *input;
+   size_t len;
+   int edited;
+   struct pt_node *unparsed;
+   int unparsed_offset;
+   size_t reparsed;
+   struct pt_stack path;
+   int pending;
+   struct strbuf text;
+   struct strbuf scratch;
+   int threads;
+   struct split *split;
+};
+
+void parser_init(struct sp_parser *parser, int options, int forms);
+void parser_free(struct sp_parser *parser);
+void render_alone(struct sp_parser *parser, int form);
+int strbuf_sink(void *arg, const char *text, size_t len);
+void compact_forms(struct sp_parser *parser);
+int forms_status(struct sp_parser *parser);
+
+#define IS_GROUP(node) ((node)->type == NEXPRPPP && (node)->num_childs == 3)
+
+int edit_tree(struct sp_parser *parser, int offset, int deleted,
+              const char *text, int len);
+int edit_text(struct sp_parser *parser, size_t offset, size_t deleted,
+              const char *text, size_t len);
+int pt_measure(struct pt_node *node, struct strbuf *out);
+struct pt_frame *pt_group(struct sp_parser *parser, int start, int end);
+struct pt_frame *pt_outer(struct sp_parser *parser, int rank);
+int group_text(struct pt_node *group, int base, int offset, int deleted,
+               const char *text, int len, struct strbuf *out);
+
+/* sp_save_tree and sp_load_tree store a compact tree in the format         */
+/* described in simple_parse.h. tree_encode appends the encoding of an AST  */
+/* to a strbuf. A first pass over the array of nodes, in which every node   */
+/* follows its operands, counts the nodes each subtree expands into, a      */
+/* shared node being written out wherever it occurs, so the size of every   */
+/* part of the encoding is known before anything is written. A second pass  */
+/* walks the tree in preorder with an explicit stack of node indices,       */
+/* writing the type of every node and the text index of every atom.         */
+/* tree_intern numbers the distinct texts of the atoms in the order they    */
+/* are first met, keeping them in a struct tree_strings: a hash table over  */
+/* text_hash like that of a shared AST, in which buckets and chain link the */
+/* texts and reps holds the first node with each text, and memo, which      */
+/* remembers the text index of every node already interned, so that a       */
+/* shared atom is looked up once.                                           */
+/*                                                                          */
+/* tree_decode checks the header, the offsets of the texts and that every   */
+/* text is a run of letters or digits, and then builds the AST in a single  */
+/* pass over the node types from the last to the first. An atom pushes its  */
+/* node onto a stack and an operator pops its two operands, so the nodes    */
+/* come out in postfix order just as if the expression had been parsed, and */
+/* the tree is shared as it is built if share is set. The atoms point       */
+/* straight into the encoding, an atom taking the index of its text as its  */
+/* symbol and the value that parse_number finds in it once per text, and    */
+/* put_u32 and get_u32 write and read its 32-bit numbers. compact_forms,    */
+/* used by both sp_parse and sp_load_tree, simplifies a new compact tree if */
+/* SP_SIMPLIFY is set and writes the chosen forms from it. forms_status     */
+/* then turns a chosen form that could not be written in full into          */
+/* SP_ERR_MEMORY, which sp_parse and sp_load_tree return. The option -w     */
+/* file of interactive mode writes the tree of the expression entered to a  */
+/* file with file_sink, and the option -r file reads it back in place of an */
+/* expression, mapping the file or else reading it with read_file, which    */
+/* reads the rest of a stream into a strbuf.                                */
+
+#define TREE_MAGIC     "SPTR"
+#define TREE_VERSION   1
+#define TREE_HEADER    24
+#define TREE_MAX_NODES 0x7fffffff
+
+struct tree_strings {
+   int *memo;
+   int *reps;
+   int *chain;
+   int *buckets;
+   int num_buckets;
+   int num_strings;
+   size_t bytes;
+};
+
+int tree_encode(struct arena *arena, struct ast *ast, struct strbuf *out);
+int tree_intern(struct ast *ast, int node, struct tree_strings *strings);
+int tree_decode(struct arena *arena, const unsigned char *data, size_t size,
+                int share, struct ast *ast);
+int file_sink(void *arg, const char *data, size_t len);
+int read_file(FILE *in, struct strbuf *data);
+void put_u32(unsigned char *p, uint32_t n);
+uint32_t get_u32(const unsigned char *p);
+
+/* Given the option -b, the program runs in batch mode instead: the         */
+/* function batch reads newline-delimited expressions from a file (standard */
+/* input if no file is named) and writes one line of output per line of     */
+/* input, holding the fully-parenthesized, postfix and prefix forms         */
+/* separated by tabs. No prompts are printed, and all output goes through a */
+/* fully buffered stdout. A single struct sp_parser and pair of strbufs are */
+/* reused for every line. How the lines are parsed is given to the batch    */
+/* functions as options, a combination of the flags OPT_COMPACT, set by -a, */
+/* OPT_SHARE, set by -d, and OPT_SIMPLIFY, set by -s, which together make   */
+/* up OPT_PARSER, and the set of forms chosen with -f, shifted into the     */
+/* bits OPT_FORMS. batch_parser_init sets up a parser for these options.    */
+/* The function read_line, which also reads the expression in interactive   */
+/* mode, reads the next line of input into a strbuf, without its line       */
+/* terminator and regardless of its length; it returns 1 if a line was      */
+/* read, 0 at end of input and -1 on a read error.                          */
+
+/* A named input file is mapped into memory with map_file where possible,   */
+/* and batch_mapped then works through the mapping in place. Since tokens   */
+/* and tree nodes only point at their lexemes, the lines are lexed, parsed  */
+/* and printed straight out of the mapping without being copied. map_file   */
+/* returns NULL if the file cannot be mapped (for example because it is     */
+/* empty or not a regular file), in which case batch reads it instead. The  */
+/* function batch_line does the work for one line: it parses the line with  */
+/* sp_parse and appends the output line, made up of the forms rendered by   */
+/* sp_render, to a strbuf. batch_block does the same for every line of a    */
+/* block of input text, and block_length returns the length of the block of */
+/* whole lines, about BATCH_BLOCK_SIZE bytes long, at the start of some     */
+/* input.                                                                   */
+
+#define BATCH_OUTPUT_BUFFER 65536
+#define BATCH_BLOCK_SIZE    65536
+
+#define OPT_COMPACT  SP_COMPACT
+#define OPT_SHARE    SP_SHARE
+#define OPT_SIMPLIFY SP_SIMPLIFY
+#define OPT_PARSER   (OPT_COMPACT | OPT_SHARE | OPT_SIMPLIFY)
+
+#define OPT_FORMS_SHIFT 4
+#define OPT_FORMS       (7 << OPT_FORMS_SHIFT)
+
+int batch(FILE *in, int options, int cache_size);
+int batch_mapped(char *data, size_t size, int options, int cache_size);
+void batch_parser_init(struct sp_parser *parser, int options);
+void batch_block(struct sp_parser *parser, char *data, size_t size,
+                 struct expr_cache *cache, struct strbuf *out);
+void batch_line(struct sp_parser *parser, char *line, size_t len,
+                struct expr_cache *cache, struct strbuf *out);
+size_t block_length(char *data, size_t size);
+int read_line(FILE *in, struct strbuf *line);
+char *map_file(char *path, size_t *size);
+void unmap_file(char *data, size_t size);
+
+/* With the option -j N, batch mode runs on N worker threads (N > 1, and    */
+/* only while USE_THREADS is defined). The work is handed out in blocks of  */
+/* lines, struct batch_jobs, kept in the ring of slots of a struct          */
+/* batch_pool. The main thread fills free slots with blocks of input using  */
+/* fill_job, either pointing a job into the mapped file or copying lines    */
+/* read from a stream into the job, and writes finished jobs to stdout      */
+/* strictly in the order they were filled, so the ring doubles as the       */
+/* reorder buffer; it holds JOBS_PER_THREAD jobs per worker, which bounds   */
+/* the memory in flight. Each worker, running batch_worker, repeatedly      */
+/* takes the oldest queued job and renders it into the job's own output     */
+/* strbuf with an arena and token_array of its own, so the workers share    */
+/* nothing but the pool. The members next_fill, next_run and next_write     */
+/* count the jobs filled, taken by a worker and written out; job number k   */
+/* lives in slot k % num_jobs of the ring. batch_parallel runs the whole    */
+/* batch, reading from the mapping data if it is not NULL and from the      */
+/* stream in otherwise.                                                     */
+
+#ifdef USE_THREADS
+
+#define JOBS_PER_THREAD 4
+
+struct batch_job {
+   char *data;
+   size_t size;
+   struct strbuf copy;
+   struct strbuf out;
+   int done;
+};
+
+struct batch_pool {
+   pthread_mutex_t lock;
+   pthread_cond_t queued;
+   pthread_cond_t finished;
+   struct batch_job *jobs;
+   int num_jobs;
+   long next_fill;
+   long next_run;
+   long next_write;
+   int end_of_input;
+   int options;
+   int cache_size;
+   long cache_hits;
+   long cache_misses;
+};
+
+int batch_parallel(FILE *in, char *data, size_t size, int options,
+                   int cache_size, int num_threads);
+int fill_job(struct batch_job *job, FILE *in, char **data, size_t *size,
+             struct strbuf *line);
+void *batch_worker(void *arg);
+
+#endif
+
+/* Without -b, -j N splits the one expression the program reads over N      */
+/* threads instead, through the member threads of its parser, set with      */
+/* SP_THREADS. sp_parse then tries split_parse before anything else unless  */
+/* the parser is compact, and takes the usual path whenever split_parse     */
+/* returns -1. The tokens are still produced by a single input_lexer.       */
+/* split_parse cuts their array into one slice per thread, but no more than */
+/* one per SPLIT_MIN_TOKENS tokens, each described by a struct split_chunk  */
+/* of the parser's struct split, which knows its index among them; the      */
+/* chunks are allocated one by one, so that a later parse over more threads */
+/* can grow the array of them without moving any, and split_run runs a      */
+/* function on all the chunks at once: on chunk 0 in the calling thread,    */
+/* and on every other chunk in a thread of its own started through          */
+/* split_thread, or in the calling thread if it cannot be started. First    */
+/* split_scan finds the change in parenthesis depth across each slice and   */
+/* the lowest depth reached in it; adding up the changes gives the depth at */
+/* which every slice starts, and parentheses that do not balance are left   */
+/* to the usual path to report. Then split_find, starting from that depth,  */
+/* finds the first + or - and the first * or / outside all parentheses in   */
+/* each slice. If any + or - lies outside all parentheses, level is ADD and */
+/* the chunks are split at one such operator in every slice but the first;  */
+/* otherwise level is MUL and they are split at * and / alike, since a      */
+/* split at * next to a + outside parentheses would take an operand of the  */
+/* + apart.                                                                 */
+/*                                                                          */
+/* split_expr parses each chunk with expr, in an arena of its own, as an    */
+/* expression of its own. The operator at which a chunk was split off       */
+/* becomes its node, the link of the operator chain of the given level that */
+/* would have held the first operand of the chunk, and tail is the slot     */
+/* holding the empty link at the end of the chain of the chunk. Putting the */
+/* node of every chunk into the tail of the one before gives exactly the    */
+/* tree that expr gives for the whole expression, associating to the left   */
+/* as always, so that nothing else needs to know how it was built; head     */
+/* then points at it, and chain at the node whose chain was split, the root */
+/* for ADD and its first child for MUL. A chunk that does not parse makes   */
+/* split_parse give up, so that the usual path reports the error as it      */
+/* always has. split_render prints the forms from such a tree into the      */
+/* strbufs out, where a form not wanted has NULL: split_print prints the    */
+/* operands of the links of each chunk, preceded or followed by their       */
+/* operators, into the forms of the chunk with pre_all_forms, the           */
+/* fully-parenthesized form of the chunk closing a parenthesis after every  */
+/* operand, and the operators of the chunk for the prefix form into ops.    */
+/* The pieces are then put together in order, after as many opening         */
+/* parentheses as the chain has operators in the fully-parenthesized form   */
+/* and after the operators of every chunk, the last one first, in the       */
+/* prefix form.                                                             */
+
+#ifdef USE_THREADS
+
+#define SPLIT_MIN_TOKENS 32768
+
+struct split_chunk {
+   struct split *split;
+   int index;
+   void (*work)(struct split_chunk *chunk);
+   pthread_t thread;
+   int started;
+   struct arena arena;
+   int begin;
+   int end;
+   int depth;
+   int lowest;
+   int first_add;
+   int first_mul;
+   int status;
+   struct pt_node *node;
+   struct pt_node **tail;
+   int num_ops;
+   struct forms forms;
+   struct strbuf ops;
+};
+
+struct split {
+   struct split_chunk **chunks;
+   int num_chunks;
+   int cap;
+   int level;
+   struct strbuf **out;
+   struct token_array *tokens;
+   struct pt_node *chain;
+};
+
+int split_parse(struct sp_parser *parser);
+int split_slices(struct split *split, int num_slices);
+void split_render(struct split *split, struct strbuf **out);
+void split_run(struct split *split, int count,
+               void (*work)(struct split_chunk *chunk));
+void *split_thread(void *arg);
+void split_scan(struct split_chunk *chunk);
+void split_find(struct split_chunk *chunk);
+void split_expr(struct split_chunk *chunk);
+void split_print(struct split_chunk *chunk);
+void split_reset(struct split *split);
+void split_free(struct split *split);
+
+#endif
+
+/* With the option -l address the program runs as a server instead (only    */
+/* while USE_SERVER is defined, which needs Linux and USE_THREADS), so that */
+/* a program that needs the forms of many expressions can connect once      */
+/* rather than start the program for each one. It listens on a Unix domain  */
+/* socket if address is a path, and on a TCP port if address has the form   */
+/* host:port or :port, the latter listening on every interface. A client    */
+/* sends requests and reads replies on the same connection, and may send    */
+/* any number of requests before reading the first reply; the replies come  */
+/* back in the order of the requests. A request is a 4-byte length n,       */
+/* followed by n bytes: a byte holding the forms wanted, with bit 1 << f    */
+/* standing for form f as for sp_parser_new, and the expression itself in   */
+/* the remaining n - 1 bytes. A forms byte of 0 asks for the forms chosen   */
+/* with -f. A reply is a 4-byte length n, followed by n bytes: a status     */
+/* byte, the negated error code of sp_parse (so 0 for success), and then    */
+/* either the forms asked for, separated by tabs as in batch mode, or, for  */
+/* an expression that cannot be parsed, the 4-byte offset reported by       */
+/* sp_error. All lengths and offsets are unsigned and little-endian, like   */
+/* the numbers in compiled expression files. A connection on which a        */
+/* request longer than SERVER_MAX_REQUEST bytes, or one without its forms   */
+/* byte, arrives is closed. The options -a, -d and -s apply as in batch     */
+/* mode, and -j N gives the number of worker threads, 1 by default.         */
+/*                                                                          */
+/* Each worker, running server_worker, waits on an epoll instance of its    */
+/* own, in which it has registered the listening socket and every           */
+/* connection it has accepted; the kernel wakes only one of the workers     */
+/* blocked on the listening socket when a connection arrives                */
+/* (EPOLLEXCLUSIVE), and from then on the connection belongs to that worker */
+/* alone. A worker parses with a struct sp_parser of its own, so the        */
+/* workers share nothing but the listening socket, and the arena of the     */
+/* parser is reused from one request to the next. A struct server_conn      */
+/* holds the state of a connection: the bytes received but not yet taken as */
+/* requests, from in_pos on, and the replies not yet sent, from out_pos on. */
+/* server_serve handles an event on a connection: it reads what has         */
+/* arrived, answers every complete request with server_request and sends as */
+/* much of the replies as the socket takes, and it stops reading from a     */
+/* client while more than SERVER_OUT_LIMIT bytes of replies wait to be      */
+/* sent, so that a client that does not read its replies cannot make the    */
+/* server run out of memory. server_listen creates the listening socket,    */
+/* removing a stale Unix domain socket left by an earlier run, and put_u32  */
+/* and get_u32 write and read the numbers of the protocol.                  */
+
+#ifdef USE_SERVER
+
+#define SERVER_MAX_REQUEST (64 * 1024 * 1024)
+#define SERVER_OUT_LIMIT   (1024 * 1024)
+#define SERVER_READ_CHUNK  65536
+#define SERVER_EVENTS      64
+#define SERVER_HOST_MAX    256
+
+struct server_conn {
+   int fd;
+   struct strbuf in;
+   size_t in_pos;
+   struct strbuf out;
+   size_t out_pos;
+   int eof;
+   uint32_t events;
+};
+
+struct server_worker {
+   pthread_t thread;
+   int epoll_fd;
+   int listen_fd;
+   int options;
+};
+
+int server(char *address, int options, int num_workers);
+int server_listen(char *address);
+void *server_worker(void *arg);
+void server_accept(struct server_worker *worker);
+void server_serve(struct server_worker *worker, struct sp_parser *parser,
+                  struct server_conn *conn, uint32_t events);
+int server_requests(struct sp_parser *parser, struct server_conn *conn);
+int server_request(struct sp_parser *parser, int forms, char *text,
+                   size_t len, struct strbuf *out);
+int server_flush(struct server_conn *conn);
+void server_compact(struct strbuf *buf, size_t *pos);
+void server_close(struct server_worker *worker, struct server_conn *conn);
+#endif
+
+#ifndef SIMPLE_PARSE_NO_MAIN
+
+int main(int argc, char **argv) {
+
+   static const char *headings[NUM_FORMS] = {
+      "The fully-parenthesized form of the expression:",
+      "The expression with postfix binary operators:",
+      "The expression with prefix binary operators:"
+   };
+   struct strbuf line;
+   int i;
+   int options = OPT_FORMS;
+   int wanted;
+   int batch_mode = 0;
+   int num_threads = 1;
+   int cache_size = 0;
+   int integer = 0;
+   char *expression = NULL;
+   char *code_file = NULL;
+   char *compile_file = NULL;
+   struct bytecode bc;
+   struct jit_code *jit;
+#ifdef USE_JIT
+   int use_jit = 0;
+   struct jit_code native;
+#endif
+   char *batch_file = NULL;
+   char *tree_out = NULL;
+   char *tree_in = NULL;
+#ifdef USE_SERVER
+   char *listen_address = NULL;
+#endif
+   char *mapped;
+   size_t mapped_size;
+   size_t offset;
+   int error_offset;
+   FILE *in;
+   FILE *compiled;
+   FILE *saved;
+   struct sp_parser parser;
+   struct strbuf out;
+
+#ifdef DEBUG_STATS
+   stats_init();
+#endif
+   for (i = 1; i < argc; ++i) {
+      if (strcmp(argv[i], "-a") == 0) {
+         options |= OPT_COMPACT;
+      } else if (strcmp(argv[i], "-d") == 0) {
+         options |= OPT_COMPACT | OPT_SHARE;
+      } else if (strcmp(argv[i], "-s") == 0) {
+         options |= OPT_COMPACT | OPT_SIMPLIFY;
+      } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc &&
+                 (wanted = parse_forms(argv[i + 1])) > 0) {
+         options = (options & ~OPT_FORMS) | wanted << OPT_FORMS_SHIFT;
+         ++i;
+      } else if (strcmp(argv[i], "-b") == 0) {
+         batch_mode = 1;
+      } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc &&
+                 atoi(argv[i + 1]) > 0) {
+         num_threads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc &&
+                 atoi(argv[i + 1]) > 0) {
+         cache_size = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+         expression = argv[++i];
+      } else if (strcmp(argv[i], "-i") == 0) {
+         integer = 1;
+      } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+         compile_file = argv[++i];
+      } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+         code_file = argv[++i];
+      } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+         tree_out = argv[++i];
+      } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+         tree_in = argv[++i];
+#ifdef USE_JIT
+      } else if (strcmp(argv[i], "-J") == 0) {
+         use_jit = 1;
+#endif
+#ifdef USE_SERVER
+      } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+         listen_address = argv[++i];
+#endif
+      } else if ((batch_mode || expression != NULL || code_file != NULL) &&
+                 batch_file == NULL &&
+                 argv[i][0] != '-') {
+         batch_file = argv[i];
+      } else {
+         printf("Usage: %s [-a] [-d] [-s] [-f forms] [-j N] [-C N] [-b [file]]\n"
+                "       %s [-a] [-d] [-s] [-f forms] [-j N] [-w tree] [-r tree]\n"
+                "       %s [-a] [-d] [-s] [-f forms] [-j N] -l address\n"
+                "       %s [-i] [-d] [-J] -e expression [-c code] [file]\n"
+                "       %s [-J] -x code [file]\n"
+                "   -a   parse into a compact abstract syntax tree\n"
+                "   -d   share identical subexpressions in that tree\n"
+                "   -s   write the forms of the simplified expression\n"
+                "   -f   write only the forms listed, separated by commas,\n"
+                "        out of paren, postfix and prefix\n"
+                "   -b   read one expression per line from file or standard\n"
+                "        input and write the three forms per line\n"
+                "   -j   spread batch mode, the server or a single long\n"
+                "        expression over N threads\n"
+                "   -C   remember the output for up to N distinct lines\n"
+                "   -w   write the tree of the expression to the file tree\n"
+                "   -r   read the tree of the expression from the file tree\n"
+                "        instead of asking for the expression\n"
+                "   -l   serve requests on the Unix domain socket at the\n"
+                "        path address, or on the TCP port host:port\n"
+                "   -e   evaluate the expression for every row of a table\n"
+                "        of variable values in file or standard input\n"
+                "   -i   evaluate in 64-bit integer arithmetic\n"
+                "   -c   compile the expression into the file code instead\n"
+                "   -x   evaluate the expression compiled into the file\n"
+                "        code\n"
+                "   -J   evaluate with machine code compiled for the\n"
+                "        expression where possible\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0]);
+         return 1;
       }
-      result->child_ptrs[0] = epsilon();
-      return result;
    }
-   if ((*lexed_in_ptr)->type == ADD ||
-       (*lexed_in_ptr)->type == SUB) {
-      result = create_node(NeXPR, "", 3);
-      if (result == NULL) {
-         printf("Failed to allocate memory for Expr!\n");
-         return NULL;
+
+   if (expression != NULL || code_file != NULL) {
+      jit = NULL;
+      if (code_file != NULL) {
+         in = fopen(code_file, "rb");
+         if (in == NULL) {
+            printf("Failed to open %s!\n", code_file);
+            return 1;
+         }
+         i = bc_read(&bc, in);
+         fclose(in);
+         if (i < 0) {
+            printf("%s does not hold a compiled expression!\n", code_file);
+            return 1;
+         }
       }
-      switch((*lexed_in_ptr)->type) {
-         case ADD:
-                   result->child_ptrs[0] = add(lexed_in_ptr);
-                   break;
-         case SUB:
-                   result->child_ptrs[0] = sub(lexed_in_ptr);
-                   break;
+      else if ((i = bc_from_expression(expression, integer,
+                                       options & OPT_SHARE, &bc,
+                                       &error_offset)) < 0) {
+         if (i == SP_ERR_MEMORY)
+            printf("Failed to allocate memory for bytecode!\n");
+         else if (i == BC_ERR_NUMBER)
+            printf("Number %.*s is too large!\n",
+                   (int)(skip_run(expression + error_offset + 1,
+                                  expression + strlen(expression),
+                                  CC_DIGIT) - (expression + error_offset)),
+                   expression + error_offset);
+         else if (i == BC_ERR_LIMIT)
+            printf("Expression is too large to compile!\n");
+         else
+            printf("Invalid input: %s at offset %d!\n", sp_strerror(i),
+                   error_offset);
+         return 1;
       }
-      result->child_ptrs[1] = exprp(lexed_in_ptr);
-      result->child_ptrs[2] = Expr(lexed_in_ptr);
-      return result;
-   } else {
-      result = create_node(NeXPR, "", 1);
-      if (result == NULL) {
-         printf("Failed to allocate memory for Expr!\n");
-         return NULL;
+      if (compile_file != NULL) {
+         compiled = fopen(compile_file, "wb");
+         if (compiled == NULL) {
+            printf("Failed to open %s!\n", compile_file);
+            bc_free(&bc);
+            return 1;
+         }
+         i = bc_write(&bc, compiled);
+         if (fclose(compiled) != 0 || i < 0) {
+            printf("Failed to write %s!\n", compile_file);
+            i = -1;
+         }
+         bc_free(&bc);
+         return i < 0;
       }
-      result->child_ptrs[0] = epsilon();
-      return result;
+#ifdef USE_JIT
+      i = use_jit ? jit_compile(&bc, &native) : 1;
+      if (i == 0)
+         jit = &native;
+      else if (i < 0)
+         printf(i == JIT_ERR_MEMORY ?
+                "Failed to allocate memory for machine code!\n" :
+                "Failed to make machine code executable!\n");
+#endif
+      in = batch_file == NULL ? stdin : fopen(batch_file, "r");
+      if (in == NULL) {
+         printf("Failed to open %s!\n", batch_file);
+         i = 1;
+      } else {
+         i = evaluate(&bc, jit, in);
+         if (in != stdin)
+            fclose(in);
+      }
+#ifdef USE_JIT
+      if (jit == &native)
+         jit_free(&native);
+#endif
+      bc_free(&bc);
+      return i;
    }
-}
 
+#ifdef USE_SERVER
+   if (listen_address != NULL)
+      return server(listen_address, options, num_threads);
+#endif
 
-struct pt_node *exprp(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   result = create_node(NEXPRP, "", 2);
-   if (result == NULL) {
-      printf("Failed to allocated memory for exprp!\n");
-      return NULL;
+   if (batch_mode) {
+      mapped_size = 0;
+      mapped = batch_file == NULL ? NULL : map_file(batch_file, &mapped_size);
+      if (mapped == NULL && batch_file != NULL) {
+         in = fopen(batch_file, "r");
+         if (in == NULL) {
+            printf("Failed to open %s!\n", batch_file);
+            return 1;
+         }
+      } else
+         in = stdin;
+#ifdef USE_THREADS
+      if (num_threads > 1)
+         i = batch_parallel(in, mapped, mapped_size, options, cache_size,
+                            num_threads);
+      else
+#endif
+      if (mapped != NULL)
+         i = batch_mapped(mapped, mapped_size, options, cache_size);
+      else
+         i = batch(in, options, cache_size);
+      if (mapped != NULL)
+         unmap_file(mapped, mapped_size);
+      else if (in != stdin)
+         fclose(in);
+      return i;
    }
-   result->child_ptrs[0] = exprpp(lexed_in_ptr);
-   result->child_ptrs[1] = Exprp(lexed_in_ptr);
-   return result;
-}
 
-struct pt_node *Exprp(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) return NULL;
-   if (*lexed_in_ptr == NULL) {
-      result = create_node(NeXPRP, "", 1);
-      if (result == NULL) {
-         printf("Failed to allocate memory for Exprp!\n");
-         return NULL;
+   wanted = options >> OPT_FORMS_SHIFT;
+   parser_init(&parser, (options & OPT_PARSER) | SP_THREADS(num_threads), 0);
+   strbuf_init(&line);
+   mapped = NULL;
+   mapped_size = 0;
+   if (tree_in != NULL) {
+      mapped = map_file(tree_in, &mapped_size);
+      if (mapped == NULL) {
+         in = fopen(tree_in, "rb");
+         if (in == NULL) {
+            printf("Failed to open %s!\n", tree_in);
+            parser_free(&parser);
+            return 1;
+         }
+         i = read_file(in, &line);
+         fclose(in);
+         if (i < 0) {
+            printf("Failed to read %s!\n", tree_in);
+            parser_free(&parser);
+            strbuf_free(&line);
+            return 1;
+         }
       }
-      result->child_ptrs[0] = epsilon();
-      return result;
-   }
-   if ((*lexed_in_ptr)->type == MUL ||
-       (*lexed_in_ptr)->type == DIV) {
-      result = create_node(NeXPRP, "", 3);
-      if (result == NULL) {
-         printf("Failed to allocate memory for Exprp!\n");
-         return NULL;
+      i = sp_load_tree(&parser, mapped != NULL ? mapped : line.data,
+                       mapped != NULL ? mapped_size : line.len);
+      if (i != SP_OK)
+         printf("%s does not hold a parse tree!\n", tree_in);
+   } else {
+      printf("\nPlease enter an arithmetic expression in infix form. The expression may\n"
+             "contain integer numbers, variable names, parentheses, and the operators\n"
+             "^ (exponentiation), * (multiplication), / (division), + (addition), and\n"
+             "- (subtraction). Variable names may contain lower-case letters and\n"
+             "upper-case letters, but may not contain any other type of character. The\n"
+             "expression must not contain any spaces.\n"
+             "\nExample:\n"
+             "   (a+3)+var^(b+282*c)\n\n"
+             ">> ");
+      if (read_line(stdin, &line) <= 0) {
+         printf("Error receiving input!\n");
+         parser_free(&parser);
+         strbuf_free(&line);
+         return 1;
       }
-      switch((*lexed_in_ptr)->type) {
-         case MUL:
-                   result->child_ptrs[0] = mul(lexed_in_ptr);
-                   break;
-         case DIV:
-                   result->child_ptrs[0] = quo(lexed_in_ptr);
-                   break;
+
+      /* The strbuf line now holds the expression the user has entered,
+         however long it is.                                              */
+
+      if ((i = sp_parse(&parser, line.data, line.len)) != SP_OK) {
+         sp_error(&parser, &offset);
+         printf("\nInvalid input: %s at offset %lu!\n\n", sp_strerror(i),
+                (unsigned long)offset);
       }
-      result->child_ptrs[1] = exprpp(lexed_in_ptr);
-      result->child_ptrs[2] = Exprp(lexed_in_ptr);
-      return result;
-   } else {
-      result = create_node(NeXPRP, "", 1);
-      if (result == NULL) {
-         printf("Failed to allocate memory for Expr!\n");
-         return NULL;
+   }
+   if (i == SP_OK) {
+      strbuf_init(&out);
+      for (i = 0; i < NUM_FORMS; ++i)
+         if (wanted & 1 << i) {
+            printf("\n%s\n", headings[i]);
+            strbuf_reset(&out);
+            if (sp_render(&parser, i, strbuf_sink, &out) == 0)
+               printf("     %s\n", out.data);
+            else
+               printf("     Failed to allocate memory for the form!\n");
+         }
+      printf("\n");
+      strbuf_free(&out);
+      i = SP_OK;
+      if (tree_out != NULL) {
+         saved = fopen(tree_out, "wb");
+         if (saved == NULL) {
+            printf("Failed to open %s!\n", tree_out);
+            i = -1;
+         } else {
+            i = sp_save_tree(&parser, file_sink, saved);
+            if (fclose(saved) != 0 || i != 0) {
+               printf("Failed to write %s!\n", tree_out);
+               i = -1;
+            }
+         }
       }
-      result->child_ptrs[0] = epsilon();
-      return result;
    }
+   if (mapped != NULL)
+      unmap_file(mapped, mapped_size);
+   parser_free(&parser);
+   strbuf_free(&line);
+
+   return i != SP_OK;
 }
 
+#endif
 
-struct pt_node *exprpp(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   struct pt_node *temp_result;
-   if (lexed_in_ptr == NULL) return NULL;
-   if (*lexed_in_ptr == NULL) return NULL;
-   if ((*lexed_in_ptr)->type == ATOM) {
-      if ((*lexed_in_ptr)->next != NULL &&
-          (*lexed_in_ptr)->next->type == EXP) {
-         result = create_node(NEXPRPP, "", 3);
-         if (result == NULL) {
-            printf("Failed to allocate memory for exprpp!\n");
-            return NULL;
-         }
-         result->child_ptrs[0] = exprppp(lexed_in_ptr);
-         result->child_ptrs[1] = expo(lexed_in_ptr);
-         result->child_ptrs[2] = exprpp(lexed_in_ptr);
-         return result;
-      } else {
-         result = create_node(NEXPRPP, "", 1);
-         if (result == NULL) {
-            printf("Failed to allocate memory for exprpp!\n");
-            return NULL;
-         }
-         result->child_ptrs[0] = exprppp(lexed_in_ptr);
-         return result;
-      }
-   } else {
-      struct token *lookahead = *lexed_in_ptr;
-      while (lookahead != NULL && lookahead->type != RPAREN)
-         lookahead = lookahead->next;
-      if (lookahead == NULL) {
-         printf("Invalid input!\n");
-         return NULL;
-      } else {
-         if (lookahead->next != NULL && lookahead->next->type == EXP) {
-            result = create_node(NEXPRPP, "", 3);
-            if (result == NULL) {
-               printf("Failed to allocate memory for exprpp!\n");
-               return NULL;
-            }
-            result->child_ptrs[0] = exprppp(lexed_in_ptr);
-            result->child_ptrs[1] = expo(lexed_in_ptr);
-            result->child_ptrs[2] = exprpp(lexed_in_ptr);
-            return result;
-         } else {
-            result = create_node(NEXPRPP, "", 1);
-            if (result == NULL) {
-               printf("Failed to allocate memory for exprpp!\n");
-               return NULL;
-            }
-            result->child_ptrs[0] = exprppp(lexed_in_ptr);
-            return result;
-         }
-      } 
+struct sp_parser *sp_parser_new(int options, int forms) {
+   struct sp_parser *parser;
+   parser = (struct sp_parser *)malloc(sizeof(struct sp_parser));
+   if (parser == NULL)
+      return NULL;
+   parser_init(parser, options, forms);
+   return parser;
+}
+
+void parser_init(struct sp_parser *parser, int options, int forms) {
+   parser->options = options;
+   parser->parsed = 0;
+   parser->status = SP_OK;
+   parser->error_offset = 0;
+   arena_init(&parser->arena);
+   token_array_init(&parser->tokens);
+   parser->tokens.intern = (options & OPT_COMPACT) != 0;
+   forms_init(&parser->forms, forms);
+   parser->head = NULL;
+   parser->tree = NULL;
+   strbuf_init(&parser->alone);
+   parser->input = NULL;
+   parser->len = 0;
+   parser->edited = 0;
+   parser->unparsed = NULL;
+   parser->unparsed_offset = 0;
+   parser->reparsed = 0;
+   pt_stack_init(&parser->path);
+   parser->pending = 0;
+   strbuf_init(&parser->text);
+   strbuf_init(&parser->scratch);
+   parser->threads = options >> SP_THREADS_SHIFT > 1 ?
+                     options >> SP_THREADS_SHIFT : 1;
+   parser->split = NULL;
+}
+
+int sp_parse(struct sp_parser *parser, const char *buf, size_t len) {
+   struct token_cursor cur;
+   int wanted;
+   int f;
+
+   /* The tokens and trees only ever read the input, so the const can be
+      cast away.                                                       */
+   sp_reset(parser);
+   parser->parsed = 1;
+   parser->input = buf != NULL ? (char *)buf : "";
+   parser->len = len;
+   parser->status = input_lexer(&parser->tokens, (char *)buf, len);
+   if (parser->status < 0) {
+      parser->error_offset = parser->tokens.error_offset;
+      return parser->status;
+   }
+   parser->status = SP_OK;
+   for (f = 0, wanted = 0; f < NUM_FORMS; ++f)
+      if (parser->forms.out[f] != NULL)
+         wanted |= 1 << f;
+   if (parser->options & OPT_COMPACT) {
+      ast_build(&parser->arena, &parser->tokens, &parser->ast,
+                parser->options & OPT_SHARE);
+      parser->status = parser->ast.status;
+      parser->error_offset = parser->ast.error_offset;
+      if (parser->status != SP_OK)
+         return parser->status;
+      compact_forms(parser);
+#ifdef USE_THREADS
+   } else if (parser->threads > 1 && split_parse(parser) == 0) {
+      if (wanted != 0)
+         split_render(parser->split, parser->forms.out);
+#endif
+   } else if (wanted == 0 || (wanted & 1 << FORM_PAREN) ||
+              direct_forms(&parser->arena, &parser->tokens,
+                           &parser->forms) < 0) {
+      forms_reset(&parser->forms);
+      token_cursor_init(&cur, &parser->tokens);
+      parser->head = expr(&parser->arena, &cur);
+      parser->status = cur.status;
+      parser->error_offset = cur.error_offset;
+      if (parser->status != SP_OK)
+         return parser->status;
+      if (wanted != 0)
+         all_forms(parser->head, &parser->forms);
    }
+   return forms_status(parser);
 }
 
-struct pt_node *exprppp(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) return NULL;
-   if (*lexed_in_ptr == NULL) return NULL;
-   if ((*lexed_in_ptr)->type == ATOM) {
-      result = create_node(NEXPRPPP, "", 1);
-      if (result == NULL) {
-         printf("Failed to allocate memory for exprppp!\n");
-         return NULL;
+int forms_status(struct sp_parser *parser) {
+   int f;
+   for (f = 0; f < NUM_FORMS; ++f)
+      if (parser->forms.out[f] != NULL && parser->forms.out[f]->failed) {
+         parser->status = SP_ERR_MEMORY;
+         parser->error_offset = 0;
+         return SP_ERR_MEMORY;
       }
-      result->child_ptrs[0] = atom(lexed_in_ptr);
-      return result;
-   } else {
-      result = create_node(NEXPRPPP, "", 3);
-      if (result == NULL) {
-         printf("Failed to allocate memory for exprppp!\n");
-         return NULL;
+   return SP_OK;
+}
+
+void compact_forms(struct sp_parser *parser) {
+   int f;
+   parser->tree = &parser->ast;
+   if ((parser->options & OPT_SIMPLIFY) &&
+       ast_simplify(&parser->arena, &parser->ast, 0, &parser->simple) >= 0)
+      parser->tree = &parser->simple;
+   for (f = 0; f < NUM_FORMS; ++f)
+      if (parser->forms.out[f] != NULL) {
+         ast_all_forms(parser->tree, &parser->forms);
+         break;
       }
-      result->child_ptrs[0] = lparen(lexed_in_ptr);
-      result->child_ptrs[1] = expr(lexed_in_ptr);
-      result->child_ptrs[2] = rparen(lexed_in_ptr);
-      return result;
+}
+
+int sp_render(struct sp_parser *parser, int form,
+              int (*sink)(void *arg, const char *text, size_t len),
+              void *arg) {
+   struct strbuf *text;
+   if (!parser->parsed || form < 0 || form >= NUM_FORMS)
+      return -1;
+   if (parser->status != SP_OK)
+      return parser->status;
+   text = parser->edited ? NULL : parser->forms.out[form];
+   if (text == NULL) {
+      render_alone(parser, form);
+      text = &parser->alone;
+      if (text->failed)
+         return SP_ERR_MEMORY;
    }
+   return sink(arg, text->data, text->len);
 }
 
-struct pt_node *lparen(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
+int sp_error(struct sp_parser *parser, size_t *offset) {
+   if (offset != NULL)
+      *offset = parser->error_offset;
+   return parser->status;
+}
+
+const char *sp_strerror(int status) {
+   static const char *messages[] = {
+      "no error", "invalid character", "operand expected",
+      "right parenthesis expected", "unexpected token", "out of memory",
+      "malformed tree", "edit out of range", "expression too long"
+   };
+   if (status > 0 || -status >= (int)(sizeof(messages) / sizeof(messages[0])))
+      return "unknown error";
+   return messages[-status];
+}
+
+void render_alone(struct sp_parser *parser, int form) {
+   struct token_cursor cur;
+   struct ast *tree = parser->tree;
+#ifdef USE_THREADS
+   struct strbuf *out[NUM_FORMS] = { NULL, NULL, NULL };
+#endif
+   strbuf_reset(&parser->alone);
+   if (tree != NULL) {
+      if (form == FORM_PAREN)
+         ast_compl_par(tree, &parser->alone);
+      else if (form == FORM_POSTFIX)
+         ast_postfix(tree, tree->root, &parser->alone);
+      else
+         ast_prefix(tree, tree->root, &parser->alone);
+      return;
    }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match left parenthesis!\n");
-      return NULL;
+#ifdef USE_THREADS
+   if (parser->split != NULL && parser->split->chain != NULL) {
+      out[form] = &parser->alone;
+      split_render(parser->split, out);
+      return;
    }
-   if ((*lexed_in_ptr)->type == LPAREN) {
-      result = create_node(NLPAREN, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for lparen!\n");
-         return NULL;
-      }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match left parenthesis!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
+#endif
+   if (parser->head == NULL) {
+      token_cursor_init(&cur, &parser->tokens);
+      parser->head = expr(&parser->arena, &cur);
    }
+   if (form == FORM_PAREN)
+      compl_par(parser->head, &parser->alone);
+   else if (form == FORM_POSTFIX)
+      postfix(parser->head, &parser->alone);
+   else
+      prefix(parser->head, &parser->alone);
 }
 
-struct pt_node *rparen(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
+void sp_reset(struct sp_parser *parser) {
+   arena_reset(&parser->arena);
+   parser->tokens.num_tokens = 0;
+   forms_reset(&parser->forms);
+   parser->head = NULL;
+   parser->tree = NULL;
+   parser->parsed = 0;
+   parser->status = SP_OK;
+   parser->error_offset = 0;
+   parser->input = NULL;
+   parser->len = 0;
+   parser->edited = 0;
+   parser->unparsed = NULL;
+   parser->reparsed = 0;
+   parser->path.depth = 0;
+   parser->pending = 0;
+#ifdef USE_THREADS
+   if (parser->split != NULL)
+      split_reset(parser->split);
+#endif
+}
+
+void sp_parser_free(struct sp_parser *parser) {
+   if (parser == NULL)
+      return;
+   parser_free(parser);
+   free(parser);
+}
+
+void parser_free(struct sp_parser *parser) {
+   arena_free(&parser->arena);
+   token_array_free(&parser->tokens);
+   forms_free(&parser->forms);
+   strbuf_free(&parser->alone);
+   strbuf_free(&parser->text);
+   strbuf_free(&parser->scratch);
+   pt_stack_free(&parser->path);
+#ifdef USE_THREADS
+   if (parser->split != NULL)
+      split_free(parser->split);
+#endif
+}
+
+int sp_edit(struct sp_parser *parser, size_t offset, size_t deleted,
+            const char *text, size_t len) {
+   struct token_cursor cur;
+   size_t size;
+   int status;
+   if (!parser->parsed || parser->input == NULL)
+      return -1;
+   size = parser->len;
+   if (offset > size || deleted > size - offset)
+      return SP_ERR_RANGE;
+   if ((parser->options & OPT_COMPACT) || size - deleted > INT_MAX ||
+       len > INT_MAX - (size - deleted))
+      return edit_text(parser, offset, deleted, text, len);
+
+   /* The first edit needs a parse tree with the widths of its nodes,
+      which the direct path did not build. Once the text reparsed by
+      edits outweighs the expression, all of it is parsed again, which
+      also frees the nodes the edits have replaced.                    */
+
+   if (!parser->edited) {
+      if (parser->status != SP_OK)
+         return edit_text(parser, offset, deleted, text, len);
+      if (parser->head == NULL) {
+         token_cursor_init(&cur, &parser->tokens);
+         parser->head = expr(&parser->arena, &cur);
+      }
+      if (parser->head == NULL || pt_measure(parser->head, NULL) < 0 ||
+          pt_push(&parser->path, parser->head) == NULL)
+         return edit_text(parser, offset, deleted, text, len);
+   } else if (parser->reparsed > size)
+      return edit_text(parser, offset, deleted, text, len);
+   status = edit_tree(parser, (int)offset, (int)deleted, text, (int)len);
+   if (status <= 0)
+      return status;
+   return edit_text(parser, offset, deleted, text, len);
+}
+
+int edit_tree(struct sp_parser *parser, int offset, int deleted,
+              const char *text, int len) {
+   struct token_cursor cur;
+   struct pt_frame *frame;
+   struct pt_node *group;
+   struct pt_node *node;
+   struct strbuf *scratch = &parser->scratch;
+   char *chunk;
+   int start = offset;
+   int end = offset + deleted;
+   int inside;
+   int depth = 0;
+   int lowest = 0;
+   int status;
+   int error_offset;
+   size_t k;
+
+   /* Text left unparsed by an earlier edit is parsed again along with
+      the new one, so the group has to hold both.                      */
+
+   if (parser->unparsed != NULL) {
+      if (parser->unparsed_offset < start)
+         start = parser->unparsed_offset;
+      if (parser->unparsed_offset + parser->unparsed->width > end)
+         end = parser->unparsed_offset + parser->unparsed->width;
    }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match right parenthesis!\n");
-      return NULL;
+   frame = pt_group(parser, start, end);
+   if (frame == NULL || group_text(frame->node, frame->step, offset, deleted,
+                                   text, len, scratch) < 0)
+      return 1;
+
+   /* If the parentheses of the new text balance, it parses between
+      those of the group exactly when it parses alone. A text reaching
+      lowest levels below zero closes as many of the enclosing groups,
+      so it takes the group that many levels further out.              */
+
+   for (k = 0; k < scratch->len; ++k)
+      if (scratch->data[k] == '(')
+         ++depth;
+      else if (scratch->data[k] == ')' && --depth < lowest)
+         lowest = depth;
+   if (depth != 0 || frame->top + lowest < 1)
+      return 1;
+   if (lowest < 0) {
+      frame = pt_outer(parser, frame->top + lowest);
+      if (group_text(frame->node, frame->step, offset, deleted, text, len,
+                     scratch) < 0)
+         return 1;
    }
-   if ((*lexed_in_ptr)->type == RPAREN) {
-      result = create_node(NRPAREN, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for rparen!\n");
-         return NULL;
-      }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match right parenthesis!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
+   group = frame->node;
+   inside = frame->step + group->child_ptrs[0]->width;
+
+   chunk = (char *)arena_alloc(&parser->arena, scratch->len + 1);
+   if (chunk == NULL)
+      return 1;
+   memcpy(chunk, scratch->data, scratch->len);
+   status = input_lexer(&parser->tokens, chunk, scratch->len);
+   if (status < 0)
+      error_offset = parser->tokens.error_offset;
+   else {
+      token_cursor_init(&cur, &parser->tokens);
+      node = expr(&parser->arena, &cur);
+      status = cur.status;
+      error_offset = cur.error_offset;
    }
+
+   /* Tokens left over inside the group stand where its closing
+      parenthesis was expected. A text that does not parse is kept
+      in a leaf of its own.                                         */
+
+   if (status == SP_OK) {
+      if (pt_measure(node, NULL) < 0)
+         return 1;
+   } else if (status == SP_ERR_MEMORY ||
+              (node = create_node(&parser->arena, NTEXT, chunk,
+                                  (int)scratch->len, 0)) == NULL)
+      return 1;
+   else if (status == SP_ERR_TOKEN)
+      status = SP_ERR_RPAREN;
+   group->child_ptrs[1] = node;
+   parser->pending += len - deleted;
+   parser->len = parser->len - deleted + len;
+   parser->edited = 1;
+   parser->reparsed += scratch->len;
+   parser->unparsed = status == SP_OK ? NULL : node;
+   parser->unparsed_offset = inside;
+   parser->status = status;
+   parser->error_offset = status == SP_OK ? 0 : inside + error_offset;
+   return status;
 }
 
-struct pt_node *expo(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
-   }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match exponentiation operator!\n");
-      return NULL;
+int group_text(struct pt_node *group, int base, int offset, int deleted,
+               const char *text, int len, struct strbuf *out) {
+   struct pt_node *inner = group->child_ptrs[1];
+   strbuf_reset(out);
+   if (pt_measure(inner, out) < 0 || out->len != (size_t)inner->width)
+      return -1;
+   strbuf_replace(out, offset - base - group->child_ptrs[0]->width, deleted,
+                  text, len);
+   return out->len == (size_t)(inner->width - deleted + len) ? 0 : -1;
+}
+
+int edit_text(struct sp_parser *parser, size_t offset, size_t deleted,
+              const char *text, size_t len) {
+   struct strbuf swap;
+   size_t size;
+
+   /* The edited expression is put together in scratch, away from the
+      old one in case that still stands in text, and then swapped in. */
+
+   strbuf_reset(&parser->scratch);
+   if (parser->edited)
+      pt_measure(parser->head, &parser->scratch);
+   else
+      strbuf_append(&parser->scratch, parser->input, parser->len);
+   size = parser->len;
+   if (parser->scratch.len == size)
+      strbuf_replace(&parser->scratch, offset, deleted, text, len);
+   if (parser->scratch.len != size - deleted + len) {
+      sp_reset(parser);
+      parser->parsed = 1;
+      parser->status = SP_ERR_MEMORY;
+      return SP_ERR_MEMORY;
    }
-   if ((*lexed_in_ptr)->type == EXP) {
-      result = create_node(NEXP, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for exp!\n");
-         return NULL;
+   swap = parser->text;
+   parser->text = parser->scratch;
+   parser->scratch = swap;
+   return sp_parse(parser, parser->text.data, parser->text.len);
+}
+
+int pt_measure(struct pt_node *node, struct strbuf *out) {
+   struct pt_stack stack;
+   struct pt_frame *frame;
+   struct pt_node *link;
+   struct pt_node *child;
+   int pos = 0;
+
+   /* A frame walks down from node to the last child of the last child
+      and so on, so that a chain takes one frame however long it is;
+      only the other children get frames of their own. Every node is
+      given minus the offset at which it starts as its width, and once
+      the frame reaches a leaf, whose end is where all of its nodes
+      end, it walks the chain once more to add that offset.            */
+
+   pt_stack_init(&stack);
+   frame = pt_push(&stack, node);
+   frame->link = node;
+   node->width = 0;
+   while (stack.depth > 0) {
+      frame = &stack.frames[stack.depth - 1];
+      link = frame->link;
+      if (frame->step < link->num_childs) {
+         child = link->child_ptrs[frame->step];
+         child->width = -pos;
+         if (frame->step == link->num_childs - 1) {
+            frame->link = child;
+            frame->step = 0;
+         } else {
+            ++frame->step;
+            if ((frame = pt_push(&stack, child)) == NULL) {
+               pt_stack_free(&stack);
+               return -1;
+            }
+            frame->link = child;
+         }
+         continue;
       }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match exponentiation operator!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
+      pos += link->len;
+      if (out != NULL)
+         strbuf_append(out, link->string, link->len);
+      for (child = frame->node; child != link;
+           child = child->child_ptrs[child->num_childs - 1])
+         child->width += pos;
+      link->width += pos;
+      --stack.depth;
    }
+   pt_stack_free(&stack);
+   return pos;
 }
 
-struct pt_node *mul(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
-   }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match multiplication operator!\n");
-      return NULL;
+struct pt_frame *pt_group(struct sp_parser *parser, int start, int end) {
+   struct pt_stack *path = &parser->path;
+   struct pt_frame *frame = &path->frames[path->depth - 1];
+   struct pt_node *node;
+   struct pt_node *child;
+   int base;
+   int top;
+   int i;
+
+   /* The path is first shortened to the last node on it that still
+      holds the range, and then lengthened from there.               */
+
+   while (path->depth > 1 &&
+          (frame->step >= start ||
+           end >= frame->step + frame->node->width + parser->pending)) {
+      frame->node->width += parser->pending;
+      frame = &path->frames[--path->depth - 1];
    }
-   if ((*lexed_in_ptr)->type == MUL) {
-      result = create_node(NMUL, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for mul!\n");
+   node = frame->node;
+   base = frame->step;
+   for (;;) {
+      for (i = 0; i < node->num_childs &&
+                  base + node->child_ptrs[i]->width <= start; ++i)
+         base += node->child_ptrs[i]->width;
+      if (i == node->num_childs)
+         break;
+      child = node->child_ptrs[i];
+      if (base >= start || end >= base + child->width ||
+          child->num_childs == 0)
+         break;
+      top = frame->top + IS_GROUP(child);
+      if ((frame = pt_push(path, child)) == NULL)
          return NULL;
-      }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match multiplication operator!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
+      frame->step = base;
+      frame->top = top;
+      child->width -= parser->pending;
+      node = child;
    }
+   return pt_outer(parser, INT_MAX);
 }
 
-struct pt_node *quo(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
+struct pt_frame *pt_outer(struct sp_parser *parser, int rank) {
+   struct pt_stack *path = &parser->path;
+   struct pt_frame *frame = &path->frames[path->depth - 1];
+   while (path->depth > 1 && (frame->top > rank || !IS_GROUP(frame->node))) {
+      frame->node->width += parser->pending;
+      frame = &path->frames[--path->depth - 1];
    }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match division operator!\n");
-      return NULL;
+   return path->depth > 1 ? frame : NULL;
+}
+
+int strbuf_sink(void *arg, const char *text, size_t len) {
+   strbuf_append((struct strbuf *)arg, text, len);
+   return ((struct strbuf *)arg)->failed ? SP_ERR_MEMORY : 0;
+}
+
+int file_sink(void *arg, const char *data, size_t len) {
+   return fwrite(data, 1, len, (FILE *)arg) == len ? 0 : -1;
+}
+
+int sp_save_tree(struct sp_parser *parser,
+                 int (*sink)(void *arg, const char *data, size_t len),
+                 void *arg) {
+   int status;
+   if (!parser->parsed)
+      return -1;
+   if (parser->status != SP_OK)
+      return parser->status;
+   if (parser->edited && (status = edit_text(parser, 0, 0, "", 0)) != SP_OK)
+      return status;
+   if (parser->tree == NULL) {
+      ast_build(&parser->arena, &parser->tokens, &parser->ast,
+                parser->options & OPT_SHARE);
+      if (parser->ast.status != SP_OK)
+         return parser->ast.status;
+      parser->tree = &parser->ast;
    }
-   if ((*lexed_in_ptr)->type == DIV) {
-      result = create_node(NDIV, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for div!\n");
-         return NULL;
+   strbuf_reset(&parser->alone);
+   status = tree_encode(&parser->arena, parser->tree, &parser->alone);
+   if (status != SP_OK)
+      return status;
+   return sink(arg, parser->alone.data, parser->alone.len);
+}
+
+int sp_load_tree(struct sp_parser *parser, const void *data, size_t size) {
+   sp_reset(parser);
+   parser->parsed = 1;
+   parser->status = tree_decode(&parser->arena, (const unsigned char *)data,
+                                size, parser->options & OPT_SHARE,
+                                &parser->ast);
+   if (parser->status != SP_OK)
+      return parser->status;
+   compact_forms(parser);
+   return forms_status(parser);
+}
+
+int tree_encode(struct arena *arena, struct ast *ast, struct strbuf *out) {
+   struct tree_strings strings;
+   struct ast_node *n;
+   unsigned char *p;
+   uint32_t *sizes;
+   uint64_t sum;
+   uint32_t offset;
+   size_t base = out->len;
+   size_t types;
+   size_t atoms;
+   size_t num_nodes;
+   int *stack;
+   int top;
+   int i;
+
+   sizes = (uint32_t *)arena_alloc(arena, ast->num_nodes * sizeof(uint32_t));
+   stack = (int *)arena_alloc(arena, (ast->num_nodes + 1) * sizeof(int));
+   strings.memo = (int *)arena_alloc(arena, ast->num_nodes * sizeof(int));
+   strings.reps = (int *)arena_alloc(arena, ast->num_nodes * sizeof(int));
+   strings.chain = (int *)arena_alloc(arena, ast->num_nodes * sizeof(int));
+   for (strings.num_buckets = 16; strings.num_buckets < 2 * ast->num_nodes; )
+      strings.num_buckets *= 2;
+   strings.buckets = (int *)arena_alloc(arena, strings.num_buckets *
+                                               sizeof(int));
+   if (sizes == NULL || stack == NULL || strings.memo == NULL ||
+       strings.reps == NULL || strings.chain == NULL ||
+       strings.buckets == NULL)
+      return SP_ERR_MEMORY;
+   for (i = 0; i < strings.num_buckets; ++i)
+      strings.buckets[i] = -1;
+   strings.num_strings = 0;
+   strings.bytes = 0;
+
+   /* A subtree too large to be written counts as TREE_MAX_NODES + 1
+      nodes, which keeps the sums from overflowing.                  */
+
+   for (i = 0; i < ast->num_nodes; ++i) {
+      n = &ast->nodes[i];
+      strings.memo[i] = -1;
+      if (n->type == NATOM)
+         sizes[i] = 1;
+      else {
+         sum = 1 + (uint64_t)sizes[n->left] + sizes[n->right];
+         sizes[i] = sum > TREE_MAX_NODES ? TREE_MAX_NODES + 1u : (uint32_t)sum;
+      }
+   }
+   num_nodes = sizes[ast->root];
+   if (num_nodes > TREE_MAX_NODES)
+      return SP_ERR_MEMORY;
+   types = base + TREE_HEADER;
+   atoms = types + (num_nodes + 3) / 4 * 4;
+   if (strbuf_reserve(out, atoms + 4 * ((num_nodes + 1) / 2) - base) != 0)
+      return SP_ERR_MEMORY;
+   p = (unsigned char *)out->data;
+   memset(p + types + num_nodes, 0, atoms - types - num_nodes);
+   stack[0] = ast->root;
+   for (top = 1; top > 0; ) {
+      i = stack[--top];
+      n = &ast->nodes[i];
+      p[types++] = (unsigned char)n->type;
+      if (n->type == NATOM) {
+         put_u32(p + atoms, (uint32_t)tree_intern(ast, i, &strings));
+         atoms += 4;
+      } else {
+         stack[top++] = n->right;
+         stack[top++] = n->left;
       }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match division operator!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
    }
+   out->len = atoms;
+
+   if (strings.bytes > 0xffffffffu ||
+       strbuf_reserve(out, 4 * ((size_t)strings.num_strings + 1) +
+                           strings.bytes) != 0)
+      return SP_ERR_MEMORY;
+   p = (unsigned char *)out->data;
+   for (i = 0, offset = 0; i <= strings.num_strings; ++i) {
+      put_u32(p + out->len, offset);
+      out->len += 4;
+      if (i < strings.num_strings)
+         offset += ast->nodes[strings.reps[i]].len;
+   }
+   for (i = 0; i < strings.num_strings; ++i) {
+      n = &ast->nodes[strings.reps[i]];
+      memcpy(p + out->len, n->string, n->len);
+      out->len += n->len;
+   }
+   p[out->len] = '\0';
+   memcpy(p + base, TREE_MAGIC, 4);
+   put_u32(p + base + 4, TREE_VERSION);
+   put_u32(p + base + 8, (uint32_t)num_nodes);
+   put_u32(p + base + 12, (uint32_t)((num_nodes + 1) / 2));
+   put_u32(p + base + 16, (uint32_t)strings.num_strings);
+   put_u32(p + base + 20, offset);
+   return SP_OK;
 }
 
-struct pt_node *add(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
+int tree_intern(struct ast *ast, int node, struct tree_strings *strings) {
+   struct ast_node *n = &ast->nodes[node];
+   struct ast_node *rep;
+   uint64_t hash;
+   int i;
+   if (strings->memo[node] >= 0)
+      return strings->memo[node];
+   hash = text_hash(n->string, n->len);
+   hash = (hash ^ hash >> 29) & (strings->num_buckets - 1);
+   for (i = strings->buckets[hash]; i >= 0; i = strings->chain[i]) {
+      rep = &ast->nodes[strings->reps[i]];
+      if (rep->len == n->len && memcmp(rep->string, n->string, n->len) == 0)
+         break;
    }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match addition operator!\n");
-      return NULL;
+   if (i < 0) {
+      i = strings->num_strings++;
+      strings->reps[i] = node;
+      strings->chain[i] = strings->buckets[hash];
+      strings->buckets[hash] = i;
+      strings->bytes += n->len;
    }
-   if ((*lexed_in_ptr)->type == ADD) {
-      result = create_node(NADD, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for add!\n");
-         return NULL;
+   strings->memo[node] = i;
+   return i;
+}
+
+int tree_decode(struct arena *arena, const unsigned char *data, size_t size,
+                int share, struct ast *ast) {
+   static char operators[] = "^*/+-";
+   const unsigned char *types;
+   const unsigned char *atoms;
+   const unsigned char *offsets;
+   char *text;
+   struct number *numbers;
+   uint32_t num_nodes;
+   uint32_t num_atoms;
+   uint32_t num_strings;
+   uint32_t num_bytes;
+   uint32_t start;
+   uint32_t end;
+   uint32_t string;
+   uint32_t i;
+   int *stack;
+   int top = 0;
+   int node;
+   int cls;
+
+   if (size < TREE_HEADER || memcmp(data, TREE_MAGIC, 4) != 0 ||
+       get_u32(data + 4) != TREE_VERSION)
+      return SP_ERR_FORMAT;
+   num_nodes = get_u32(data + 8);
+   num_atoms = get_u32(data + 12);
+   num_strings = get_u32(data + 16);
+   num_bytes = get_u32(data + 20);
+   if (num_nodes % 2 == 0 || num_nodes > TREE_MAX_NODES ||
+       num_strings > TREE_MAX_NODES || num_atoms != num_nodes / 2 + 1 ||
+       size != TREE_HEADER + ((uint64_t)num_nodes + 3) / 4 * 4 +
+               4 * (uint64_t)num_atoms + 4 * ((uint64_t)num_strings + 1) +
+               num_bytes)
+      return SP_ERR_FORMAT;
+   types = data + TREE_HEADER;
+   atoms = types + ((size_t)num_nodes + 3) / 4 * 4;
+   offsets = atoms + 4 * (size_t)num_atoms;
+   text = (char *)(offsets + 4 * ((size_t)num_strings + 1));
+   for (i = num_nodes; types + i < atoms; ++i)
+      if (types[i] != 0)
+         return SP_ERR_FORMAT;
+
+   /* The offsets have to rise from 0 to num_bytes, and every text has
+      to be a variable name or a number, as the lexer would have made. */
+
+   if (get_u32(offsets) != 0 ||
+       get_u32(offsets + 4 * (size_t)num_strings) != num_bytes)
+      return SP_ERR_FORMAT;
+   numbers = (struct number *)arena_alloc(arena, ((size_t)num_strings + 1) *
+                                                 sizeof(struct number));
+   if (numbers == NULL)
+      return SP_ERR_MEMORY;
+   for (i = 0; i < num_strings; ++i) {
+      start = get_u32(offsets + 4 * i);
+      end = get_u32(offsets + 4 * i + 4);
+      if (end <= start || end - start > INT_MAX)
+         return SP_ERR_FORMAT;
+      cls = char_class[(unsigned char)text[start]];
+      if ((cls != CC_ALPHA && cls != CC_DIGIT) ||
+          skip_run(text + start, text + end, cls) != text + end)
+         return SP_ERR_FORMAT;
+      if (cls == CC_DIGIT)
+         parse_number(text + start, (int)(end - start), &numbers[i]);
+      else {
+         numbers[i].i = -1;
+         numbers[i].d = 0;
       }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match addition operator!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
    }
+
+   if (ast_init(arena, ast, (int)num_nodes, share) < 0)
+      return SP_ERR_MEMORY;
+   ast->num_symbols = (int)num_strings;
+   stack = (int *)arena_alloc(arena, num_atoms * sizeof(int));
+   if (stack == NULL)
+      return SP_ERR_MEMORY;
+   for (i = num_nodes; i-- > 0; ) {
+      if (types[i] == NATOM) {
+         if (num_atoms == 0)
+            return SP_ERR_FORMAT;
+         string = get_u32(atoms + 4 * (size_t)--num_atoms);
+         if (string >= num_strings)
+            return SP_ERR_FORMAT;
+         start = get_u32(offsets + 4 * (size_t)string);
+         end = get_u32(offsets + 4 * (size_t)string + 4);
+         node = ast_node(ast, NATOM, text + start, (int)(end - start), -1, -1,
+                         (int)string, &numbers[string]);
+      } else if (types[i] >= NEXP && types[i] <= NSUB) {
+         if (top < 2)
+            return SP_ERR_FORMAT;
+         top -= 2;
+         node = ast_node(ast, types[i], operators + types[i] - NEXP, 1,
+                         stack[top + 1], stack[top], -1, NULL);
+      } else
+         return SP_ERR_FORMAT;
+      if (node < 0)
+         return SP_ERR_MEMORY;
+      stack[top++] = node;
+   }
+   if (top != 1)
+      return SP_ERR_FORMAT;
+   ast->root = stack[0];
+   return SP_OK;
 }
 
-struct pt_node *sub(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
+void put_u32(unsigned char *p, uint32_t n) {
+   int i;
+   for (i = 0; i < 4; ++i)
+      p[i] = (unsigned char)(n >> 8 * i);
+}
+
+uint32_t get_u32(const unsigned char *p) {
+   uint32_t n = 0;
+   int i;
+   for (i = 0; i < 4; ++i)
+      n |= (uint32_t)p[i] << 8 * i;
+   return n;
+}
+
+#ifndef SIMPLE_PARSE_NO_MAIN
+
+int batch(FILE *in, int options, int cache_size) {
+   struct strbuf line;
+   struct strbuf out;
+   struct sp_parser parser;
+   struct expr_cache cache;
+   int status;
+
+   if (cache_size != 0 && expr_cache_init(&cache, cache_size) < 0) {
+      printf("Failed to allocate memory for the cache!\n");
+      return 1;
    }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match subtraction operator!\n");
-      return NULL;
+   setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+   strbuf_init(&line);
+   strbuf_init(&out);
+   batch_parser_init(&parser, options);
+   while ((status = read_line(in, &line)) > 0) {
+      strbuf_reset(&out);
+      batch_line(&parser, line.data, line.len,
+                 cache_size != 0 ? &cache : NULL, &out);
+      fwrite(out.data, 1, out.len, stdout);
    }
-   if ((*lexed_in_ptr)->type == SUB) {
-      result = create_node(NSUB, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for sub!\n");
-         return NULL;
-      }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match subtraction operator!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
+   strbuf_free(&line);
+   strbuf_free(&out);
+   parser_free(&parser);
+   if (cache_size != 0) {
+      expr_cache_report(cache.hits, cache.misses);
+      expr_cache_free(&cache);
+   }
+   if (status < 0) {
+      printf("Error receiving input!\n");
+      return 1;
    }
+   return fflush(stdout) == 0 ? 0 : 1;
 }
 
-struct pt_node *atom(struct token **lexed_in_ptr) {
-   struct pt_node *result;
-   if (lexed_in_ptr == NULL) {
-      printf("Invalid input!\n");
-      return NULL;
+int batch_mapped(char *data, size_t size, int options, int cache_size) {
+   struct strbuf out;
+   struct sp_parser parser;
+   struct expr_cache cache;
+   size_t len;
+
+   if (cache_size != 0 && expr_cache_init(&cache, cache_size) < 0) {
+      printf("Failed to allocate memory for the cache!\n");
+      return 1;
    }
-   if (*lexed_in_ptr == NULL) {
-      printf("Failed to match atom!\n");
-      return NULL;
+   setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+   strbuf_init(&out);
+   batch_parser_init(&parser, options);
+   while (size != 0) {
+      len = block_length(data, size);
+      strbuf_reset(&out);
+      batch_block(&parser, data, len, cache_size != 0 ? &cache : NULL, &out);
+      fwrite(out.data, 1, out.len, stdout);
+      data += len;
+      size -= len;
    }
-   if ((*lexed_in_ptr)->type == ATOM) {
-      result = create_node(NATOM, (*lexed_in_ptr)->string, 0);
-      if (result == NULL) {
-         printf("Failed to allocate memory for atom!\n");
-         return NULL;
-      }
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return result;
-   } else {
-      printf("Failed to match atom!\n");
-      *lexed_in_ptr = (*lexed_in_ptr)->next;
-      return NULL;
+   strbuf_free(&out);
+   parser_free(&parser);
+   if (cache_size != 0) {
+      expr_cache_report(cache.hits, cache.misses);
+      expr_cache_free(&cache);
    }
+   return fflush(stdout) == 0 ? 0 : 1;
 }
 
-struct pt_node *epsilon(void) {
-   struct pt_node *result;
-   result = create_node(NEPSILON, "", 0);
-   if (result == NULL) {
-      printf("Failed to allocate memory for epsilon!\n");
-      return NULL;
+void batch_parser_init(struct sp_parser *parser, int options) {
+   parser_init(parser, options & OPT_PARSER, options >> OPT_FORMS_SHIFT);
+}
+
+void batch_block(struct sp_parser *parser, char *data, size_t size,
+                 struct expr_cache *cache, struct strbuf *out) {
+   char *line = data;
+   char *end = data + size;
+   char *newline;
+   size_t len;
+   while (line < end) {
+      newline = (char *)memchr(line, '\n', end - line);
+      len = (newline == NULL ? end : newline) - line;
+      if (len != 0 && line[len - 1] == '\r')
+         --len;
+      batch_line(parser, line, len, cache, out);
+      if (newline == NULL)
+         break;
+      line = newline + 1;
    }
-   return result;
 }
 
-char *concat(char *str1, char *str2) {
-   char *result;
-   int i, j;
-   result = (char *)malloc((strlen(str1) + strlen(str2) + 1) * sizeof(char));
-   if (result == NULL) {
-      printf("Failed to allocate memory for new string!\n");
-      return "";
+void batch_line(struct sp_parser *parser, char *line, size_t len,
+                struct expr_cache *cache, struct strbuf *out) {
+   struct expr_entry *entry;
+   size_t start = out->len;
+   size_t offset;
+   char number[24];
+   int status;
+   int tab;
+   int f;
+
+   STAT_POLL();
+   if (len != 0 && cache != NULL &&
+       (entry = expr_cache_find(cache, line, len)) != NULL)
+      strbuf_append(out, entry->forms.data, entry->forms.len);
+   else if (len != 0 && (status = sp_parse(parser, line, len)) != SP_OK) {
+      sp_error(parser, &offset);
+      snprintf(number, sizeof(number), "%lu", (unsigned long)offset);
+      strbuf_append_str(out, "error: ");
+      strbuf_append_str(out, sp_strerror(status));
+      strbuf_append_str(out, " at offset ");
+      strbuf_append_str(out, number);
+   } else if (len != 0) {
+      for (f = 0, tab = 0; f < NUM_FORMS; ++f)
+         if (parser->forms.out[f] != NULL) {
+            if (tab++)
+               strbuf_append_str(out, "\t");
+            sp_render(parser, f, strbuf_sink, out);
+         }
+      if (cache != NULL)
+         expr_cache_add(cache, line, len, out->data + start,
+                        out->len - start);
    }
-   j = 0;
-   for (i = 0; i < strlen(str1); ++i, ++j)
-      result[j] = str1[i];
-   for (i = 0; i < strlen(str2); ++i, ++j)
-      result[j] = str2[i];
-   result[j] = '\0';
-   return result;
+   strbuf_append_str(out, "\n");
 }
 
-char *pre_compl_par(struct pt_node *head) {
-   char *result = "";
-   struct pt_node *dummy;
-   if (head == NULL) {
-      printf("Invalid input!\n");
-      return "";
-   }
-   if (head->type == NEXPR &&
-       head->child_ptrs[1]->num_childs == 3) {
-      result = concat(result, "(");
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while (dummy->num_childs == 3) {
-         result = concat(result, "(");
-         dummy = dummy->child_ptrs[2];
-      }
-      result = concat(result, pre_compl_par(head->child_ptrs[0]));
-      result = concat(result, head->child_ptrs[1]->child_ptrs[0]->string);
-      result = concat(result, pre_compl_par(head->child_ptrs[1]->child_ptrs[1]));
-      result = concat(result, ")");
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while (dummy->num_childs != 1) {
-         result = concat(result, dummy->child_ptrs[0]->string);
-         result = concat(result, pre_compl_par(dummy->child_ptrs[1]));
-         result = concat(result, ")");
-         dummy = dummy->child_ptrs[2];
-      }
-      return result;
+size_t block_length(char *data, size_t size) {
+   char *newline;
+   if (size <= BATCH_BLOCK_SIZE)
+      return size;
+   newline = (char *)memchr(data + BATCH_BLOCK_SIZE - 1, '\n',
+                            size - BATCH_BLOCK_SIZE + 1);
+   return newline == NULL ? size : (size_t)(newline - data) + 1;
+}
+
+#ifdef USE_THREADS
+
+int batch_parallel(FILE *in, char *data, size_t size, int options,
+                   int cache_size, int num_threads) {
+   struct batch_pool pool;
+   struct batch_job *job;
+   struct strbuf line;
+   pthread_t *threads;
+   int num_started;
+   int filled;
+   int status = 0;
+   int i;
+
+   setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+   pool.num_jobs = JOBS_PER_THREAD * num_threads;
+   pool.jobs = (struct batch_job *)malloc(pool.num_jobs *
+                                          sizeof(struct batch_job));
+   threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+   if (pool.jobs == NULL || threads == NULL) {
+      printf("Failed to allocate memory for worker threads!\n");
+      free(pool.jobs);
+      free(threads);
+      return 1;
+   }
+   for (i = 0; i < pool.num_jobs; ++i) {
+      strbuf_init(&pool.jobs[i].copy);
+      strbuf_init(&pool.jobs[i].out);
+      pool.jobs[i].done = 0;
+   }
+   pool.next_fill = 0;
+   pool.next_run = 0;
+   pool.next_write = 0;
+   pool.end_of_input = 0;
+   pool.options = options;
+   pool.cache_size = cache_size;
+   pool.cache_hits = 0;
+   pool.cache_misses = 0;
+   pthread_mutex_init(&pool.lock, NULL);
+   pthread_cond_init(&pool.queued, NULL);
+   pthread_cond_init(&pool.finished, NULL);
+   strbuf_init(&line);
+
+   for (num_started = 0; num_started < num_threads; ++num_started)
+      if (pthread_create(&threads[num_started], NULL, batch_worker,
+                         &pool) != 0)
+         break;
+   if (num_started == 0) {
+      printf("Failed to start worker threads!\n");
+      status = 1;
    }
-   if (head->type == NEXPRP &&
-       head->child_ptrs[1]->num_childs == 3) {
-      result = concat(result, "(");
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while (dummy->num_childs == 3) {
-         result = concat(result, "(");
-         dummy = dummy->child_ptrs[2];
-      }
-      result = concat(result, pre_compl_par(head->child_ptrs[0]));
-      result = concat(result, head->child_ptrs[1]->child_ptrs[0]->string);
-      result = concat(result, pre_compl_par(head->child_ptrs[1]->child_ptrs[1]));
-      result = concat(result, ")");
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while(dummy->num_childs != 1) {
-         result = concat(result, dummy->child_ptrs[0]->string);
-         result = concat(result, pre_compl_par(dummy->child_ptrs[1]));
-         result = concat(result, ")");
-         dummy = dummy->child_ptrs[2];
+
+   pthread_mutex_lock(&pool.lock);
+   while (status == 0) {
+      /* Write out the oldest jobs for as long as they are finished, and
+         wait for the oldest one if no slot is free for the next job.    */
+      while (pool.next_write < pool.next_fill &&
+             (pool.jobs[pool.next_write % pool.num_jobs].done ||
+              pool.next_fill - pool.next_write == pool.num_jobs)) {
+         job = &pool.jobs[pool.next_write % pool.num_jobs];
+         while (!job->done)
+            pthread_cond_wait(&pool.finished, &pool.lock);
+         pthread_mutex_unlock(&pool.lock);
+         fwrite(job->out.data, 1, job->out.len, stdout);
+         pthread_mutex_lock(&pool.lock);
+         job->done = 0;
+         ++pool.next_write;
       }
-      return result;
+      job = &pool.jobs[pool.next_fill % pool.num_jobs];
+      pthread_mutex_unlock(&pool.lock);
+      filled = fill_job(job, in, &data, &size, &line);
+      pthread_mutex_lock(&pool.lock);
+      if (filled <= 0) {
+         if (filled < 0) {
+            printf("Error receiving input!\n");
+            status = 1;
+         }
+         break;
+      }
+      ++pool.next_fill;
+      pthread_cond_signal(&pool.queued);
    }
-   if (head->type == NEXPRPP &&
-       head->num_childs == 3) {
-      result = concat(result, "(");
-      result = concat(result, pre_compl_par(head->child_ptrs[0]));
-      result = concat(result, "^");
-      result = concat(result, pre_compl_par(head->child_ptrs[2]));
-      result = concat(result, ")");
-      return result;
+   pool.end_of_input = 1;
+   pthread_cond_broadcast(&pool.queued);
+   while (num_started != 0 && pool.next_write < pool.next_fill) {
+      job = &pool.jobs[pool.next_write % pool.num_jobs];
+      while (!job->done)
+         pthread_cond_wait(&pool.finished, &pool.lock);
+      pthread_mutex_unlock(&pool.lock);
+      fwrite(job->out.data, 1, job->out.len, stdout);
+      pthread_mutex_lock(&pool.lock);
+      ++pool.next_write;
    }
-   if (head->type == NADD ||
-       head->type == NSUB ||
-       head->type == NMUL ||
-       head->type == NDIV ||
-       head->type == NATOM)
-      return head->string;
-   if (head->type == NEXPRPPP &&
-       head->num_childs == 1)
-      return pre_compl_par(head->child_ptrs[0]);
-   if (head->type == NEXPR ||
-       head->type == NEXPRP ||
-       head->type == NEXPRPP)
-      return pre_compl_par(head->child_ptrs[0]);
-   if (head->type == NEXPRPPP)
-      return pre_compl_par(head->child_ptrs[1]);
-}
-
-char *strip_parens(char *pre_compl_par) {
-   char *result = "";
-   char *temp = pre_compl_par;
-   if (*pre_compl_par == '(') {
-      ++temp;
-      while (*temp != '\0')
-         ++temp;
-      --temp;
-      *temp = '\0';
-      result = concat(result, pre_compl_par + 1);
-      return result;
+   pthread_mutex_unlock(&pool.lock);
+
+   for (i = 0; i < num_started; ++i)
+      pthread_join(threads[i], NULL);
+   if (cache_size != 0)
+      expr_cache_report(pool.cache_hits, pool.cache_misses);
+   for (i = 0; i < pool.num_jobs; ++i) {
+      strbuf_free(&pool.jobs[i].copy);
+      strbuf_free(&pool.jobs[i].out);
    }
-   else
-      return pre_compl_par;
+   pthread_mutex_destroy(&pool.lock);
+   pthread_cond_destroy(&pool.queued);
+   pthread_cond_destroy(&pool.finished);
+   strbuf_free(&line);
+   free(pool.jobs);
+   free(threads);
+   if (fflush(stdout) != 0)
+      status = 1;
+   return status;
 }
 
-char *compl_par(struct pt_node *head) {
-   return strip_parens(pre_compl_par(head));
+int fill_job(struct batch_job *job, FILE *in, char **data, size_t *size,
+             struct strbuf *line) {
+   int status = 0;
+   if (*data != NULL) {
+      job->data = *data;
+      job->size = block_length(*data, *size);
+      *data += job->size;
+      *size -= job->size;
+      return job->size != 0;
+   }
+   strbuf_reset(&job->copy);
+   while (job->copy.len < BATCH_BLOCK_SIZE &&
+          (status = read_line(in, line)) > 0) {
+      strbuf_append(&job->copy, line->data, line->len);
+      strbuf_append_str(&job->copy, "\n");
+   }
+   if (status < 0)
+      return -1;
+   job->data = job->copy.data;
+   job->size = job->copy.len;
+   return job->size != 0;
 }
 
-char *postfix(struct pt_node *head) {
-   char *result = "";
-   struct pt_node *dummy;
-   if (head == NULL) {
-      printf("Invalid input!\n");
-      return "";
-   }
-   if (head->type == NEXPR &&
-       head->child_ptrs[1]->num_childs == 3) {
-      result = concat(result, postfix(head->child_ptrs[0]));
-      result = concat(result, postfix(head->child_ptrs[1]->child_ptrs[1]));
-      result = concat(result, concat(head->child_ptrs[1]->child_ptrs[0]->string, " "));
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while (dummy->num_childs != 1) {
-         result = concat(result, postfix(dummy->child_ptrs[1]));
-         result = concat(result, concat(dummy->child_ptrs[0]->string, " "));
-         dummy = dummy->child_ptrs[2];
-      }
-      return result;
+void *batch_worker(void *arg) {
+   struct batch_pool *pool = (struct batch_pool *)arg;
+   struct batch_job *job;
+   struct sp_parser parser;
+   struct expr_cache cache;
+   struct expr_cache *cachep = NULL;
+
+#ifdef DEBUG_STATS
+   stats_register();
+#endif
+   if (pool->cache_size != 0 && expr_cache_init(&cache, pool->cache_size) == 0)
+      cachep = &cache;
+   batch_parser_init(&parser, pool->options);
+   pthread_mutex_lock(&pool->lock);
+   for (;;) {
+      while (pool->next_run == pool->next_fill && !pool->end_of_input)
+         pthread_cond_wait(&pool->queued, &pool->lock);
+      if (pool->next_run == pool->next_fill)
+         break;
+      job = &pool->jobs[pool->next_run++ % pool->num_jobs];
+      pthread_mutex_unlock(&pool->lock);
+      strbuf_reset(&job->out);
+      batch_block(&parser, job->data, job->size, cachep, &job->out);
+      pthread_mutex_lock(&pool->lock);
+      job->done = 1;
+      pthread_cond_broadcast(&pool->finished);
    }
-   if (head->type == NEXPRP &&
-       head->child_ptrs[1]->num_childs == 3) {
-      result = concat(result, postfix(head->child_ptrs[0]));
-      result = concat(result, postfix(head->child_ptrs[1]->child_ptrs[1]));
-      result = concat(result, concat(head->child_ptrs[1]->child_ptrs[0]->string, " "));
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while(dummy->num_childs != 1) {
-         result = concat(result, postfix(dummy->child_ptrs[1]));
-         result = concat(result, concat(dummy->child_ptrs[0]->string, " "));
-         dummy = dummy->child_ptrs[2];
-      }
-      return result;
+   if (cachep != NULL) {
+      pool->cache_hits += cache.hits;
+      pool->cache_misses += cache.misses;
+      expr_cache_free(&cache);
    }
-   if (head->type == NEXPRPP &&
-       head->num_childs == 3) {
-      result = concat(result, postfix(head->child_ptrs[0]));
-      result = concat(result, postfix(head->child_ptrs[2]));
-      result = concat(result, "^ ");
-      return result;
+   pthread_mutex_unlock(&pool->lock);
+   parser_free(&parser);
+#ifdef DEBUG_STATS
+   stats_unregister();
+#endif
+   return NULL;
+}
+
+#endif
+
+#endif
+
+#ifdef USE_THREADS
+
+int split_parse(struct sp_parser *parser) {
+   struct split *split = parser->split;
+   struct split_chunk **chunks;
+   int num_tokens = parser->tokens.num_tokens;
+   int num_slices = parser->threads;
+   int depth = 0;
+   int change;
+   int first;
+   int n;
+   int k;
+
+   if (num_slices > num_tokens / SPLIT_MIN_TOKENS)
+      num_slices = num_tokens / SPLIT_MIN_TOKENS;
+   if (num_slices < 2)
+      return -1;
+   if (split == NULL) {
+      split = (struct split *)malloc(sizeof(struct split));
+      if (split == NULL)
+         return -1;
+      split->chunks = NULL;
+      split->num_chunks = 0;
+      split->cap = 0;
+      split->chain = NULL;
+      parser->split = split;
    }
-   if (head->type == NATOM)
-      return concat(head->string, " ");
-   if (head->type == NEXPRPPP &&
-       head->num_childs == 1)
-      return postfix(head->child_ptrs[0]);
-   if (head->type == NEXPR ||
-       head->type == NEXPRP ||
-       head->type == NEXPRPP)
-      return postfix(head->child_ptrs[0]);
-   if (head->type == NEXPRPPP)
-      return postfix(head->child_ptrs[1]);
-}
-
-char *prefix(struct pt_node *head) {
-   char *result = "";
-   struct pt_node *dummy;
-   if (head == NULL) {
-      printf("Invalid input!\n");
-      return "";
-   }
-   if (head->type == NEXPR &&
-       head->child_ptrs[1]->num_childs == 3) {
-      result = concat(result, concat(head->child_ptrs[1]->child_ptrs[0]->string, " "));
-      result = concat(result, prefix(head->child_ptrs[0]));
-      result = concat(result, prefix(head->child_ptrs[1]->child_ptrs[1]));
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while (dummy->num_childs != 1) {
-         result = concat(concat(dummy->child_ptrs[0]->string, " "), result);
-         result = concat(result, prefix(dummy->child_ptrs[1]));
-         dummy = dummy->child_ptrs[2];
+   if (split_slices(split, num_slices) < 0)
+      return -1;
+   split->tokens = &parser->tokens;
+   chunks = split->chunks;
+   for (k = 0; k < num_slices; ++k) {
+      chunks[k]->begin = (int)((long long)num_tokens * k / num_slices);
+      chunks[k]->end = (int)((long long)num_tokens * (k + 1) / num_slices);
+   }
+
+   /* Parentheses that do not balance are left to the sequential parse,
+      which reports them.                                               */
+
+   split_run(split, num_slices, split_scan);
+   for (k = 0; k < num_slices; ++k) {
+      if (depth + chunks[k]->lowest < 0)
+         return -1;
+      change = chunks[k]->depth;
+      chunks[k]->depth = depth;
+      depth += change;
+   }
+   if (depth != 0)
+      return -1;
+   split_run(split, num_slices, split_find);
+   split->level = MUL;
+   for (k = 0; k < num_slices; ++k)
+      if (chunks[k]->first_add >= 0)
+         split->level = ADD;
+
+   /* The chunks are written over the slices in place; chunk n never
+      lies beyond slice k, which has been read by then.              */
+
+   for (k = 1, n = 1; k < num_slices; ++k) {
+      first = split->level == ADD ? chunks[k]->first_add
+                                  : chunks[k]->first_mul;
+      if (first >= 0) {
+         chunks[n - 1]->end = first;
+         chunks[n++]->begin = first;
       }
-      return result;
    }
-   if (head->type == NEXPRP &&
-       head->child_ptrs[1]->num_childs == 3) {
-      result = concat(result, concat(head->child_ptrs[1]->child_ptrs[0]->string, " "));
-      result = concat(result, prefix(head->child_ptrs[0]));
-      result = concat(result, prefix(head->child_ptrs[1]->child_ptrs[1]));
-      dummy = head->child_ptrs[1]->child_ptrs[2];
-      while(dummy->num_childs != 1) {
-         result = concat(concat(dummy->child_ptrs[0]->string, " "), result);
-         result = concat(result, prefix(dummy->child_ptrs[1]));
-         dummy = dummy->child_ptrs[2];
+   if (n < 2)
+      return -1;
+   chunks[0]->begin = 0;
+   chunks[n - 1]->end = num_tokens;
+   split_run(split, n, split_expr);
+   for (k = 0; k < n; ++k)
+      if (chunks[k]->status != SP_OK)
+         return -1;
+   for (k = 1; k < n; ++k)
+      *chunks[k - 1]->tail = chunks[k]->node;
+   parser->head = chunks[0]->node;
+   split->num_chunks = n;
+   split->chain = split->level == ADD ? parser->head
+                                      : parser->head->child_ptrs[0];
+   return 0;
+}
+
+int split_slices(struct split *split, int num_slices) {
+   struct split_chunk **chunks;
+   struct split_chunk *chunk;
+   if (num_slices <= split->cap)
+      return 0;
+   chunks = (struct split_chunk **)realloc(split->chunks,
+                                           num_slices * sizeof(*chunks));
+   if (chunks == NULL)
+      return -1;
+   split->chunks = chunks;
+   while (split->cap < num_slices) {
+      chunk = (struct split_chunk *)malloc(sizeof(struct split_chunk));
+      if (chunk == NULL)
+         return -1;
+      chunk->split = split;
+      chunk->index = split->cap;
+      arena_init(&chunk->arena);
+      forms_init(&chunk->forms, 0);
+      strbuf_init(&chunk->ops);
+      chunks[split->cap++] = chunk;
+   }
+   return 0;
+}
+
+void split_render(struct split *split, struct strbuf **out) {
+   struct split_chunk **chunks = split->chunks;
+   struct strbuf *text;
+   size_t start;
+   int num_ops = 0;
+   int f;
+   int k;
+
+   STAT_START(STAT_PRINT);
+   split->out = out;
+   split_run(split, split->num_chunks, split_print);
+   for (k = 0; k < split->num_chunks; ++k)
+      num_ops += chunks[k]->num_ops;
+
+   /* The chain opens one parenthesis per operator up front, and its
+      operators come out last chunk first in prefix form.            */
+
+   for (f = 0; f < NUM_FORMS; ++f) {
+      if (out[f] == NULL)
+         continue;
+      start = out[f]->len;
+      if (f == FORM_PAREN)
+         for (k = 0; k < num_ops; ++k)
+            strbuf_append_str(out[f], "(");
+      else if (f == FORM_PREFIX)
+         for (k = split->num_chunks - 1; k >= 0; --k)
+            strbuf_append(out[f], chunks[k]->ops.data, chunks[k]->ops.len);
+      for (k = 0; k < split->num_chunks; ++k) {
+         text = &chunks[k]->forms.text[f];
+         strbuf_append(out[f], text->data, text->len);
+         if (text->failed || (f == FORM_PREFIX && chunks[k]->ops.failed))
+            out[f]->failed = 1;
       }
-      return result;
+      if (f == FORM_PAREN)
+         strip_parens(out[f], start);
    }
-   if (head->type == NEXPRPP &&
-       head->num_childs == 3) {
-      result = concat(result, "^ ");
-      result = concat(result, prefix(head->child_ptrs[0]));
-      result = concat(result, prefix(head->child_ptrs[2]));
-      return result;
+   STAT_STOP(STAT_PRINT);
+}
+
+void split_run(struct split *split, int count,
+               void (*work)(struct split_chunk *chunk)) {
+   struct split_chunk *chunk;
+   int k;
+   for (k = 1; k < count; ++k) {
+      chunk = split->chunks[k];
+      chunk->work = work;
+      chunk->started = pthread_create(&chunk->thread, NULL, split_thread,
+                                      chunk) == 0;
+      if (!chunk->started)
+         work(chunk);
+   }
+   work(split->chunks[0]);
+   for (k = 1; k < count; ++k)
+      if (split->chunks[k]->started)
+         pthread_join(split->chunks[k]->thread, NULL);
+}
+
+void *split_thread(void *arg) {
+   struct split_chunk *chunk = (struct split_chunk *)arg;
+#ifdef DEBUG_STATS
+   stats_register();
+#endif
+   chunk->work(chunk);
+#ifdef DEBUG_STATS
+   stats_unregister();
+#endif
+   return NULL;
+}
+
+void split_scan(struct split_chunk *chunk) {
+   struct token *tokens = chunk->split->tokens->tokens;
+   int depth = 0;
+   int lowest = 0;
+   int i;
+   for (i = chunk->begin; i < chunk->end; ++i)
+      if (tokens[i].type == LPAREN)
+         ++depth;
+      else if (tokens[i].type == RPAREN && --depth < lowest)
+         lowest = depth;
+   chunk->depth = depth;
+   chunk->lowest = lowest;
+}
+
+void split_find(struct split_chunk *chunk) {
+   struct token *tokens = chunk->split->tokens->tokens;
+   int depth = chunk->depth;
+   int type;
+   int i;
+   chunk->first_add = -1;
+   chunk->first_mul = -1;
+   for (i = chunk->begin; i < chunk->end && chunk->first_add < 0; ++i) {
+      type = tokens[i].type;
+      if (type == LPAREN)
+         ++depth;
+      else if (type == RPAREN)
+         --depth;
+      else if (depth != 0)
+         continue;
+      else if (type == ADD || type == SUB)
+         chunk->first_add = i;
+      else if ((type == MUL || type == DIV) && chunk->first_mul < 0)
+         chunk->first_mul = i;
    }
-   if (head->type == NATOM)
-      return concat(head->string, " ");
-   if (head->type == NEXPRPPP &&
-       head->num_childs == 1)
-      return prefix(head->child_ptrs[0]);
-   if (head->type == NEXPR ||
-       head->type == NEXPRP ||
-       head->type == NEXPRPP)
-      return prefix(head->child_ptrs[0]);
-   if (head->type == NEXPRPPP)
-      return prefix(head->child_ptrs[1]);
 }
+
+void split_expr(struct split_chunk *chunk) {
+   struct split *split = chunk->split;
+   struct token_cursor cur;
+   struct pt_node *op = NULL;
+   struct pt_node *tree;
+   struct pt_node *chain;
+   struct pt_node *node;
+   int type;
+
+   /* Every chunk after the first starts with the operator at which it
+      was split off, which becomes the link of the chain that would
+      have held the chunk's first operand.                            */
+
+   token_cursor_init(&cur, split->tokens);
+   cur.tokens += chunk->begin;
+   cur.num_tokens = chunk->end - chunk->begin;
+   if (chunk->index != 0) {
+      type = cur.tokens[0].type;
+      op = type == ADD ? add(&chunk->arena, &cur) :
+           type == SUB ? sub(&chunk->arena, &cur) :
+           type == MUL ? mul(&chunk->arena, &cur) : quo(&chunk->arena, &cur);
+   }
+   tree = expr(&chunk->arena, &cur);
+   chunk->status = cur.status;
+   if (tree == NULL)
+      return;
+   chain = split->level == ADD ? tree : tree->child_ptrs[0];
+   chunk->node = tree;
+   if (op != NULL) {
+      node = create_node(&chunk->arena, split->level == ADD ? NeXPR : NeXPRP,
+                         "", 0, 3);
+      if (node == NULL) {
+         chunk->status = SP_ERR_MEMORY;
+         return;
+      }
+      node->child_ptrs[0] = op;
+      node->child_ptrs[1] = chain->child_ptrs[0];
+      node->child_ptrs[2] = chain->child_ptrs[1];
+      chunk->node = node;
+      chunk->tail = &node->child_ptrs[2];
+   } else
+      chunk->tail = &chain->child_ptrs[1];
+   while ((*chunk->tail)->num_childs == 3)
+      chunk->tail = &(*chunk->tail)->child_ptrs[2];
+}
+
+void split_print(struct split_chunk *chunk) {
+   struct split *split = chunk->split;
+   struct forms *forms = &chunk->forms;
+   struct strbuf *paren;
+   struct strbuf *post;
+   struct pt_node *link;
+   struct pt_node *stop = NULL;
+   struct pt_node *op;
+   int f;
+
+   /* Each chunk prints the operands of its part of the chain, from the
+      link starting it up to the one starting the next chunk, into the
+      strbufs of its own forms.                                        */
+
+   for (f = 0; f < NUM_FORMS; ++f)
+      forms->out[f] = split->out[f] != NULL ? &forms->text[f] : NULL;
+   forms_reset(forms);
+   strbuf_reset(&chunk->ops);
+   paren = forms->out[FORM_PAREN];
+   post = forms->out[FORM_POSTFIX];
+   chunk->num_ops = 0;
+   link = chunk->node;
+   if (chunk->index == 0) {
+      link = split->chain->child_ptrs[1];
+      pre_all_forms(split->chain->child_ptrs[0], forms, 0);
+   }
+   if (chunk->index + 1 < split->num_chunks)
+      stop = split->chunks[chunk->index + 1]->node;
+   if (forms->out[FORM_PREFIX] != NULL)
+      prefix_operators(link, stop, &chunk->ops);
+   for (; link != stop && link->num_childs == 3; link = link->child_ptrs[2]) {
+      op = link->child_ptrs[0];
+      ++chunk->num_ops;
+      if (paren != NULL)
+         strbuf_append(paren, op->string, op->len);
+      pre_all_forms(link->child_ptrs[1], forms, 0);
+      if (paren != NULL)
+         strbuf_append_str(paren, ")");
+      if (post != NULL) {
+         strbuf_append(post, op->string, op->len);
+         strbuf_append_str(post, " ");
+      }
+   }
+}
+
+void split_reset(struct split *split) {
+   int k;
+   for (k = 0; k < split->cap; ++k)
+      arena_reset(&split->chunks[k]->arena);
+   split->num_chunks = 0;
+   split->chain = NULL;
+}
+
+void split_free(struct split *split) {
+   int k;
+   for (k = 0; k < split->cap; ++k) {
+      arena_free(&split->chunks[k]->arena);
+      forms_free(&split->chunks[k]->forms);
+      strbuf_free(&split->chunks[k]->ops);
+      free(split->chunks[k]);
+   }
+   free(split->chunks);
+   free(split);
+}
+
+#endif
+
+#if defined(USE_SERVER) && !defined(SIMPLE_PARSE_NO_MAIN)
+
+int server(char *address, int options, int num_workers) {
+   struct server_worker *workers;
+   struct server_worker *worker;
+   struct epoll_event event;
+   int listen_fd;
+   int num_started;
+   int i;
+
+   listen_fd = server_listen(address);
+   if (listen_fd < 0)
+      return 1;
+   workers = (struct server_worker *)malloc(num_workers *
+                                            sizeof(struct server_worker));
+   if (workers == NULL) {
+      printf("Failed to allocate memory for worker threads!\n");
+      close(listen_fd);
+      return 1;
+   }
+   for (num_started = 0; num_started < num_workers; ++num_started) {
+      worker = &workers[num_started];
+      worker->listen_fd = listen_fd;
+      worker->options = options;
+      worker->epoll_fd = epoll_create1(0);
+      event.events = EPOLLIN | EPOLLEXCLUSIVE;
+      event.data.ptr = NULL;
+      if (worker->epoll_fd < 0)
+         break;
+      if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0 ||
+          pthread_create(&worker->thread, NULL, server_worker, worker) != 0) {
+         close(worker->epoll_fd);
+         break;
+      }
+   }
+   if (num_started == 0)
+      printf("Failed to start worker threads!\n");
+
+   /* The workers only return if waiting for events fails. */
+   for (i = 0; i < num_started; ++i)
+      pthread_join(workers[i].thread, NULL);
+   if (num_started != 0)
+      printf("Failed to wait for requests!\n");
+   close(listen_fd);
+   free(workers);
+   return 1;
+}
+
+int server_listen(char *address) {
+   struct sockaddr_un local;
+   struct addrinfo hints;
+   struct addrinfo *addrs;
+   struct addrinfo *a;
+   struct stat st;
+   char host[SERVER_HOST_MAX];
+   char *port = strrchr(address, ':');
+   size_t len;
+   int one = 1;
+   int fd = -1;
+
+   if (port == NULL || strchr(address, '/') != NULL) {
+      if (strlen(address) < sizeof(local.sun_path)) {
+         memset(&local, 0, sizeof(local));
+         local.sun_family = AF_UNIX;
+         strcpy(local.sun_path, address);
+         if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(address);
+         fd = socket(AF_UNIX, SOCK_STREAM, 0);
+         if (fd >= 0 &&
+             bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+            close(fd);
+            fd = -1;
+         }
+      }
+   } else if ((len = port++ - address) < SERVER_HOST_MAX) {
+      /* A numeric IPv6 host may be given in brackets, as in [::1]:80. */
+      if (len >= 2 && address[0] == '[' && address[len - 1] == ']')
+         memcpy(host, address + 1, len -= 2);
+      else
+         memcpy(host, address, len);
+      host[len] = '\0';
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+      if (getaddrinfo(len != 0 ? host : NULL, port, &hints, &addrs) == 0) {
+         for (a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0)
+               continue;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, a->ai_addr, a->ai_addrlen) < 0) {
+               close(fd);
+               fd = -1;
+            }
+         }
+         freeaddrinfo(addrs);
+      }
+   }
+   if (fd >= 0 &&
+       (listen(fd, SOMAXCONN) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0)) {
+      close(fd);
+      fd = -1;
+   }
+   if (fd < 0)
+      printf("Failed to listen on %s!\n", address);
+   return fd;
+}
+
+void *server_worker(void *arg) {
+   struct server_worker *worker = (struct server_worker *)arg;
+   struct epoll_event events[SERVER_EVENTS];
+   struct sp_parser parser;
+   int num_events;
+   int i;
+
+#ifdef DEBUG_STATS
+   stats_register();
+#endif
+   batch_parser_init(&parser, worker->options);
+   for (;;) {
+      num_events = epoll_wait(worker->epoll_fd, events, SERVER_EVENTS, -1);
+      if (num_events < 0 && errno == EINTR)
+         continue;
+      if (num_events < 0)
+         break;
+      for (i = 0; i < num_events; ++i)
+         if (events[i].data.ptr == NULL)
+            server_accept(worker);
+         else
+            server_serve(worker, &parser,
+                         (struct server_conn *)events[i].data.ptr,
+                         events[i].events);
+   }
+   parser_free(&parser);
+   close(worker->epoll_fd);
+#ifdef DEBUG_STATS
+   stats_unregister();
+#endif
+   return NULL;
+}
+
+void server_accept(struct server_worker *worker) {
+   struct server_conn *conn;
+   struct epoll_event event;
+   int one = 1;
+   int fd;
+
+   /* Another worker may have taken the connection already, in which
+      case accept fails with EAGAIN and there is nothing to do.       */
+   fd = accept(worker->listen_fd, NULL, NULL);
+   if (fd < 0)
+      return;
+   conn = (struct server_conn *)malloc(sizeof(struct server_conn));
+   if (conn == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+      free(conn);
+      close(fd);
+      return;
+   }
+
+   /* Replies are sent as soon as they are ready; on a Unix domain
+      socket the option does not exist and setting it fails.        */
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+   conn->fd = fd;
+   strbuf_init(&conn->in);
+   conn->in_pos = 0;
+   strbuf_init(&conn->out);
+   conn->out_pos = 0;
+   conn->eof = 0;
+   conn->events = EPOLLIN;
+   event.events = conn->events;
+   event.data.ptr = conn;
+   if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      free(conn);
+      close(fd);
+   }
+}
+
+void server_serve(struct server_worker *worker, struct sp_parser *parser,
+                  struct server_conn *conn, uint32_t events) {
+   struct epoll_event event;
+   ssize_t got;
+   uint32_t wanted;
+   int more;
+
+   if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->eof) {
+      if (strbuf_reserve(&conn->in, SERVER_READ_CHUNK) != 0) {
+         server_close(worker, conn);
+         return;
+      }
+      got = read(conn->fd, conn->in.data + conn->in.len, SERVER_READ_CHUNK);
+      if (got > 0)
+         conn->in.len += got;
+      else if (got == 0)
+         conn->eof = 1;
+      else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+         server_close(worker, conn);
+         return;
+      }
+   }
+
+   /* Answer requests and send the replies until the requests run out
+      or the socket takes no more.                                     */
+   do {
+      more = server_requests(parser, conn);
+      if (more < 0 || server_flush(conn) < 0) {
+         server_close(worker, conn);
+         return;
+      }
+   } while (more && conn->out_pos == conn->out.len);
+   server_compact(&conn->in, &conn->in_pos);
+
+   if (conn->eof && conn->out_pos == conn->out.len) {
+      server_close(worker, conn);
+      return;
+   }
+   wanted = 0;
+   if (!conn->eof && conn->out.len - conn->out_pos <= SERVER_OUT_LIMIT)
+      wanted |= EPOLLIN;
+   if (conn->out_pos != conn->out.len)
+      wanted |= EPOLLOUT;
+   if (wanted != conn->events) {
+      event.events = wanted;
+      event.data.ptr = conn;
+      if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+         server_close(worker, conn);
+         return;
+      }
+      conn->events = wanted;
+   }
+}
+
+int server_requests(struct sp_parser *parser, struct server_conn *conn) {
+   unsigned char *request;
+   uint32_t len;
+   while (conn->in.len - conn->in_pos >= 4) {
+      if (conn->out.len - conn->out_pos > SERVER_OUT_LIMIT)
+         return 1;
+      request = (unsigned char *)conn->in.data + conn->in_pos;
+      len = get_u32(request);
+      if (len == 0 || len > SERVER_MAX_REQUEST)
+         return -1;
+      if (conn->in.len - conn->in_pos - 4 < len)
+         break;
+      if (server_request(parser, request[4], (char *)request + 5, len - 1,
+                         &conn->out) < 0)
+         return -1;
+      conn->in_pos += 4 + (size_t)len;
+   }
+   return 0;
+}
+
+int server_request(struct sp_parser *parser, int forms, char *text,
+                   size_t len, struct strbuf *out) {
+   size_t start = out->len;
+   size_t offset;
+   int chosen;
+   int status;
+   int tab;
+   int f;
+
+   STAT_POLL();
+   if (strbuf_reserve(out, 9) != 0)
+      return -1;
+   out->len += 5;
+   out->data[out->len] = '\0';
+   forms &= (1 << NUM_FORMS) - 1;
+   for (f = 0, chosen = 0; f < NUM_FORMS; ++f)
+      if (parser->forms.out[f] != NULL)
+         chosen |= 1 << f;
+   if (forms == 0)
+      forms = chosen;
+   status = sp_parse(parser, text, len);
+   if (status != SP_OK) {
+      sp_error(parser, &offset);
+      put_u32((unsigned char *)out->data + out->len, (uint32_t)offset);
+      out->len += 4;
+      out->data[out->len] = '\0';
+   } else
+      for (f = 0, tab = 0; f < NUM_FORMS; ++f)
+         if (forms & 1 << f) {
+            if (tab++)
+               strbuf_append_str(out, "\t");
+            sp_render(parser, f, strbuf_sink, out);
+         }
+   put_u32((unsigned char *)out->data + start, (uint32_t)(out->len - start - 4));
+   out->data[start + 4] = (char)-status;
+   return 0;
+}
+
+int server_flush(struct server_conn *conn) {
+   ssize_t sent;
+   while (conn->out_pos < conn->out.len) {
+      sent = send(conn->fd, conn->out.data + conn->out_pos,
+                  conn->out.len - conn->out_pos, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+         continue;
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         break;
+      if (sent < 0)
+         return -1;
+      conn->out_pos += sent;
+   }
+   if (conn->out_pos >= conn->out.len / 2)
+      server_compact(&conn->out, &conn->out_pos);
+   return 0;
+}
+
+/* server_compact drops the first *pos bytes of a buffer, which have been   */
+/* dealt with.                                                              */
+
+void server_compact(struct strbuf *buf, size_t *pos) {
+   if (*pos == 0)
+      return;
+   memmove(buf->data, buf->data + *pos, buf->len - *pos);
+   buf->len -= *pos;
+   buf->data[buf->len] = '\0';
+   *pos = 0;
+}
+
+void server_close(struct server_worker *worker, struct server_conn *conn) {
+   epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+   close(conn->fd);
+   strbuf_free(&conn->in);
+   strbuf_free(&conn->out);
+   free(conn);
+}
+
+#endif
+
+int read_line(FILE *in, struct strbuf *line) {
+   size_t avail;
+   strbuf_reset(line);
+   for (;;) {
+      if (strbuf_reserve(line, LINE_CHUNK) != 0)
+         return -1;
+      avail = line->cap - line->len;
+      if (avail > INT_MAX)
+         avail = INT_MAX;
+      if (fgets(line->data + line->len, (int)avail, in) == NULL)
+         break;
+      line->len += strlen(line->data + line->len);
+      if (line->len != 0 && line->data[line->len - 1] == '\n') {
+         line->data[--line->len] = '\0';
+         if (line->len != 0 && line->data[line->len - 1] == '\r')
+            line->data[--line->len] = '\0';
+         return 1;
+      }
+   }
+   line->data[line->len] = '\0';
+   if (ferror(in))
+      return -1;
+   return line->len != 0;
+}
+
+int read_file(FILE *in, struct strbuf *data) {
+   size_t got;
+   strbuf_reset(data);
+   do {
+      if (strbuf_reserve(data, LINE_CHUNK) != 0)
+         return -1;
+      got = fread(data->data + data->len, 1, data->cap - data->len - 1, in);
+      data->len += got;
+   } while (got != 0);
+   data->data[data->len] = '\0';
+   return ferror(in) ? -1 : 0;
+}
+
+char *map_file(char *path, size_t *size) {
+#ifdef USE_MMAP
+   struct stat st;
+   void *data;
+   int fd;
+   fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return NULL;
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      close(fd);
+      return NULL;
+   }
+   data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED)
+      return NULL;
+   posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+   *size = st.st_size;
+   return (char *)data;
+#else
+   (void)path;
+   (void)size;
+   return NULL;
+#endif
+}
+
+void unmap_file(char *data, size_t size) {
+#ifdef USE_MMAP
+   munmap(data, size);
+#else
+   (void)data;
+   (void)size;
+#endif
+}
+
+void arena_init(struct arena *arena) {
+   arena->first = NULL;
+   arena->current = NULL;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+   struct arena_block *block;
+   struct arena_block *new_block;
+   size_t block_size;
+   char *result;
+
+   size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+   block = arena->current;
+   if (block == NULL || block->size - block->used < size) {
+      if (block != NULL && block->next != NULL && block->next->size >= size) {
+         /* Blocks after the current one are left over from before the
+            last arena_reset, so they can be reused from the start.     */
+         block = block->next;
+         block->used = 0;
+      } else {
+         block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+         new_block = (struct arena_block *)malloc(ARENA_HEADER_SIZE + block_size);
+         if (new_block == NULL)
+            return NULL;
+         new_block->size = block_size;
+         new_block->used = 0;
+         if (block == NULL) {
+            new_block->next = NULL;
+            arena->first = new_block;
+         } else {
+            new_block->next = block->next;
+            block->next = new_block;
+         }
+         block = new_block;
+      }
+      arena->current = block;
+   }
+   result = (char *)block + ARENA_HEADER_SIZE + block->used;
+   block->used += size;
+   STAT_ADD(arena_bytes, size);
+   return result;
+}
+
+void arena_reset(struct arena *arena) {
+   if (arena->first != NULL) {
+      arena->first->used = 0;
+      arena->current = arena->first;
+   }
+}
+
+void arena_free(struct arena *arena) {
+   struct arena_block *block;
+   struct arena_block *next;
+   for (block = arena->first; block != NULL; block = next) {
+      next = block->next;
+      free(block);
+   }
+   arena->first = NULL;
+   arena->current = NULL;
+}
+
+void token_array_init(struct token_array *array) {
+   array->tokens = NULL;
+   array->num_tokens = 0;
+   array->cap = 0;
+   array->input = NULL;
+   array->error_offset = 0;
+   array->intern = 0;
+   array->symbols = NULL;
+   array->num_symbols = 0;
+   array->symbols_cap = 0;
+   array->buckets = NULL;
+   array->num_buckets = 0;
+}
+
+void token_array_free(struct token_array *array) {
+   free(array->tokens);
+   free(array->symbols);
+   free(array->buckets);
+   token_array_init(array);
+}
+
+void token_cursor_init(struct token_cursor *cur, struct token_array *array) {
+   cur->tokens = array->tokens;
+   cur->num_tokens = array->num_tokens;
+   cur->pos = 0;
+   cur->input = array->input;
+   cur->symbols = array->symbols;
+   cur->status = SP_OK;
+   cur->error_offset = 0;
+}
+
+struct token *peek_token(struct token_cursor *cur) {
+   return cur->pos < cur->num_tokens ? &cur->tokens[cur->pos] : NULL;
+}
+
+void parse_error(struct token_cursor *cur, int status) {
+   struct token *token;
+   if (cur->status != SP_OK)
+      return;
+   cur->status = status;
+   if (cur->pos < cur->num_tokens)
+      cur->error_offset = cur->tokens[cur->pos].offset;
+   else if (cur->num_tokens != 0) {
+      token = &cur->tokens[cur->num_tokens - 1];
+      cur->error_offset = token->offset + token->len;
+   } else
+      cur->error_offset = 0;
+}
+
+struct token *create_token(struct token_array *array, int type,
+                           char *init_char, int token_len) {
+
+   struct token *result;
+   struct token *tokens;
+   int cap;
+
+   if (array->num_tokens == array->cap) {
+      cap = array->cap == 0 ? 64 :
+            array->cap > INT_MAX / 2 ? INT_MAX : 2 * array->cap;
+      tokens = (struct token *)realloc(array->tokens,
+                                       (size_t)cap * sizeof(struct token));
+      if (tokens == NULL)
+         return NULL;
+      array->tokens = tokens;
+      array->cap = cap;
+   }
+   result = &array->tokens[array->num_tokens++];
+
+   result->offset = init_char - array->input;
+   result->len = token_len;
+   result->symbol = -1;
+   result->type = type;
+
+   return result;
+}
+
+int input_lexer(struct token_array *array, char *user_input, size_t len) {
+
+   struct token *token;
+   char *first_char;
+   char *end = user_input + len;
+   int status = SP_ERR_MEMORY;
+   int cls;
+   int i;
+
+   array->num_tokens = 0;
+   array->input = user_input;
+   for (i = 0; i < array->num_symbols; ++i)
+      array->buckets[array->symbols[i].hash & (array->num_buckets - 1)] = -1;
+   array->num_symbols = 0;
+   if (len > INT_MAX) {
+      array->error_offset = 0;
+      return SP_ERR_LENGTH;
+   }
+   STAT_START(STAT_LEX);
+   while (user_input < end) {
+      cls = char_class[(unsigned char)*user_input];
+      if (cls == CC_ALPHA || cls == CC_DIGIT) {
+         first_char = user_input;
+         user_input = skip_run(user_input + 1, end, cls);
+         token = create_token(array, ATOM, first_char,
+                              user_input - first_char);
+         if (token == NULL || (array->intern &&
+                               (token->symbol = intern_symbol(array,
+                                   first_char, token->len)) < 0)) {
+            user_input = first_char;
+            break;
+         }
+      } else if (cls == CC_INVALID) {
+         status = SP_ERR_CHAR;
+         break;
+      } else {
+         if (create_token(array, cls, user_input, 1) == NULL)
+            break;
+         ++user_input;
+      }
+   }
+   STAT_ADD(tokens, array->num_tokens);
+   STAT_STOP(STAT_LEX);
+   if (user_input < end) {
+      array->num_tokens = 0;
+      array->error_offset = user_input - array->input;
+      return status;
+   }
+   return array->num_tokens;
+}
+
+int intern_symbol(struct token_array *array, char *name, int len) {
+   struct symbol *sym;
+   char *text;
+   uint64_t full = text_hash(name, len);
+   uint32_t hash = (uint32_t)(full ^ full >> 32);
+   int i;
+   int k;
+
+   /* Most names are a few letters long, for which comparing them in
+      a loop of our own is much faster than calling memcmp.         */
+
+   if (array->num_buckets != 0)
+      for (i = array->buckets[hash & (array->num_buckets - 1)]; i >= 0;
+           i = sym->next) {
+         sym = &array->symbols[i];
+         if (sym->hash != hash || sym->len != len)
+            continue;
+         text = array->input + sym->offset;
+         for (k = 0; k < len && text[k] == name[k]; ++k)
+            ;
+         if (k == len)
+            return i;
+      }
+   if (array->num_symbols == array->symbols_cap && symbols_grow(array) < 0)
+      return -1;
+   i = array->num_symbols++;
+   sym = &array->symbols[i];
+   sym->offset = name - array->input;
+   sym->len = len;
+   sym->hash = hash;
+   if (char_class[(unsigned char)name[0]] == CC_DIGIT)
+      parse_number(name, len, &sym->number);
+   else {
+      sym->number.i = -1;
+      sym->number.d = 0;
+   }
+   sym->next = array->buckets[hash & (array->num_buckets - 1)];
+   array->buckets[hash & (array->num_buckets - 1)] = i;
+   return i;
+}
+
+int intern_tokens(struct token_array *array) {
+   struct token *token;
+   int i;
+   for (i = 0; i < array->num_tokens; ++i) {
+      token = &array->tokens[i];
+      if (token->type == ATOM && token->symbol < 0 &&
+          (token->symbol = intern_symbol(array, array->input + token->offset,
+                                         token->len)) < 0)
+         return -1;
+   }
+   return 0;
+}
+
+int symbols_grow(struct token_array *array) {
+   struct symbol *symbols;
+   int *buckets;
+   int cap = array->symbols_cap == 0 ? 16 : 2 * array->symbols_cap;
+   int i;
+   symbols = (struct symbol *)realloc(array->symbols,
+                                      cap * sizeof(struct symbol));
+   if (symbols == NULL)
+      return -1;
+   array->symbols = symbols;
+   buckets = (int *)realloc(array->buckets, 2 * (size_t)cap * sizeof(int));
+   if (buckets == NULL)
+      return -1;
+   array->buckets = buckets;
+   array->symbols_cap = cap;
+   array->num_buckets = 2 * cap;
+   for (i = 0; i < array->num_buckets; ++i)
+      buckets[i] = -1;
+   for (i = 0; i < array->num_symbols; ++i) {
+      symbols[i].next = buckets[symbols[i].hash & (array->num_buckets - 1)];
+      buckets[symbols[i].hash & (array->num_buckets - 1)] = i;
+   }
+   return 0;
+}
+
+void parse_number(char *string, int len, struct number *number) {
+   char digits[NUMBER_DIGITS + 1];
+   uint64_t i = 0;
+   int k;
+
+   /* Leading zeros do not change the value; strip them so that the
+      digits fit into the buffer for strtod whenever they can.       */
+
+   while (len > 1 && string[0] == '0') {
+      ++string;
+      --len;
+   }
+   for (k = 0; k < len; ++k) {
+      if (i > ((uint64_t)INT64_MAX - (string[k] - '0')) / 10)
+         break;
+      i = i * 10 + (string[k] - '0');
+   }
+   if (k == len) {
+      number->i = (int64_t)i;
+      number->d = (double)number->i;
+   } else {
+      number->i = -1;
+      if (len > NUMBER_DIGITS)
+         number->d = HUGE_VAL;
+      else {
+         memcpy(digits, string, len);
+         digits[len] = '\0';
+         number->d = strtod(digits, NULL);
+      }
+   }
+}
+
+#define CI CC_INVALID
+#define CA CC_ALPHA
+#define CD CC_DIGIT
+
+const unsigned char char_class[256] = {
+   /* 0x00 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0x10 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0x20 */ CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0x28 */ LPAREN, RPAREN, MUL, ADD, CI, SUB, CI, DIV,
+   /* 0x30 */ CD, CD, CD, CD, CD, CD, CD, CD, CD, CD, CI, CI, CI, CI, CI, CI,
+   /* 0x40 */ CI, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA,
+   /* 0x50 */ CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CI, CI, CI, EXP, CI,
+   /* 0x60 */ CI, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA,
+   /* 0x70 */ CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CI, CI, CI, CI, CI,
+   /* 0x80 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0x90 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0xa0 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0xb0 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0xc0 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0xd0 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0xe0 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI,
+   /* 0xf0 */ CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI, CI
+};
+
+#undef CI
+#undef CA
+#undef CD
+
+char *skip_run(char *p, char *end, int cls) {
+   char fold = cls == CC_ALPHA ? 0x20 : 0;
+   char low = cls == CC_ALPHA ? 'a' : '0';
+   char last = cls == CC_ALPHA ? 'z' - 'a' : '9' - '0';
+#ifdef __AVX2__
+   __m256i fold32 = _mm256_set1_epi8(fold);
+   __m256i low32 = _mm256_set1_epi8(low);
+   __m256i last32 = _mm256_set1_epi8(last);
+   __m256i v32;
+   unsigned int mask32;
+#endif
+#ifdef __SSE2__
+   __m128i fold16 = _mm_set1_epi8(fold);
+   __m128i low16 = _mm_set1_epi8(low);
+   __m128i last16 = _mm_set1_epi8(last);
+   __m128i v16;
+   unsigned int mask16;
+#endif
+
+   /* A character is in the class when (c | fold) - low, taken as an
+      unsigned byte, is at most last; that is the case exactly when the
+      unsigned minimum of the two is the difference itself.          */
+#ifdef __AVX2__
+   while (end - p >= 32) {
+      v32 = _mm256_loadu_si256((const __m256i *)p);
+      v32 = _mm256_sub_epi8(_mm256_or_si256(v32, fold32), low32);
+      v32 = _mm256_cmpeq_epi8(_mm256_min_epu8(v32, last32), v32);
+      mask32 = ~(unsigned int)_mm256_movemask_epi8(v32);
+      if (mask32 != 0)
+         return p + __builtin_ctz(mask32);
+      p += 32;
+   }
+#endif
+#ifdef __SSE2__
+   while (end - p >= 16) {
+      v16 = _mm_loadu_si128((const __m128i *)p);
+      v16 = _mm_sub_epi8(_mm_or_si128(v16, fold16), low16);
+      v16 = _mm_cmpeq_epi8(_mm_min_epu8(v16, last16), v16);
+      mask16 = ~(unsigned int)_mm_movemask_epi8(v16) & 0xffff;
+      if (mask16 != 0)
+         return p + __builtin_ctz(mask16);
+      p += 16;
+   }
+#endif
+   (void)fold;
+   (void)low;
+   (void)last;
+   while (p < end && char_class[(unsigned char)*p] == cls)
+      ++p;
+   return p;
+}
+
+struct pt_node *create_node(struct arena *arena, int type, char *string,
+                            int len, int num_childs) {
+   struct pt_node *result;
+   result = (struct pt_node *)arena_alloc(arena, sizeof(struct pt_node) +
+                                          num_childs * sizeof(struct pt_node *));
+   if (result == NULL)
+      return NULL;
+   STAT_ADD(nodes, 1);
+   result->type = type;
+   result->width = len;
+   result->string = string;
+   result->len = len;
+   result->num_childs = num_childs;
+   return result;
+}
+
+struct pt_node *expr(struct arena *arena, struct token_cursor *cur) {
+   struct pt_stack stack;
+   struct pt_frame *frame;
+   struct pt_node *root = NULL;
+   struct pt_node **slot = &root;
+   struct pt_node **expr_tail = NULL;
+   struct pt_node **exprp_tail = NULL;
+   struct pt_node **exprpp_slot = NULL;
+   struct pt_node *base = NULL;
+   struct pt_node *node;
+   struct token *token;
+   int state = NEXPR;
+
+   /* The state is the nonterminal to be parsed next: an expr, exprp or
+      exprpp going to slot, the Exprp going to exprp_tail or the Expr
+      going to expr_tail. NEXPRPPP stands for the rest of the exprpp
+      going to exprpp_slot once its exprppp, base, has been parsed, and
+      NRPAREN for the rest of the exprppp on top of the stack once the
+      expr inside its parentheses has been parsed.                      */
+   STAT_START(STAT_PARSE);
+   pt_stack_init(&stack);
+   while (cur->status == SP_OK) {
+      switch (state) {
+         case NEXPR:
+            node = create_node(arena, NEXPR, "", 0, 2);
+            *slot = node;
+            if (node == NULL) {
+               parse_error(cur, SP_ERR_MEMORY);
+               break;
+            }
+            expr_tail = &node->child_ptrs[1];
+            slot = &node->child_ptrs[0];
+            state = NEXPRP;
+            break;
+         case NEXPRP:
+            node = create_node(arena, NEXPRP, "", 0, 2);
+            *slot = node;
+            if (node == NULL) {
+               parse_error(cur, SP_ERR_MEMORY);
+               break;
+            }
+            exprp_tail = &node->child_ptrs[1];
+            slot = &node->child_ptrs[0];
+            state = NEXPRPP;
+            break;
+         case NEXPRPP:
+            exprpp_slot = slot;
+            token = peek_token(cur);
+            STAT_ADD(lookahead, 1);
+            if (token == NULL) {
+               parse_error(cur, SP_ERR_OPERAND);
+               break;
+            }
+            base = create_node(arena, NEXPRPPP, "", 0,
+                               token->type == ATOM ? 1 : 3);
+            state = NEXPRPPP;
+            if (base == NULL)
+               parse_error(cur, SP_ERR_MEMORY);
+            else if (token->type == ATOM)
+               base->child_ptrs[0] = atom(arena, cur);
+            else {
+               base->child_ptrs[0] = lparen(arena, cur);
+               if ((frame = pt_push(&stack, base)) == NULL) {
+                  parse_error(cur, SP_ERR_MEMORY);
+                  break;
+               }
+               frame->expr_tail = expr_tail;
+               frame->exprp_tail = exprp_tail;
+               frame->exprpp_slot = exprpp_slot;
+               slot = &base->child_ptrs[1];
+               state = NEXPR;
+            }
+            break;
+         case NEXPRPPP:
+            token = peek_token(cur);
+            STAT_ADD(lookahead, 1);
+            node = create_node(arena, NEXPRPP, "", 0,
+                               token != NULL && token->type == EXP ? 3 : 1);
+            *exprpp_slot = node;
+            state = NeXPRP;
+            if (node == NULL)
+               parse_error(cur, SP_ERR_MEMORY);
+            else {
+               node->child_ptrs[0] = base;
+               if (node->num_childs == 3) {
+                  node->child_ptrs[1] = expo(arena, cur);
+                  slot = &node->child_ptrs[2];
+                  state = NEXPRPP;
+               }
+            }
+            break;
+         case NeXPRP:
+            token = peek_token(cur);
+            state = NeXPR;
+            if (token != NULL &&
+                (token->type == MUL || token->type == DIV)) {
+               node = create_node(arena, NeXPRP, "", 0, 3);
+               *exprp_tail = node;
+               if (node == NULL) {
+                  parse_error(cur, SP_ERR_MEMORY);
+                  break;
+               }
+               if (token->type == MUL)
+                  node->child_ptrs[0] = mul(arena, cur);
+               else
+                  node->child_ptrs[0] = quo(arena, cur);
+               exprp_tail = &node->child_ptrs[2];
+               slot = &node->child_ptrs[1];
+               state = NEXPRPP;
+               break;
+            }
+            node = create_node(arena, NeXPRP, "", 0, 1);
+            *exprp_tail = node;
+            if (node == NULL || (node->child_ptrs[0] = epsilon(arena)) == NULL)
+               parse_error(cur, SP_ERR_MEMORY);
+            break;
+         case NeXPR:
+            token = peek_token(cur);
+            state = NRPAREN;
+            if (token != NULL &&
+                (token->type == ADD || token->type == SUB)) {
+               node = create_node(arena, NeXPR, "", 0, 3);
+               *expr_tail = node;
+               if (node == NULL) {
+                  parse_error(cur, SP_ERR_MEMORY);
+                  break;
+               }
+               if (token->type == ADD)
+                  node->child_ptrs[0] = add(arena, cur);
+               else
+                  node->child_ptrs[0] = sub(arena, cur);
+               expr_tail = &node->child_ptrs[2];
+               slot = &node->child_ptrs[1];
+               state = NEXPRP;
+               break;
+            }
+            node = create_node(arena, NeXPR, "", 0, 1);
+            *expr_tail = node;
+            if (node == NULL || (node->child_ptrs[0] = epsilon(arena)) == NULL)
+               parse_error(cur, SP_ERR_MEMORY);
+            break;
+         default:
+            if (stack.depth == 0) {
+               if (peek_token(cur) != NULL) {
+                  parse_error(cur, SP_ERR_TOKEN);
+                  break;
+               }
+               pt_stack_free(&stack);
+               STAT_STOP(STAT_PARSE);
+               return root;
+            }
+            frame = &stack.frames[--stack.depth];
+            base = frame->node;
+            expr_tail = frame->expr_tail;
+            exprp_tail = frame->exprp_tail;
+            exprpp_slot = frame->exprpp_slot;
+            base->child_ptrs[2] = rparen(arena, cur);
+            state = NEXPRPPP;
+            break;
+      }
+   }
+
+   /* The nodes built before the error stay in the arena until it is
+      reset; nothing points at them once NULL is returned.           */
+   pt_stack_free(&stack);
+   STAT_STOP(STAT_PARSE);
+   return NULL;
+}
+
+void pt_stack_init(struct pt_stack *stack) {
+   stack->frames = stack->local;
+   stack->depth = 0;
+   stack->cap = PT_STACK_LOCAL;
+}
+
+struct pt_frame *pt_push(struct pt_stack *stack, struct pt_node *node) {
+   struct pt_frame *frame;
+   if (stack->depth == stack->cap && pt_grow(stack) < 0)
+      return NULL;
+   frame = &stack->frames[stack->depth++];
+   frame->node = node;
+   frame->step = 0;
+   frame->top = 0;
+   return frame;
+}
+
+int pt_grow(struct pt_stack *stack) {
+   struct pt_frame *frames;
+   int cap = 2 * stack->cap;
+   if (stack->frames == stack->local) {
+      frames = (struct pt_frame *)malloc(cap * sizeof(struct pt_frame));
+      if (frames != NULL)
+         memcpy(frames, stack->local, sizeof(stack->local));
+   } else
+      frames = (struct pt_frame *)realloc(stack->frames,
+                                          cap * sizeof(struct pt_frame));
+   if (frames == NULL)
+      return -1;
+   stack->frames = frames;
+   stack->cap = cap;
+   return 0;
+}
+
+void pt_stack_free(struct pt_stack *stack) {
+   if (stack->frames != stack->local)
+      free(stack->frames);
+   pt_stack_init(stack);
+}
+
+
+struct pt_node *terminal(struct arena *arena, struct token_cursor *cur,
+                         int type, int node_type, int status) {
+   struct pt_node *result;
+   struct token *token = peek_token(cur);
+   if (token == NULL || token->type != type) {
+      parse_error(cur, status);
+      return NULL;
+   }
+   result = create_node(arena, node_type, cur->input + token->offset,
+                        token->len, 0);
+   if (result == NULL) {
+      parse_error(cur, SP_ERR_MEMORY);
+      return NULL;
+   }
+   ++cur->pos;
+   return result;
+}
+
+struct pt_node *lparen(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, LPAREN, NLPAREN, SP_ERR_OPERAND);
+}
+
+struct pt_node *rparen(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, RPAREN, NRPAREN, SP_ERR_RPAREN);
+}
+
+struct pt_node *expo(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, EXP, NEXP, SP_ERR_TOKEN);
+}
+
+struct pt_node *mul(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, MUL, NMUL, SP_ERR_TOKEN);
+}
+
+struct pt_node *quo(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, DIV, NDIV, SP_ERR_TOKEN);
+}
+
+struct pt_node *add(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, ADD, NADD, SP_ERR_TOKEN);
+}
+
+struct pt_node *sub(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, SUB, NSUB, SP_ERR_TOKEN);
+}
+
+struct pt_node *atom(struct arena *arena, struct token_cursor *cur) {
+   return terminal(arena, cur, ATOM, NATOM, SP_ERR_OPERAND);
+}
+
+struct pt_node *epsilon(struct arena *arena) {
+   return create_node(arena, NEPSILON, "", 0, 0);
+}
+
+int ast_build(struct arena *arena, struct token_array *tokens,
+              struct ast *ast, int share) {
+   struct token_cursor cur;
+   int max_nodes = 0;
+   int failed;
+   int i;
+   STAT_START(STAT_COMPACT);
+   for (i = 0; i < tokens->num_tokens; ++i)
+      if (tokens->tokens[i].type != LPAREN && tokens->tokens[i].type != RPAREN)
+         ++max_nodes;
+   failed = ast_init(arena, ast, max_nodes, share) < 0 ||
+            (!tokens->intern && intern_tokens(tokens) < 0);
+   token_cursor_init(&cur, tokens);
+   if (failed)
+      parse_error(&cur, SP_ERR_MEMORY);
+   else {
+      ast->num_symbols = tokens->num_symbols;
+      ast->root = ast_expr(ast, &cur);
+      if (ast->root >= 0 && peek_token(&cur) != NULL)
+         parse_error(&cur, SP_ERR_TOKEN);
+      else if (ast->root < 0)
+         parse_error(&cur, SP_ERR_MEMORY);
+   }
+
+   /* parse_error keeps the first error, so SP_ERR_MEMORY above only
+      stands when ast_expr failed without recording why, which only a
+      full node array can cause.                                     */
+   if (cur.status != SP_OK)
+      ast->root = -1;
+   ast->status = cur.status;
+   ast->error_offset = cur.error_offset;
+   STAT_STOP(STAT_COMPACT);
+   return ast->root;
+}
+
+int ast_init(struct arena *arena, struct ast *ast, int max_nodes, int share) {
+   int i;
+   ast->nodes = (struct ast_node *)arena_alloc(arena,
+                                               max_nodes * sizeof(struct ast_node));
+   ast->root = -1;
+   ast->num_symbols = 0;
+   ast->status = SP_OK;
+   ast->error_offset = 0;
+   if (ast->nodes == NULL && max_nodes != 0)
+      ast->max_nodes = 0;
+   else
+      ast->max_nodes = max_nodes;
+   ast->num_nodes = 0;
+   ast->buckets = NULL;
+   ast->chain = NULL;
+   ast->num_buckets = 0;
+   ast->spans = NULL;
+
+   /* The hash table has at least twice as many buckets as there can
+      be nodes. If it cannot be allocated, the tree is built unshared. */
+
+   if (share && ast->max_nodes != 0) {
+      for (ast->num_buckets = 16; ast->num_buckets < 2 * max_nodes; )
+         ast->num_buckets *= 2;
+      ast->buckets = (int *)arena_alloc(arena, ast->num_buckets *
+                                               sizeof(int));
+      ast->chain = (int *)arena_alloc(arena, max_nodes * sizeof(int));
+      ast->spans = (struct ast_span *)arena_alloc(arena, NUM_FORMS *
+                                                  (size_t)max_nodes *
+                                                  sizeof(struct ast_span));
+      if (ast->buckets == NULL || ast->chain == NULL || ast->spans == NULL) {
+         ast->buckets = NULL;
+         ast->spans = NULL;
+      } else
+         for (i = 0; i < ast->num_buckets; ++i)
+            ast->buckets[i] = -1;
+   }
+   return ast->max_nodes == max_nodes ? 0 : -1;
+}
+
+int ast_expr(struct ast *ast, struct token_cursor *cur) {
+   struct ast_stack stack;
+   struct ast_frame *frame;
+   struct token *token;
+   struct token *op;
+   int node = -1;
+   int prec;
+
+   /* node is -1 while an operand is due and the operand read last
+      otherwise. ast_node failing leaves the status alone, so that
+      ast_build can tell a full node array from malformed input.   */
+   ast_stack_init(&stack);
+   while (cur->status == SP_OK) {
+      token = peek_token(cur);
+      if (node < 0) {
+         if (token != NULL && token->type == LPAREN) {
+            if (ast_push(&stack, -1) == NULL)
+               parse_error(cur, SP_ERR_MEMORY);
+            ++cur->pos;
+            continue;
+         }
+         if (token == NULL || token->type != ATOM) {
+            parse_error(cur, SP_ERR_OPERAND);
+            break;
+         }
+         ++cur->pos;
+         node = ast_node(ast, NATOM, cur->input + token->offset, token->len,
+                         -1, -1, token->symbol,
+                         &cur->symbols[token->symbol].number);
+         if (node < 0)
+            break;
+         continue;
+      }
+      prec = token == NULL ? 0 : token->type == EXP ? 3 :
+             token->type == MUL || token->type == DIV ? 2 :
+             token->type == ADD || token->type == SUB ? 1 : 0;
+      while (stack.depth > 0 && node >= 0) {
+         frame = &stack.frames[stack.depth - 1];
+         if (frame->step == 0 || frame->step < prec + (prec == 3))
+            break;
+         op = frame->op;
+         node = ast_node(ast, op->type - EXP + NEXP, cur->input + op->offset,
+                         op->len, frame->node, node, -1, NULL);
+         --stack.depth;
+      }
+      if (node < 0)
+         break;
+      if (prec > 0) {
+         if ((frame = ast_push(&stack, node)) == NULL) {
+            parse_error(cur, SP_ERR_MEMORY);
+            break;
+         }
+         frame->step = prec;
+         frame->op = token;
+         ++cur->pos;
+         node = -1;
+         continue;
+      }
+      if (stack.depth == 0)
+         break;
+      if (token == NULL || token->type != RPAREN) {
+         parse_error(cur, SP_ERR_RPAREN);
+         break;
+      }
+      ++cur->pos;
+      --stack.depth;
+   }
+   ast_stack_free(&stack);
+   return cur->status == SP_OK ? node : -1;
+}
+
+void ast_stack_init(struct ast_stack *stack) {
+   stack->frames = stack->local;
+   stack->depth = 0;
+   stack->cap = PT_STACK_LOCAL;
+}
+
+struct ast_frame *ast_push(struct ast_stack *stack, int node) {
+   struct ast_frame *frame;
+   if (stack->depth == stack->cap && ast_grow(stack) < 0)
+      return NULL;
+   frame = &stack->frames[stack->depth++];
+   frame->node = node;
+   frame->step = 0;
+   frame->top = 0;
+   return frame;
+}
+
+int ast_grow(struct ast_stack *stack) {
+   struct ast_frame *frames;
+   int cap = 2 * stack->cap;
+   if (stack->frames == stack->local) {
+      frames = (struct ast_frame *)malloc(cap * sizeof(struct ast_frame));
+      if (frames != NULL)
+         memcpy(frames, stack->local, sizeof(stack->local));
+   } else
+      frames = (struct ast_frame *)realloc(stack->frames,
+                                           cap * sizeof(struct ast_frame));
+   if (frames == NULL)
+      return -1;
+   stack->frames = frames;
+   stack->cap = cap;
+   return 0;
+}
+
+void ast_stack_free(struct ast_stack *stack) {
+   if (stack->frames != stack->local)
+      free(stack->frames);
+   ast_stack_init(stack);
+}
+
+int ast_node(struct ast *ast, int type, char *string, int len, int left,
+             int right, int symbol, const struct number *number) {
+   struct ast_node *node;
+   uint64_t hash = 0;
+   int i;
+
+   /* Only the constants folded by ast_simplify, which have no symbol,
+      are told apart by their lexemes; any other atom is known by its
+      symbol alone, and an operator by its operands.                  */
+
+   if (ast->buckets != NULL) {
+      hash = type == NATOM && symbol < 0 ? text_hash(string, len) :
+             ((uint64_t)type * 0x9e3779b97f4a7c15u ^ (uint32_t)left) *
+             0x100000001b3u ^ (uint32_t)right ^ (uint64_t)symbol << 32;
+      hash = (hash ^ hash >> 29) & (ast->num_buckets - 1);
+      for (i = ast->buckets[hash]; i >= 0; i = ast->chain[i]) {
+         node = &ast->nodes[i];
+         if (node->type == type && node->left == left &&
+             node->right == right && node->symbol == symbol &&
+             (type != NATOM || symbol >= 0 ||
+              (node->len == len && memcmp(node->string, string, len) == 0)))
+            return i;
+      }
+   }
+   if (ast->num_nodes == ast->max_nodes)
+      return -1;
+   node = &ast->nodes[ast->num_nodes];
+   node->type = type;
+   node->string = string;
+   node->len = len;
+   node->left = left;
+   node->right = right;
+   node->symbol = symbol;
+   if (number != NULL)
+      node->number = *number;
+   else {
+      node->number.i = -1;
+      node->number.d = 0;
+   }
+   if (ast->buckets != NULL) {
+      ast->chain[ast->num_nodes] = ast->buckets[hash];
+      ast->buckets[hash] = ast->num_nodes;
+   }
+   return ast->num_nodes++;
+}
+
+int ast_simplify(struct arena *arena, struct ast *ast, int strict,
+                 struct ast *result) {
+   struct ast_node *n;
+   int64_t *values;
+   int *refs;
+   int keep;
+   int i;
+
+   /* values[i] is the value of node i if it is a constant, and -1
+      otherwise; refs[i] is the index of the node standing in for it
+      in result, or -1 while there is none. Constants are only added
+      to result once an operator that is not folded needs them.      */
+
+   if (ast_init(arena, result, ast->num_nodes, ast->buckets != NULL) < 0)
+      return -1;
+   result->num_symbols = ast->num_symbols;
+   values = (int64_t *)arena_alloc(arena, ast->num_nodes * sizeof(int64_t));
+   refs = (int *)arena_alloc(arena, ast->num_nodes * sizeof(int));
+   if ((values == NULL || refs == NULL) && ast->num_nodes != 0)
+      return -1;
+   for (i = 0; i < ast->num_nodes; ++i) {
+      n = &ast->nodes[i];
+      refs[i] = -1;
+      if (n->type == NATOM) {
+         values[i] = ast_constant(n);
+         if (values[i] < 0)
+            refs[i] = ast_node(result, NATOM, n->string, n->len, -1, -1,
+                               n->symbol, &n->number);
+         continue;
+      }
+      values[i] = -1;
+      if (values[n->left] >= 0 && values[n->right] >= 0)
+         values[i] = ast_fold(n->type, values[n->left], values[n->right]);
+      if (values[i] >= 0)
+         continue;
+      keep = ast_identity(n->type, values[n->left], values[n->right],
+                          strict);
+      if (keep >= 0) {
+         values[i] = values[keep == 0 ? n->left : n->right];
+         refs[i] = refs[keep == 0 ? n->left : n->right];
+         continue;
+      }
+      if (ast_simplified(arena, ast, n->left, values, refs, result) < 0 ||
+          ast_simplified(arena, ast, n->right, values, refs, result) < 0)
+         return -1;
+      refs[i] = ast_node(result, n->type, n->string, n->len, refs[n->left],
+                         refs[n->right], -1, NULL);
+   }
+   if (ast->root >= 0)
+      result->root = ast_simplified(arena, ast, ast->root, values, refs,
+                                    result);
+   return result->root;
+}
+
+int64_t ast_constant(struct ast_node *n) {
+   return n->number.i <= AST_FOLD_LIMIT ? n->number.i : -1;
+}
+
+int64_t ast_fold(int type, int64_t left, int64_t right) {
+   int64_t result = 1;
+   switch (type) {
+   case NADD:
+      return left + right <= AST_FOLD_LIMIT ? left + right : -1;
+   case NSUB:
+      return left - right;
+   case NMUL:
+      return right == 0 || left <= AST_FOLD_LIMIT / right ? left * right : -1;
+   case NDIV:
+      return right != 0 && left % right == 0 ? left / right : -1;
+   case NEXP:
+      if (left <= 1)
+         return right == 0 ? 1 : left;
+      for (; right > 0; --right) {
+         if (result > AST_FOLD_LIMIT / left)
+            return -1;
+         result *= left;
+      }
+      return result;
+   }
+   return -1;
+}
+
+int ast_identity(int type, int64_t left, int64_t right, int strict) {
+
+   /* 0 keeps the left operand, 1 the right one, -1 neither. */
+
+   switch (type) {
+   case NADD:
+      if (strict)
+         return -1;
+      return right == 0 ? 0 : left == 0 ? 1 : -1;
+   case NSUB:
+      return right == 0 ? 0 : -1;
+   case NMUL:
+      return right == 1 ? 0 : left == 1 ? 1 : -1;
+   case NDIV:
+   case NEXP:
+      return right == 1 ? 0 : -1;
+   }
+   return -1;
+}
+
+int ast_simplified(struct arena *arena, struct ast *ast, int node,
+                   int64_t *values, int *refs, struct ast *result) {
+   struct ast_node *n = &ast->nodes[node];
+   struct number number;
+   char *text;
+   int len;
+   if (refs[node] >= 0)
+      return refs[node];
+   if (n->type == NATOM)
+      refs[node] = ast_node(result, NATOM, n->string, n->len, -1, -1,
+                            n->symbol, &n->number);
+   else {
+      text = (char *)arena_alloc(arena, 24);
+      if (text == NULL)
+         return -1;
+      len = snprintf(text, 24, "%" PRId64, values[node]);
+      number.i = values[node];
+      number.d = (double)values[node];
+      refs[node] = ast_node(result, NATOM, text, len, -1, -1, -1, &number);
+   }
+   return refs[node];
+}
+
+void strbuf_init(struct strbuf *buf) {
+   buf->data = "";
+   buf->len = 0;
+   buf->cap = 0;
+   buf->failed = 0;
+}
+
+int strbuf_reserve(struct strbuf *buf, size_t extra) {
+   char *data;
+   size_t cap;
+   if (buf->len + extra < buf->cap)
+      return 0;
+   cap = buf->cap == 0 ? 64 : buf->cap;
+   while (cap <= buf->len + extra)
+      cap *= 2;
+   data = (char *)realloc(buf->cap == 0 ? NULL : buf->data, cap);
+   if (data == NULL) {
+      buf->failed = 1;
+      return -1;
+   }
+   if (buf->cap == 0)
+      data[0] = '\0';
+   STAT_ADD(strbuf_bytes, cap - buf->cap);
+   buf->data = data;
+   buf->cap = cap;
+   return 0;
+}
+
+void strbuf_append(struct strbuf *buf, const char *str, size_t len) {
+   if (strbuf_reserve(buf, len) != 0)
+      return;
+   memcpy(buf->data + buf->len, str, len);
+   buf->len += len;
+   buf->data[buf->len] = '\0';
+}
+
+void strbuf_append_str(struct strbuf *buf, const char *str) {
+   strbuf_append(buf, str, strlen(str));
+}
+
+void strbuf_append_copy(struct strbuf *buf, size_t start, size_t len) {
+   if (strbuf_reserve(buf, len) != 0)
+      return;
+   memcpy(buf->data + buf->len, buf->data + start, len);
+   buf->len += len;
+   buf->data[buf->len] = '\0';
+}
+
+void strbuf_replace(struct strbuf *buf, size_t start, size_t deleted,
+                    const char *str, size_t len) {
+   if ((len == 0 && deleted == 0) ||
+       (len > deleted && strbuf_reserve(buf, len - deleted) != 0))
+      return;
+   memmove(buf->data + start + len, buf->data + start + deleted,
+           buf->len - start - deleted + 1);
+   memcpy(buf->data + start, str, len);
+   buf->len = buf->len - deleted + len;
+}
+
+void strbuf_reset(struct strbuf *buf) {
+   buf->len = 0;
+   buf->failed = 0;
+   if (buf->cap != 0)
+      buf->data[0] = '\0';
+}
+
+void strbuf_free(struct strbuf *buf) {
+   if (buf->cap != 0)
+      free(buf->data);
+   strbuf_init(buf);
+}
+
+void pre_compl_par(struct pt_node *head, struct strbuf *out) {
+   struct pt_stack stack;
+   struct pt_frame *frame;
+   struct pt_node *dummy;
+   int enter = 1;
+   if (head == NULL)
+      return;
+   pt_stack_init(&stack);
+   for (;;) {
+      if (enter) {
+         /* head is the next node to be printed. Operator chains and
+            exponentiations get a frame, to be resumed at step 1 (the
+            next operator of the chain and its right operand) and 2
+            (closing its parenthesis), or at step 3 (the ^ and the
+            exponent) and 4 (closing the parenthesis); atoms do not. */
+         if ((head->type == NEXPR || head->type == NEXPRP) &&
+             head->child_ptrs[1]->num_childs == 3) {
+            strbuf_append_str(out, "(");
+            dummy = head->child_ptrs[1]->child_ptrs[2];
+            while (dummy->num_childs == 3) {
+               strbuf_append_str(out, "(");
+               dummy = dummy->child_ptrs[2];
+            }
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->link = head->child_ptrs[1];
+            frame->step = 1;
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPP &&
+                    head->num_childs == 3) {
+            strbuf_append_str(out, "(");
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->step = 3;
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NADD ||
+                    head->type == NSUB ||
+                    head->type == NMUL ||
+                    head->type == NDIV ||
+                    head->type == NATOM)
+            strbuf_append(out, head->string, head->len);
+         else if (head->type == NEXPRPPP &&
+                  head->num_childs == 1) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPR ||
+                    head->type == NEXPRP ||
+                    head->type == NEXPRPP) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPPP) {
+            head = head->child_ptrs[1];
+            continue;
+         }
+         enter = 0;
+      }
+      if (stack.depth == 0)
+         break;
+      frame = &stack.frames[stack.depth - 1];
+      dummy = frame->link;
+      if (frame->step == 1) {
+         strbuf_append(out, dummy->child_ptrs[0]->string, dummy->child_ptrs[0]->len);
+         frame->step = 2;
+         head = dummy->child_ptrs[1];
+         enter = 1;
+      } else if (frame->step == 2) {
+         strbuf_append_str(out, ")");
+         frame->link = dummy->child_ptrs[2];
+         if (frame->link->num_childs == 1)
+            --stack.depth;
+         else
+            frame->step = 1;
+      } else if (frame->step == 3) {
+         strbuf_append_str(out, "^");
+         frame->step = 4;
+         head = frame->node->child_ptrs[2];
+         enter = 1;
+      } else {
+         strbuf_append_str(out, ")");
+         --stack.depth;
+      }
+   }
+   if (stack.depth != 0)
+      out->failed = 1;
+   pt_stack_free(&stack);
+}
+
+void strip_parens(struct strbuf *out, size_t start) {
+   if (out->len - start >= 2 && out->data[start] == '(') {
+      memmove(out->data + start, out->data + start + 1, out->len - start - 2);
+      out->len -= 2;
+      out->data[out->len] = '\0';
+   }
+}
+
+void compl_par(struct pt_node *head, struct strbuf *out) {
+   size_t start = out->len;
+   pre_compl_par(head, out);
+   strip_parens(out, start);
+}
+
+void postfix(struct pt_node *head, struct strbuf *out) {
+   struct pt_stack stack;
+   struct pt_frame *frame;
+   struct pt_node *dummy;
+   int enter = 1;
+   if (head == NULL)
+      return;
+   pt_stack_init(&stack);
+   for (;;) {
+      if (enter) {
+         /* As in pre_compl_par, a frame is resumed at step 1 (the right
+            operand of the next operator of a chain) and 2 (the operator
+            itself), or at step 3 (the exponent) and 4 (the ^).          */
+         if ((head->type == NEXPR || head->type == NEXPRP) &&
+             head->child_ptrs[1]->num_childs == 3) {
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->link = head->child_ptrs[1];
+            frame->step = 1;
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPP &&
+                    head->num_childs == 3) {
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->step = 3;
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NATOM) {
+            strbuf_append(out, head->string, head->len);
+            strbuf_append_str(out, " ");
+         } else if (head->type == NEXPRPPP &&
+                    head->num_childs == 1) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPR ||
+                    head->type == NEXPRP ||
+                    head->type == NEXPRPP) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPPP) {
+            head = head->child_ptrs[1];
+            continue;
+         }
+         enter = 0;
+      }
+      if (stack.depth == 0)
+         break;
+      frame = &stack.frames[stack.depth - 1];
+      dummy = frame->link;
+      if (frame->step == 1) {
+         frame->step = 2;
+         head = dummy->child_ptrs[1];
+         enter = 1;
+      } else if (frame->step == 2) {
+         strbuf_append(out, dummy->child_ptrs[0]->string, dummy->child_ptrs[0]->len);
+         strbuf_append_str(out, " ");
+         frame->link = dummy->child_ptrs[2];
+         if (frame->link->num_childs == 1)
+            --stack.depth;
+         else
+            frame->step = 1;
+      } else if (frame->step == 3) {
+         frame->step = 4;
+         head = frame->node->child_ptrs[2];
+         enter = 1;
+      } else {
+         strbuf_append_str(out, "^ ");
+         --stack.depth;
+      }
+   }
+   if (stack.depth != 0)
+      out->failed = 1;
+   pt_stack_free(&stack);
+}
+
+void prefix(struct pt_node *head, struct strbuf *out) {
+   struct pt_stack stack;
+   struct pt_frame *frame;
+   struct pt_node *dummy;
+   int enter = 1;
+   if (head == NULL)
+      return;
+   pt_stack_init(&stack);
+   for (;;) {
+      if (enter) {
+         /* The operators come first, so a frame is only resumed for the
+            operands: at step 1 for the right operand of the next
+            operator of a chain, and at step 2 for the exponent, which
+            takes the place of the exponentiation on the stack.        */
+         if ((head->type == NEXPR || head->type == NEXPRP) &&
+             head->child_ptrs[1]->num_childs == 3) {
+            prefix_operators(head->child_ptrs[1], NULL, out);
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->link = head->child_ptrs[1];
+            frame->step = 1;
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPP &&
+                    head->num_childs == 3) {
+            strbuf_append_str(out, "^ ");
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->step = 2;
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NATOM) {
+            strbuf_append(out, head->string, head->len);
+            strbuf_append_str(out, " ");
+         } else if (head->type == NEXPRPPP &&
+                    head->num_childs == 1) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPR ||
+                    head->type == NEXPRP ||
+                    head->type == NEXPRPP) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPPP) {
+            head = head->child_ptrs[1];
+            continue;
+         }
+         enter = 0;
+      }
+      if (stack.depth == 0)
+         break;
+      frame = &stack.frames[stack.depth - 1];
+      dummy = frame->link;
+      if (frame->step == 2) {
+         head = frame->node->child_ptrs[2];
+         --stack.depth;
+         enter = 1;
+      } else if (dummy->num_childs != 1) {
+         frame->link = dummy->child_ptrs[2];
+         head = dummy->child_ptrs[1];
+         enter = 1;
+      } else
+         --stack.depth;
+   }
+   if (stack.depth != 0)
+      out->failed = 1;
+   pt_stack_free(&stack);
+}
+
+void prefix_operators(struct pt_node *chain, struct pt_node *stop,
+                      struct strbuf *out) {
+   struct pt_node *dummy;
+   size_t total = 0;
+   size_t pos;
+   size_t len;
+   for (dummy = chain; dummy != stop && dummy->num_childs == 3;
+        dummy = dummy->child_ptrs[2])
+      total += dummy->child_ptrs[0]->len + 1;
+   if (strbuf_reserve(out, total) != 0)
+      return;
+   /* The first operator of the chain is applied innermost, so it goes
+      last; fill the reserved space from its end towards its start.    */
+   pos = out->len + total;
+   for (dummy = chain; dummy != stop && dummy->num_childs == 3;
+        dummy = dummy->child_ptrs[2]) {
+      len = dummy->child_ptrs[0]->len;
+      pos -= len + 1;
+      memcpy(out->data + pos, dummy->child_ptrs[0]->string, len);
+      out->data[pos + len] = ' ';
+   }
+   out->len += total;
+   out->data[out->len] = '\0';
+}
+
+void ast_compl_par(struct ast *ast, struct strbuf *out) {
+   struct strbuf *outs[NUM_FORMS] = { NULL, NULL, NULL };
+   outs[FORM_PAREN] = out;
+   ast_spans_reset(ast);
+   ast_pre_all_forms(ast, ast->root, outs, 1);
+}
+
+void ast_postfix(struct ast *ast, int node, struct strbuf *out) {
+   struct strbuf *outs[NUM_FORMS] = { NULL, NULL, NULL };
+   outs[FORM_POSTFIX] = out;
+   ast_spans_reset(ast);
+   ast_pre_all_forms(ast, node, outs, 0);
+}
+
+void ast_prefix(struct ast *ast, int node, struct strbuf *out) {
+   struct strbuf *outs[NUM_FORMS] = { NULL, NULL, NULL };
+   outs[FORM_PREFIX] = out;
+   ast_spans_reset(ast);
+   ast_pre_all_forms(ast, node, outs, 0);
+}
+
+void ast_spans_reset(struct ast *ast) {
+   size_t i;
+   if (ast->spans != NULL)
+      for (i = 0; i < NUM_FORMS * (size_t)ast->num_nodes; ++i)
+         ast->spans[i].start = AST_UNPRINTED;
+}
+
+void ast_printed(struct ast *ast, int node, int form, size_t start,
+                 struct strbuf *out) {
+   struct ast_span *span;
+   if (ast->spans == NULL)
+      return;
+   span = &ast->spans[(size_t)node * NUM_FORMS + form];
+   span->start = start;
+   span->len = out->len - start;
+}
+
+int ast_print_again(struct ast *ast, int node, int form, struct strbuf *out) {
+   struct ast_span *span;
+   if (ast->spans == NULL)
+      return 0;
+   span = &ast->spans[(size_t)node * NUM_FORMS + form];
+   if (span->start == AST_UNPRINTED)
+      return 0;
+   strbuf_append_copy(out, span->start, span->len);
+   return 1;
+}
+
+void forms_init(struct forms *forms, int wanted) {
+   int f;
+   for (f = 0; f < NUM_FORMS; ++f) {
+      strbuf_init(&forms->text[f]);
+      forms->out[f] = wanted & 1 << f ? &forms->text[f] : NULL;
+   }
+}
+
+void forms_reset(struct forms *forms) {
+   int f;
+   for (f = 0; f < NUM_FORMS; ++f)
+      strbuf_reset(&forms->text[f]);
+}
+
+void forms_free(struct forms *forms) {
+   int f;
+   for (f = 0; f < NUM_FORMS; ++f)
+      strbuf_free(&forms->text[f]);
+}
+
+int parse_forms(char *list) {
+   static const char *names[NUM_FORMS] = { "paren", "postfix", "prefix" };
+   size_t len;
+   int wanted = 0;
+   int f;
+   for (;;) {
+      len = strcspn(list, ",");
+      for (f = 0; f < NUM_FORMS; ++f)
+         if (strlen(names[f]) == len && strncmp(list, names[f], len) == 0)
+            break;
+      if (f == NUM_FORMS)
+         return -1;
+      wanted |= 1 << f;
+      if (list[len] == '\0')
+         return wanted;
+      list += len + 1;
+   }
+}
+
+void all_forms(struct pt_node *head, struct forms *forms) {
+   STAT_START(STAT_PRINT);
+   pre_all_forms(head, forms, 1);
+   STAT_STOP(STAT_PRINT);
+}
+
+void pre_all_forms(struct pt_node *head, struct forms *forms, int top) {
+   struct strbuf *paren = forms->out[FORM_PAREN];
+   struct strbuf *post = forms->out[FORM_POSTFIX];
+   struct strbuf *pre = forms->out[FORM_PREFIX];
+   struct pt_stack stack;
+   struct pt_frame *frame;
+   struct pt_node *dummy;
+   struct pt_node *op;
+   int enter = 1;
+   int f;
+   if (head == NULL)
+      return;
+   pt_stack_init(&stack);
+   for (;;) {
+      if (enter) {
+         /* The steps are those of pre_compl_par, with the postfix form
+            of an operator written where pre_compl_par closes its
+            parenthesis; top is that of the node entered.             */
+         if ((head->type == NEXPR || head->type == NEXPRP) &&
+             head->child_ptrs[1]->num_childs == 3) {
+            if (paren != NULL) {
+               if (!top)
+                  strbuf_append_str(paren, "(");
+               for (dummy = head->child_ptrs[1]->child_ptrs[2];
+                    dummy->num_childs == 3; dummy = dummy->child_ptrs[2])
+                  strbuf_append_str(paren, "(");
+            }
+            if (pre != NULL)
+               prefix_operators(head->child_ptrs[1], NULL, pre);
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->link = head->child_ptrs[1];
+            frame->step = 1;
+            frame->top = top;
+            head = head->child_ptrs[0];
+            top = 0;
+            continue;
+         } else if (head->type == NEXPRPP &&
+                    head->num_childs == 3) {
+            if (paren != NULL && !top)
+               strbuf_append_str(paren, "(");
+            if (pre != NULL)
+               strbuf_append_str(pre, "^ ");
+            if ((frame = pt_push(&stack, head)) == NULL)
+               break;
+            frame->step = 3;
+            frame->top = top;
+            head = head->child_ptrs[0];
+            top = 0;
+            continue;
+         } else if (head->type == NATOM) {
+            if (paren != NULL)
+               strbuf_append(paren, head->string, head->len);
+            if (post != NULL) {
+               strbuf_append(post, head->string, head->len);
+               strbuf_append_str(post, " ");
+            }
+            if (pre != NULL) {
+               strbuf_append(pre, head->string, head->len);
+               strbuf_append_str(pre, " ");
+            }
+         } else if (head->type == NEXPRPPP &&
+                    head->num_childs == 1) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPR ||
+                    head->type == NEXPRP ||
+                    head->type == NEXPRPP) {
+            head = head->child_ptrs[0];
+            continue;
+         } else if (head->type == NEXPRPPP) {
+            head = head->child_ptrs[1];
+            continue;
+         }
+         enter = 0;
+      }
+      if (stack.depth == 0)
+         break;
+      frame = &stack.frames[stack.depth - 1];
+      dummy = frame->link;
+      if (frame->step == 1) {
+         op = dummy->child_ptrs[0];
+         if (paren != NULL)
+            strbuf_append(paren, op->string, op->len);
+         frame->step = 2;
+         head = dummy->child_ptrs[1];
+         enter = 1;
+      } else if (frame->step == 2) {
+         op = dummy->child_ptrs[0];
+         if (paren != NULL &&
+             (!frame->top || dummy->child_ptrs[2]->num_childs == 3))
+            strbuf_append_str(paren, ")");
+         if (post != NULL) {
+            strbuf_append(post, op->string, op->len);
+            strbuf_append_str(post, " ");
+         }
+         frame->link = dummy->child_ptrs[2];
+         if (frame->link->num_childs == 1)
+            --stack.depth;
+         else
+            frame->step = 1;
+      } else if (frame->step == 3) {
+         if (paren != NULL)
+            strbuf_append_str(paren, "^");
+         frame->step = 4;
+         head = frame->node->child_ptrs[2];
+         enter = 1;
+      } else {
+         if (paren != NULL && !frame->top)
+            strbuf_append_str(paren, ")");
+         if (post != NULL)
+            strbuf_append_str(post, "^ ");
+         --stack.depth;
+      }
+   }
+   if (stack.depth != 0)
+      for (f = 0; f < NUM_FORMS; ++f)
+         if (forms->out[f] != NULL)
+            forms->out[f]->failed = 1;
+   pt_stack_free(&stack);
+}
+
+void ast_all_forms(struct ast *ast, struct forms *forms) {
+   STAT_START(STAT_PRINT);
+   ast_spans_reset(ast);
+   ast_pre_all_forms(ast, ast->root, forms->out, 1);
+   STAT_STOP(STAT_PRINT);
+}
+
+void ast_pre_all_forms(struct ast *ast, int node, struct strbuf **out,
+                       int top) {
+   struct strbuf *paren = out[FORM_PAREN];
+   struct strbuf *post = out[FORM_POSTFIX];
+   struct strbuf *pre = out[FORM_PREFIX];
+   struct ast_stack stack;
+   struct ast_frame *frame;
+   struct ast_node *n;
+   int first;
+   int f;
+
+   /* The spans of all wanted forms are recorded together, so the first
+      of them tells whether a node has been printed before. node is -1
+      once the node entered last is done with.                         */
+   for (first = 0; first < NUM_FORMS && out[first] == NULL; ++first)
+      ;
+   if (first == NUM_FORMS)
+      return;
+   ast_stack_init(&stack);
+   for (;;) {
+      if (node >= 0) {
+         n = &ast->nodes[node];
+         if (n->type == NATOM) {
+            if (paren != NULL)
+               strbuf_append(paren, n->string, n->len);
+            if (post != NULL) {
+               strbuf_append(post, n->string, n->len);
+               strbuf_append_str(post, " ");
+            }
+            if (pre != NULL) {
+               strbuf_append(pre, n->string, n->len);
+               strbuf_append_str(pre, " ");
+            }
+         } else if (ast_print_again(ast, node, first, out[first])) {
+            for (f = first + 1; f < NUM_FORMS; ++f)
+               if (out[f] != NULL)
+                  ast_print_again(ast, node, f, out[f]);
+         } else {
+            if ((frame = ast_push(&stack, node)) == NULL)
+               break;
+            for (f = 0; f < NUM_FORMS; ++f)
+               frame->start[f] = out[f] != NULL ? out[f]->len : 0;
+            frame->top = top;
+            if (paren != NULL && !top)
+               strbuf_append_str(paren, "(");
+            if (pre != NULL) {
+               strbuf_append(pre, n->string, n->len);
+               strbuf_append_str(pre, " ");
+            }
+            node = n->left;
+            top = 0;
+            continue;
+         }
+      }
+      if (stack.depth == 0)
+         break;
+      frame = &stack.frames[stack.depth - 1];
+      n = &ast->nodes[frame->node];
+      if (frame->step == 0) {
+         if (paren != NULL)
+            strbuf_append(paren, n->string, n->len);
+         frame->step = 1;
+         node = n->right;
+         continue;
+      }
+      if (paren != NULL && !frame->top)
+         strbuf_append_str(paren, ")");
+      if (post != NULL) {
+         strbuf_append(post, n->string, n->len);
+         strbuf_append_str(post, " ");
+      }
+      for (f = 0; f < NUM_FORMS; ++f)
+         if (out[f] != NULL)
+            ast_printed(ast, frame->node, f, frame->start[f], out[f]);
+      --stack.depth;
+      node = -1;
+   }
+   if (stack.depth != 0)
+      for (f = 0; f < NUM_FORMS; ++f)
+         if (out[f] != NULL)
+            out[f]->failed = 1;
+   ast_stack_free(&stack);
+}
+
+int direct_forms(struct arena *arena, struct token_array *tokens,
+                 struct forms *forms) {
+   int status = 0;
+   int f;
+   STAT_START(STAT_DIRECT);
+   for (f = 0; f < NUM_FORMS && status == 0; ++f)
+      if (forms->out[f] != NULL &&
+          direct_form(arena, tokens, f, forms->out[f]) < 0)
+         status = -1;
+   STAT_STOP(STAT_DIRECT);
+   return status;
+}
+
+int direct_form(struct arena *arena, struct token_array *tokens, int form,
+                struct strbuf *out) {
+   static const int precedence[ATOM + 1] = { 0, 0, 3, 2, 2, 1, 1, 0 };
+   struct token *tok = tokens->tokens;
+   int n = tokens->num_tokens;
+   int reverse = form == FORM_PREFIX;
+   int open = reverse ? RPAREN : LPAREN;
+   int close = reverse ? LPAREN : RPAREN;
+   int operand = 1;
+   int *stack;
+   int depth = 0;
+   size_t total = 0;
+   size_t pos;
+   int type;
+   int top;
+   int i;
+   int k;
+
+   if (form == FORM_PAREN || n == 0)
+      return -1;
+   for (i = 0; i < n; ++i)
+      if (tok[i].type != LPAREN && tok[i].type != RPAREN)
+         total += tok[i].len + 1;
+   stack = (int *)arena_alloc(arena, n * sizeof(int));
+   if (stack == NULL || strbuf_reserve(out, total) != 0)
+      return -1;
+   pos = reverse ? out->len + total : out->len;
+
+   /* The end of the input counts as a closing parenthesis that pops
+      every operator left on the stack.                              */
+   for (k = 0; k <= n; ++k) {
+      i = reverse ? n - 1 - k : k;
+      type = k < n ? tok[i].type : close;
+      if (type == open || type == ATOM) {
+         if (!operand)
+            return -1;
+         if (type == open)
+            stack[depth++] = i;
+         else {
+            pos = direct_token(out, pos, tokens, i, reverse);
+            operand = 0;
+         }
+         continue;
+      }
+      if (operand)
+         return -1;
+      while (depth != 0) {
+         top = tok[stack[depth - 1]].type;
+         if (top == open ||
+             (type != close &&
+              (precedence[top] < precedence[type] ||
+               (precedence[top] == precedence[type] &&
+                (type == EXP) != reverse))))
+            break;
+         pos = direct_token(out, pos, tokens, stack[--depth], reverse);
+      }
+      if (type != close) {
+         stack[depth++] = i;
+         operand = 1;
+      } else if (k < n) {
+         if (depth == 0)
+            return -1;
+         --depth;
+      }
+   }
+   if (depth != 0)
+      return -1;
+   out->len += total;
+   out->data[out->len] = '\0';
+   return 0;
+}
+
+size_t direct_token(struct strbuf *out, size_t pos, struct token_array *tokens,
+                    int i, int reverse) {
+   struct token *tok = &tokens->tokens[i];
+   if (reverse)
+      pos -= tok->len + 1;
+   memcpy(out->data + pos, tokens->input + tok->offset, tok->len);
+   out->data[pos + tok->len] = ' ';
+   return reverse ? pos : pos + tok->len + 1;
+}
+
+int number_value(struct ast_node *n, int integer, union eval_value *value) {
+   if (!integer)
+      value->d = n->number.d;
+   else if (n->number.i < 0)
+      return -1;
+   else
+      value->i = n->number.i;
+   return 0;
+}
+
+int64_t eval_pow(int64_t base, int64_t exponent) {
+   uint64_t result = 1;
+   uint64_t b = (uint64_t)base;
+
+   /* A negative exponent gives the reciprocal of a power, which
+      truncates to zero unless the base is 1 or -1.               */
+
+   if (exponent < 0) {
+      if (base == 1 || base == -1)
+         return (exponent & 1) != 0 ? base : 1;
+      return 0;
+   }
+   while (exponent != 0) {
+      if ((exponent & 1) != 0)
+         result *= b;
+      b *= b;
+      exponent >>= 1;
+   }
+   return (int64_t)result;
+}
+
+int bc_from_expression(char *expression, int integer, int share,
+                       struct bytecode *bc, int *offset) {
+   struct arena arena;
+   struct token_array tokens;
+   struct symbol *sym;
+   struct ast ast;
+   struct ast simple;
+   int status;
+   int i;
+
+   arena_init(&arena);
+   token_array_init(&tokens);
+   tokens.intern = 1;
+   *offset = 0;
+   status = input_lexer(&tokens, expression, strlen(expression));
+   if (status < 0)
+      *offset = tokens.error_offset;
+   else if (ast_build(&arena, &tokens, &ast, share) < 0) {
+      status = ast.status;
+      *offset = ast.error_offset;
+   } else if (ast_simplify(&arena, &ast, !integer, &simple) < 0)
+      status = SP_ERR_MEMORY;
+   else
+      status = bc_compile(&simple, integer, bc);
+
+   /* The symbols are in order of first appearance, so the first number
+      too large for 64 bits among them is the first in the expression. */
+
+   if (status == BC_ERR_NUMBER)
+      for (i = 0; i < tokens.num_symbols; ++i) {
+         sym = &tokens.symbols[i];
+         if (char_class[(unsigned char)expression[sym->offset]] == CC_DIGIT &&
+             sym->number.i < 0) {
+            *offset = sym->offset;
+            break;
+         }
+      }
+   arena_free(&arena);
+   token_array_free(&tokens);
+   return status;
+}
+
+int bc_compile(struct ast *ast, int integer, struct bytecode *bc) {
+   struct ast_node *n;
+   size_t names_len = 0;
+   int *uses;
+   int *index;
+   int *vars;
+   int *work;
+   int num_work = 0;
+   int status = 0;
+   int node;
+   int op;
+   int i;
+   int j;
+
+   /* A node is compiled once and every further use of it costs one
+      instruction, an OP_TEMP, besides its OP_SAVE, so there are at
+      most four instructions per node.                               */
+
+   bc->code = (uint32_t *)malloc((4 * (size_t)ast->num_nodes + 1) *
+                                 sizeof(uint32_t));
+   bc->consts = (union eval_value *)malloc((ast->num_nodes + 1) *
+                                           sizeof(union eval_value));
+   bc->vars.names = (char **)malloc((ast->num_nodes + 1) * sizeof(char *));
+   bc->vars.lens = (int *)malloc((ast->num_nodes + 1) * sizeof(int));
+   uses = (int *)malloc((2 * (size_t)ast->num_nodes + ast->num_symbols + 1) *
+                        sizeof(int));
+   index = uses + ast->num_nodes;
+   vars = index + ast->num_nodes;
+   work = (int *)malloc((2 * (size_t)ast->num_nodes + 1) * sizeof(int));
+   bc->names = NULL;
+   bc->num_code = 0;
+   bc->num_consts = 0;
+   bc->vars.num_vars = 0;
+   bc->integer = integer;
+   if (bc->code == NULL || bc->consts == NULL || bc->vars.names == NULL ||
+       bc->vars.lens == NULL || uses == NULL || work == NULL ||
+       ast->root < 0) {
+      free(uses);
+      free(work);
+      bc_free(bc);
+      return ast->root < 0 ? SP_ERR_OPERAND : SP_ERR_MEMORY;
+   }
+
+   /* While compiling, the variable names point into the expression;
+      they are copied into the names block of the bytecode at the end.
+      index holds the constant or variable of an atom and the
+      temporary of a shared operator, once there is one, and vars the
+      variable of each symbol.                                        */
+
+   for (i = 0; i < ast->num_nodes; ++i) {
+      uses[i] = 0;
+      index[i] = -1;
+   }
+   for (i = 0; i < ast->num_symbols; ++i)
+      vars[i] = -1;
+   for (i = 0; i < ast->num_nodes; ++i)
+      if (ast->nodes[i].type != NATOM) {
+         ++uses[ast->nodes[i].left];
+         ++uses[ast->nodes[i].right];
+      }
+
+   /* The walk keeps the nodes still to be compiled on work, and an
+      operator whose operands have been compiled as -1 - node.        */
+
+   j = 0;
+   work[num_work++] = ast->root;
+   while (num_work > 0) {
+      node = work[--num_work];
+      if (node < 0) {
+         n = &ast->nodes[-1 - node];
+         op = n->type == NADD ? OP_ADD : n->type == NSUB ? OP_SUB :
+              n->type == NMUL ? OP_MUL : n->type == NDIV ? OP_DIV : OP_POW;
+         bc->code[bc->num_code++] = (uint32_t)op;
+         if (uses[-1 - node] > 1) {
+            if (j == BC_MAX_INDEX - 1) {
+               status = BC_ERR_LIMIT;
+               break;
+            }
+            index[-1 - node] = j;
+            bc->code[bc->num_code++] = (uint32_t)j++ << OP_BITS | OP_SAVE;
+         }
+         continue;
+      }
+      n = &ast->nodes[node];
+      if (n->type != NATOM) {
+         if (index[node] >= 0)
+            bc->code[bc->num_code++] = (uint32_t)index[node] << OP_BITS |
+                                       OP_TEMP;
+         else {
+            work[num_work++] = -1 - node;
+            work[num_work++] = n->right;
+            work[num_work++] = n->left;
+         }
+         continue;
+      }
+      if (char_class[(unsigned char)n->string[0]] == CC_DIGIT) {
+         if (index[node] < 0) {
+            if (bc->num_consts == BC_MAX_INDEX - 1) {
+               status = BC_ERR_LIMIT;
+               break;
+            }
+            if (number_value(n, integer, &bc->consts[bc->num_consts]) < 0) {
+               status = BC_ERR_NUMBER;
+               break;
+            }
+            index[node] = bc->num_consts++;
+         }
+         bc->code[bc->num_code++] = (uint32_t)index[node] << OP_BITS |
+                                    OP_CONST;
+         continue;
+      }
+      if (vars[n->symbol] < 0) {
+         if (bc->vars.num_vars == BC_MAX_INDEX - 1) {
+            status = BC_ERR_LIMIT;
+            break;
+         }
+         i = bc->vars.num_vars++;
+         bc->vars.names[i] = n->string;
+         bc->vars.lens[i] = n->len;
+         names_len += n->len;
+         vars[n->symbol] = i;
+      }
+      index[node] = vars[n->symbol];
+      bc->code[bc->num_code++] = (uint32_t)index[node] << OP_BITS | OP_LOAD;
+   }
+   free(uses);
+   free(work);
+   if (status != 0) {
+      bc_free(bc);
+      return status;
+   }
+
+   bc->names = (char *)malloc(names_len + 1);
+   if (bc->names == NULL) {
+      bc_free(bc);
+      return SP_ERR_MEMORY;
+   }
+   names_len = 0;
+   for (j = 0; j < bc->vars.num_vars; ++j) {
+      memcpy(bc->names + names_len, bc->vars.names[j], bc->vars.lens[j]);
+      bc->vars.names[j] = bc->names + names_len;
+      names_len += bc->vars.lens[j];
+   }
+   return bc_check(bc);
+}
+
+int bc_check(struct bytecode *bc) {
+   int depth = 0;
+   int i;
+   bc->max_depth = 0;
+   bc->num_temps = 0;
+   if (bc->num_consts >= BC_MAX_INDEX || bc->vars.num_vars >= BC_MAX_INDEX)
+      return -1;
+   for (i = 0; i < bc->num_code; ++i) {
+      switch (bc->code[i] & ((1 << OP_BITS) - 1)) {
+      case OP_CONST:
+         if ((bc->code[i] >> OP_BITS) >= (uint32_t)bc->num_consts)
+            return -1;
+         ++depth;
+         break;
+      case OP_LOAD:
+         if ((bc->code[i] >> OP_BITS) >= (uint32_t)bc->vars.num_vars)
+            return -1;
+         ++depth;
+         break;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+      case OP_POW:
+         if (depth < 2 || (bc->code[i] >> OP_BITS) != 0)
+            return -1;
+         --depth;
+         break;
+      case OP_SAVE:
+         if (depth < 1 ||
+             (bc->code[i] >> OP_BITS) != (uint32_t)bc->num_temps)
+            return -1;
+         ++bc->num_temps;
+         break;
+      case OP_TEMP:
+         if ((bc->code[i] >> OP_BITS) >= (uint32_t)bc->num_temps)
+            return -1;
+         ++depth;
+         break;
+      default:
+         return -1;
+      }
+      if (depth > bc->max_depth)
+         bc->max_depth = depth;
+   }
+   return depth == 1 ? 0 : -1;
+}
+
+int bc_bind(struct bytecode *bc, struct bindings *vars, int *columns) {
+   int i;
+   int j;
+   for (i = 0; i < bc->vars.num_vars; ++i) {
+      for (j = 0; j < vars->num_vars; ++j)
+         if (vars->lens[j] == bc->vars.lens[i] &&
+             memcmp(vars->names[j], bc->vars.names[i], vars->lens[j]) == 0)
+            break;
+      if (j == vars->num_vars)
+         return -1 - i;
+      columns[i] = j;
+   }
+   return 0;
+}
+
+double bc_run_double(struct bytecode *bc, const union eval_value *vars,
+                     union eval_value *stack) {
+   uint32_t *pc = bc->code;
+   uint32_t *end = bc->code + bc->num_code;
+   union eval_value *sp = stack - 1;
+   for (; pc < end; ++pc) {
+      switch (*pc & ((1 << OP_BITS) - 1)) {
+      case OP_CONST:
+         *++sp = bc->consts[*pc >> OP_BITS];
+         break;
+      case OP_LOAD:
+         *++sp = vars[*pc >> OP_BITS];
+         break;
+      case OP_ADD:
+         --sp;
+         sp[0].d += sp[1].d;
+         break;
+      case OP_SUB:
+         --sp;
+         sp[0].d -= sp[1].d;
+         break;
+      case OP_MUL:
+         --sp;
+         sp[0].d *= sp[1].d;
+         break;
+      case OP_DIV:
+         --sp;
+         sp[0].d /= sp[1].d;
+         break;
+      case OP_POW:
+         --sp;
+         sp[0].d = pow(sp[0].d, sp[1].d);
+         break;
+      case OP_SAVE:
+         stack[bc->max_depth + (*pc >> OP_BITS)] = *sp;
+         break;
+      case OP_TEMP:
+         *++sp = stack[bc->max_depth + (*pc >> OP_BITS)];
+         break;
+      }
+   }
+   return stack[0].d;
+}
+
+int bc_run_int(struct bytecode *bc, const union eval_value *vars,
+               union eval_value *stack, int64_t *result) {
+   uint32_t *pc = bc->code;
+   uint32_t *end = bc->code + bc->num_code;
+   union eval_value *sp = stack - 1;
+   int64_t right;
+   for (; pc < end; ++pc) {
+      switch (*pc & ((1 << OP_BITS) - 1)) {
+      case OP_CONST:
+         *++sp = bc->consts[*pc >> OP_BITS];
+         continue;
+      case OP_LOAD:
+         *++sp = vars[*pc >> OP_BITS];
+         continue;
+      case OP_SAVE:
+         stack[bc->max_depth + (*pc >> OP_BITS)] = *sp;
+         continue;
+      case OP_TEMP:
+         *++sp = stack[bc->max_depth + (*pc >> OP_BITS)];
+         continue;
+      }
+      right = sp[0].i;
+      --sp;
+      switch (*pc & ((1 << OP_BITS) - 1)) {
+      case OP_ADD:
+         sp[0].i = (int64_t)((uint64_t)sp[0].i + (uint64_t)right);
+         break;
+      case OP_SUB:
+         sp[0].i = (int64_t)((uint64_t)sp[0].i - (uint64_t)right);
+         break;
+      case OP_MUL:
+         sp[0].i = (int64_t)((uint64_t)sp[0].i * (uint64_t)right);
+         break;
+      case OP_DIV:
+         if (right == 0)
+            return -1;
+         sp[0].i = right == -1 ? (int64_t)(0 - (uint64_t)sp[0].i) :
+                                 sp[0].i / right;
+         break;
+      case OP_POW:
+         if (right < 0 && sp[0].i == 0)
+            return -1;
+         sp[0].i = eval_pow(sp[0].i, right);
+         break;
+      }
+   }
+   *result = stack[0].i;
+   return 0;
+}
+
+void bc_free(struct bytecode *bc) {
+   free(bc->code);
+   free(bc->consts);
+   free(bc->vars.names);
+   free(bc->vars.lens);
+   free(bc->names);
+   bc->code = NULL;
+   bc->consts = NULL;
+   bc->vars.names = NULL;
+   bc->vars.lens = NULL;
+   bc->names = NULL;
+}
+
+int bc_write(struct bytecode *bc, FILE *out) {
+   uint64_t bits;
+   int i;
+   if (fwrite(BC_MAGIC, 1, 4, out) != 4 ||
+       write_u32(out, BC_VERSION) < 0 ||
+       write_u32(out, (uint32_t)bc->integer) < 0 ||
+       write_u32(out, (uint32_t)bc->vars.num_vars) < 0 ||
+       write_u32(out, (uint32_t)bc->num_consts) < 0 ||
+       write_u32(out, (uint32_t)bc->num_code) < 0)
+      return -1;
+   for (i = 0; i < bc->vars.num_vars; ++i)
+      if (write_u32(out, (uint32_t)bc->vars.lens[i]) < 0 ||
+          fwrite(bc->vars.names[i], 1, bc->vars.lens[i], out) !=
+          (size_t)bc->vars.lens[i])
+         return -1;
+   for (i = 0; i < bc->num_consts; ++i) {
+      memcpy(&bits, &bc->consts[i], sizeof(bits));
+      if (write_u64(out, bits) < 0)
+         return -1;
+   }
+   for (i = 0; i < bc->num_code; ++i)
+      if (write_u32(out, bc->code[i]) < 0)
+         return -1;
+   return 0;
+}
+
+int bc_read(struct bytecode *bc, FILE *in) {
+   char magic[4];
+   char *names;
+   uint32_t version;
+   uint32_t integer;
+   uint32_t num_vars;
+   uint32_t num_consts;
+   uint32_t num_code;
+   uint32_t len;
+   uint64_t bits;
+   size_t names_len = 0;
+   int i;
+
+   bc->code = NULL;
+   bc->consts = NULL;
+   bc->vars.names = NULL;
+   bc->vars.lens = NULL;
+   bc->names = NULL;
+   if (fread(magic, 1, 4, in) != 4 || memcmp(magic, BC_MAGIC, 4) != 0 ||
+       read_u32(in, &version) < 0 || version != BC_VERSION ||
+       read_u32(in, &integer) < 0 || integer > 1 ||
+       read_u32(in, &num_vars) < 0 || read_u32(in, &num_consts) < 0 ||
+       read_u32(in, &num_code) < 0 || num_vars > INT_MAX / 16 ||
+       num_consts > INT_MAX / 16 || num_code > INT_MAX / 16)
+      return -1;
+   bc->integer = (int)integer;
+   bc->vars.num_vars = (int)num_vars;
+   bc->num_consts = (int)num_consts;
+   bc->num_code = (int)num_code;
+
+   /* The names are read one after another into a block that grows as
+      needed, and the pointers to them are set once the block is done. */
+
+   bc->vars.names = (char **)malloc((num_vars + 1) * sizeof(char *));
+   bc->vars.lens = (int *)malloc((num_vars + 1) * sizeof(int));
+   if (bc->vars.names == NULL || bc->vars.lens == NULL)
+      goto fail;
+   for (i = 0; i < (int)num_vars; ++i) {
+      if (read_u32(in, &len) < 0 || len > INT_MAX / 2)
+         goto fail;
+      names = (char *)realloc(bc->names, names_len + len + 1);
+      if (names == NULL)
+         goto fail;
+      bc->names = names;
+      if (fread(bc->names + names_len, 1, len, in) != len)
+         goto fail;
+      bc->vars.lens[i] = (int)len;
+      names_len += len;
+   }
+   for (i = 0, names_len = 0; i < (int)num_vars; ++i) {
+      bc->vars.names[i] = bc->names + names_len;
+      names_len += bc->vars.lens[i];
+   }
+   bc->consts = (union eval_value *)malloc((num_consts + 1) *
+                                           sizeof(union eval_value));
+   bc->code = (uint32_t *)malloc((num_code + 1) * sizeof(uint32_t));
+   if (bc->consts == NULL || bc->code == NULL)
+      goto fail;
+   for (i = 0; i < (int)num_consts; ++i) {
+      if (read_u64(in, &bits) < 0)
+         goto fail;
+      memcpy(&bc->consts[i], &bits, sizeof(bits));
+   }
+   for (i = 0; i < (int)num_code; ++i)
+      if (read_u32(in, &bc->code[i]) < 0)
+         goto fail;
+   if (bc_check(bc) == 0)
+      return 0;
+
+fail:
+   bc_free(bc);
+   return -1;
+}
+
+int write_u32(FILE *out, uint32_t n) {
+   unsigned char bytes[4];
+   int i;
+   for (i = 0; i < 4; ++i)
+      bytes[i] = (unsigned char)(n >> 8 * i);
+   return fwrite(bytes, 1, 4, out) == 4 ? 0 : -1;
+}
+
+int write_u64(FILE *out, uint64_t n) {
+   if (write_u32(out, (uint32_t)n) < 0)
+      return -1;
+   return write_u32(out, (uint32_t)(n >> 32));
+}
+
+int read_u32(FILE *in, uint32_t *n) {
+   unsigned char bytes[4];
+   int i;
+   if (fread(bytes, 1, 4, in) != 4)
+      return -1;
+   *n = 0;
+   for (i = 0; i < 4; ++i)
+      *n |= (uint32_t)bytes[i] << 8 * i;
+   return 0;
+}
+
+int read_u64(FILE *in, uint64_t *n) {
+   uint32_t low;
+   uint32_t high;
+   if (read_u32(in, &low) < 0 || read_u32(in, &high) < 0)
+      return -1;
+   *n = (uint64_t)high << 32 | low;
+   return 0;
+}
+
+int bc_run_columns(struct bytecode *bc, double **columns, size_t num_rows,
+                   double *out) {
+   double **operands;
+   double *scratch;
+   double *block;
+   size_t start;
+   size_t n;
+   size_t k;
+   int depth;
+   int op;
+   int i;
+
+   operands = (double **)malloc((bc->max_depth + 1) * sizeof(double *));
+   scratch = (double *)malloc(((size_t)bc->max_depth + bc->num_temps + 1) *
+                              COLUMN_BLOCK * sizeof(double));
+   if (operands == NULL || scratch == NULL) {
+      free(operands);
+      free(scratch);
+      return -1;
+   }
+
+   /* The block that the instruction leaving the stack at depth d
+      writes to is always block d - 1 of the scratch memory, so an
+      operation on the top two operands may overwrite its left one.
+      Temporary k is block max_depth + k.                             */
+
+   for (start = 0; start < num_rows; start += n) {
+      n = num_rows - start < COLUMN_BLOCK ? num_rows - start : COLUMN_BLOCK;
+      depth = 0;
+      for (i = 0; i < bc->num_code; ++i) {
+         op = bc->code[i] & ((1 << OP_BITS) - 1);
+         if (op == OP_LOAD) {
+            operands[depth++] = columns[bc->code[i] >> OP_BITS] + start;
+            continue;
+         }
+         block = scratch + ((size_t)bc->max_depth + (bc->code[i] >> OP_BITS)) *
+                           COLUMN_BLOCK;
+         if (op == OP_SAVE) {
+            memcpy(block, operands[depth - 1], n * sizeof(double));
+            continue;
+         }
+         if (op == OP_TEMP) {
+            operands[depth++] = block;
+            continue;
+         }
+         if (op == OP_CONST) {
+            block = scratch + (size_t)depth * COLUMN_BLOCK;
+            for (k = 0; k < n; ++k)
+               block[k] = bc->consts[bc->code[i] >> OP_BITS].d;
+            operands[depth++] = block;
+            continue;
+         }
+         --depth;
+         block = scratch + (size_t)(depth - 1) * COLUMN_BLOCK;
+         column_kernel(op, block, operands[depth - 1], operands[depth], n);
+         operands[depth - 1] = block;
+      }
+      memcpy(out + start, operands[0], n * sizeof(double));
+   }
+   free(operands);
+   free(scratch);
+   return 0;
+}
+
+void column_kernel(int op, double *dst, double *a, double *b, size_t n) {
+   size_t k = 0;
+
+   /* COLUMN_VECTOR runs the loop over as many elements as fit the
+      widest vector unit available, COLUMN_SCALAR does the rest.     */
+
+#if defined(__AVX__)
+#define COLUMN_VECTOR(vop)                                   \
+   for (; k + 4 <= n; k += 4)                                \
+      _mm256_storeu_pd(dst + k, vop(_mm256_loadu_pd(a + k),  \
+                                    _mm256_loadu_pd(b + k)))
+#define VADD _mm256_add_pd
+#define VSUB _mm256_sub_pd
+#define VMUL _mm256_mul_pd
+#define VDIV _mm256_div_pd
+#elif defined(__SSE2__)
+#define COLUMN_VECTOR(vop)                                   \
+   for (; k + 2 <= n; k += 2)                                \
+      _mm_storeu_pd(dst + k, vop(_mm_loadu_pd(a + k),        \
+                                 _mm_loadu_pd(b + k)))
+#define VADD _mm_add_pd
+#define VSUB _mm_sub_pd
+#define VMUL _mm_mul_pd
+#define VDIV _mm_div_pd
+#else
+#define COLUMN_VECTOR(vop)
+#endif
+#define COLUMN_SCALAR(expr) \
+   for (; k < n; ++k)       \
+      dst[k] = expr
+
+   switch (op) {
+   case OP_ADD:
+      COLUMN_VECTOR(VADD);
+      COLUMN_SCALAR(a[k] + b[k]);
+      break;
+   case OP_SUB:
+      COLUMN_VECTOR(VSUB);
+      COLUMN_SCALAR(a[k] - b[k]);
+      break;
+   case OP_MUL:
+      COLUMN_VECTOR(VMUL);
+      COLUMN_SCALAR(a[k] * b[k]);
+      break;
+   case OP_DIV:
+      COLUMN_VECTOR(VDIV);
+      COLUMN_SCALAR(a[k] / b[k]);
+      break;
+   case OP_POW:
+      COLUMN_SCALAR(pow(a[k], b[k]));
+      break;
+   }
+
+#undef COLUMN_VECTOR
+#undef COLUMN_SCALAR
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+}
+
+#ifndef SIMPLE_PARSE_NO_MAIN
+
+int evaluate(struct bytecode *bc, struct jit_code *jit, FILE *in) {
+   struct bindings vars;
+   struct strbuf header;
+   struct strbuf line;
+   union eval_value *row = NULL;
+   union eval_value *values = NULL;
+   union eval_value *stack = NULL;
+   double **columns = NULL;
+   double *results = NULL;
+   int *map = NULL;
+   char *valid = NULL;
+   int64_t result;
+   size_t num_rows = 0;
+   size_t k;
+   char *p;
+   int got;
+   int status = 1;
+   int j;
+
+   setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+   strbuf_init(&header);
+   strbuf_init(&line);
+   vars.names = NULL;
+   vars.lens = NULL;
+   if (read_line(in, &header) <= 0) {
+      printf("Error receiving the names of the variables!\n");
+      goto done;
+   }
+
+   /* Split the header into variable names, which stay in the header
+      strbuf; there are at most half as many names as characters.      */
+
+   vars.names = (char **)malloc((header.len / 2 + 1) * sizeof(char *));
+   vars.lens = (int *)malloc((header.len / 2 + 1) * sizeof(int));
+   row = (union eval_value *)malloc((header.len / 2 + 1) *
+                                    sizeof(union eval_value));
+   values = (union eval_value *)malloc(((size_t)bc->vars.num_vars + 1) *
+                                       EVAL_BLOCK * sizeof(union eval_value));
+   stack = (union eval_value *)malloc(((size_t)bc->max_depth +
+                                       bc->num_temps + 1) *
+                                      sizeof(union eval_value));
+   columns = (double **)malloc((bc->vars.num_vars + 1) * sizeof(double *));
+   results = (double *)malloc(((size_t)bc->vars.num_vars + 1) * EVAL_BLOCK *
+                              sizeof(double));
+   map = (int *)malloc((bc->vars.num_vars + 1) * sizeof(int));
+   valid = (char *)malloc(EVAL_BLOCK);
+   if (vars.names == NULL || vars.lens == NULL || row == NULL ||
+       values == NULL || stack == NULL || columns == NULL ||
+       results == NULL || map == NULL || valid == NULL) {
+      printf("Failed to allocate memory for evaluation!\n");
+      goto done;
+   }
+   vars.num_vars = 0;
+   for (p = header.data; *p != '\0'; ) {
+      while (*p == ' ' || *p == '\t')
+         ++p;
+      if (*p == '\0')
+         break;
+      vars.names[vars.num_vars] = p;
+      while (*p != '\0' && *p != ' ' && *p != '\t')
+         ++p;
+      vars.lens[vars.num_vars] = (int)(p - vars.names[vars.num_vars]);
+      ++vars.num_vars;
+   }
+   if ((j = bc_bind(bc, &vars, map)) < 0) {
+      printf("Variable %.*s is not bound!\n", bc->vars.lens[-1 - j],
+             bc->vars.names[-1 - j]);
+      goto done;
+   }
+
+   /* The columns of the block live behind the results in the same
+      allocation; rows run one at a time are kept whole, row after
+      row, in values.                                                */
+
+   for (j = 0; j < bc->vars.num_vars; ++j)
+      columns[j] = results + (size_t)(j + 1) * EVAL_BLOCK;
+   do {
+      got = read_line(in, &line);
+      if (got > 0) {
+         valid[num_rows] = parse_row(line.data, bc->integer, row,
+                                     vars.num_vars) == 0;
+         for (j = 0; j < bc->vars.num_vars; ++j)
+            if (bc->integer || jit != NULL)
+               values[num_rows * bc->vars.num_vars + j] = row[map[j]];
+            else
+               columns[j][num_rows] = valid[num_rows] ? row[map[j]].d : 0;
+         ++num_rows;
+      }
+      if (num_rows == 0 || (got > 0 && num_rows < EVAL_BLOCK))
+         continue;
+      if (!bc->integer && jit == NULL &&
+          bc_run_columns(bc, columns, num_rows, results) < 0) {
+         printf("Failed to allocate memory for evaluation!\n");
+         break;
+      }
+      for (k = 0; k < num_rows; ++k)
+         if (!valid[k])
+            printf("error\n");
+         else if (jit != NULL)
+            printf("%.17g\n", jit->run(values + k * bc->vars.num_vars));
+         else if (!bc->integer)
+            printf("%.17g\n", results[k]);
+         else if (bc_run_int(bc, values + k * bc->vars.num_vars, stack,
+                             &result) < 0)
+            printf("error\n");
+         else
+            printf("%" PRId64 "\n", result);
+      num_rows = 0;
+      STAT_POLL();
+   } while (got > 0);
+   if (got < 0)
+      printf("Error receiving input!\n");
+   else if (num_rows == 0)
+      status = 0;
+
+done:
+   strbuf_free(&header);
+   strbuf_free(&line);
+   free(vars.names);
+   free(vars.lens);
+   free(row);
+   free(values);
+   free(stack);
+   free(columns);
+   free(results);
+   free(map);
+   free(valid);
+   if (fflush(stdout) != 0)
+      status = 1;
+   return status;
+}
+
+int parse_row(char *line, int integer, union eval_value *row, int num_vars) {
+   char *end;
+   int j;
+   for (j = 0; j < num_vars; ++j) {
+      if (integer)
+         row[j].i = strtoll(line, &end, 10);
+      else
+         row[j].d = strtod(line, &end);
+      if (end == line)
+         return -1;
+      line = end;
+   }
+   while (*line == ' ' || *line == '\t')
+      ++line;
+   return *line == '\0' ? 0 : -1;
+}
+
+#endif
+
+#ifdef USE_JIT
+
+int jit_compile(struct bytecode *bc, struct jit_code *jit) {
+   struct strbuf code;
+   double (*pow_function)(double, double) = pow;
+   unsigned char bytes[10];
+   size_t *fixups;
+   size_t num_fixups = 0;
+   size_t consts_start;
+   int32_t disp;
+   int32_t frame;
+   int depth = 0;
+   int op;
+   int i;
+   int j;
+
+   jit->run = NULL;
+   jit->mem = NULL;
+   jit->size = 0;
+   if (bc->integer || bc->max_depth > JIT_REGISTERS)
+      return 1;
+
+   /* No instruction takes more than JIT_MAX_INSTRUCTION bytes, so
+      with the room reserved here none of the appends below fails.   */
+
+   strbuf_init(&code);
+   fixups = (size_t *)malloc((bc->num_code + 1) * sizeof(size_t));
+   if (fixups == NULL ||
+       strbuf_reserve(&code, (size_t)bc->num_code * JIT_MAX_INSTRUCTION +
+                             (size_t)bc->num_consts * 8 + 64) < 0) {
+      free(fixups);
+      strbuf_free(&code);
+      return JIT_ERR_MEMORY;
+   }
+
+   /* push rbx; mov rbx, rdi; sub rsp, frame. The frame keeps the
+      stack aligned to 16 bytes for calls and has room to save every
+      register level around them, followed by the temporaries.      */
+
+   frame = (int32_t)(JIT_FRAME + (8 * (size_t)bc->num_temps + 15) / 16 * 16);
+   strbuf_append(&code, "\x53\x48\x89\xfb\x48\x81\xec", 7);
+   strbuf_append(&code, (char *)&frame, 4);
+
+   for (i = 0; i < bc->num_code; ++i) {
+      op = bc->code[i] & ((1 << OP_BITS) - 1);
+      switch (op) {
+      case OP_CONST:
+         fixups[num_fixups++] =
+            jit_emit_sse_mem(&code, 0xf2, 0x10, depth + 2, JIT_RIP,
+                             (int32_t)(bc->code[i] >> OP_BITS));
+         ++depth;
+         break;
+      case OP_LOAD:
+         jit_emit_sse_mem(&code, 0xf2, 0x10, depth + 2, JIT_RBX,
+                          (int32_t)(8 * (bc->code[i] >> OP_BITS)));
+         ++depth;
+         break;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+         jit_emit_sse(&code, 0xf2, op == OP_ADD ? 0x58 : op == OP_SUB ? 0x5c :
+                                   op == OP_MUL ? 0x59 : 0x5e,
+                      depth, depth + 1);
+         --depth;
+         break;
+      case OP_POW:
+         for (j = 0; j < depth - 2; ++j)
+            jit_emit_sse_mem(&code, 0xf2, 0x11, j + 2, JIT_RSP, 8 * j);
+         jit_emit_sse(&code, 0x66, 0x28, 0, depth);
+         jit_emit_sse(&code, 0x66, 0x28, 1, depth + 1);
+         bytes[0] = 0x48;
+         bytes[1] = 0xb8;
+         memcpy(bytes + 2, &pow_function, 8);
+         strbuf_append(&code, (char *)bytes, 10);
+         strbuf_append(&code, "\xff\xd0", 2);
+         jit_emit_sse(&code, 0x66, 0x28, depth, 0);
+         for (j = 0; j < depth - 2; ++j)
+            jit_emit_sse_mem(&code, 0xf2, 0x10, j + 2, JIT_RSP, 8 * j);
+         --depth;
+         break;
+      case OP_SAVE:
+         jit_emit_sse_mem(&code, 0xf2, 0x11, depth + 1, JIT_RSP,
+                          (int32_t)(JIT_FRAME + 8 * (bc->code[i] >> OP_BITS)));
+         break;
+      case OP_TEMP:
+         jit_emit_sse_mem(&code, 0xf2, 0x10, depth + 2, JIT_RSP,
+                          (int32_t)(JIT_FRAME + 8 * (bc->code[i] >> OP_BITS)));
+         ++depth;
+         break;
+      }
+   }
+
+   /* movapd xmm0, xmm2; add rsp, frame; pop rbx; ret; then the
+      constants, aligned to 8 bytes and reached relative to rip. */
+
+   jit_emit_sse(&code, 0x66, 0x28, 0, 2);
+   strbuf_append(&code, "\x48\x81\xc4", 3);
+   strbuf_append(&code, (char *)&frame, 4);
+   strbuf_append(&code, "\x5b\xc3", 2);
+   while (code.len % 8 != 0)
+      strbuf_append(&code, "\xcc", 1);
+   consts_start = code.len;
+   strbuf_append(&code, (char *)bc->consts, (size_t)bc->num_consts * 8);
+   for (i = 0; i < (int)num_fixups; ++i) {
+      memcpy(&disp, code.data + fixups[i], 4);
+      disp = (int32_t)(consts_start + 8 * (size_t)disp - (fixups[i] + 4));
+      memcpy(code.data + fixups[i], &disp, 4);
+   }
+   free(fixups);
+
+   jit->size = code.len;
+   jit->mem = mmap(NULL, jit->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (jit->mem == MAP_FAILED) {
+      jit->mem = NULL;
+      strbuf_free(&code);
+      return JIT_ERR_MEMORY;
+   }
+   memcpy(jit->mem, code.data, code.len);
+   strbuf_free(&code);
+   if (mprotect(jit->mem, jit->size, PROT_READ | PROT_EXEC) != 0) {
+      jit_free(jit);
+      return JIT_ERR_PROTECT;
+   }
+   *(void **)&jit->run = jit->mem;
+   return 0;
+}
+
+void jit_emit_sse(struct strbuf *code, int prefix, int opcode, int reg,
+                  int rm) {
+   unsigned char bytes[5];
+   int n = 0;
+   bytes[n++] = (unsigned char)prefix;
+   if (reg >= 8 || rm >= 8)
+      bytes[n++] = (unsigned char)(0x40 | (reg >= 8) << 2 | (rm >= 8));
+   bytes[n++] = 0x0f;
+   bytes[n++] = (unsigned char)opcode;
+   bytes[n++] = (unsigned char)(0xc0 | (reg & 7) << 3 | (rm & 7));
+   strbuf_append(code, (char *)bytes, n);
+}
+
+size_t jit_emit_sse_mem(struct strbuf *code, int prefix, int opcode, int reg,
+                        int base, int32_t disp) {
+   unsigned char bytes[10];
+   int n = 0;
+   bytes[n++] = (unsigned char)prefix;
+   if (reg >= 8 || base >= 8)
+      bytes[n++] = (unsigned char)(0x40 | (reg >= 8) << 2 | (base >= 8));
+   bytes[n++] = 0x0f;
+   bytes[n++] = (unsigned char)opcode;
+   if (base == JIT_RIP)
+      bytes[n++] = (unsigned char)(0x05 | (reg & 7) << 3);
+   else {
+      bytes[n++] = (unsigned char)(0x80 | (reg & 7) << 3 | (base & 7));
+      if ((base & 7) == JIT_RSP)
+         bytes[n++] = 0x24;
+   }
+   memcpy(bytes + n, &disp, 4);
+   strbuf_append(code, (char *)bytes, n + 4);
+   return code->len - 4;
+}
+
+void jit_free(struct jit_code *jit) {
+   if (jit->mem != NULL)
+      munmap(jit->mem, jit->size);
+   jit->mem = NULL;
+   jit->run = NULL;
+}
+
+#endif
+
+int expr_cache_init(struct expr_cache *cache, int capacity) {
+   int i;
+   cache->capacity = capacity;
+   cache->num_entries = 0;
+   cache->newest = -1;
+   cache->oldest = -1;
+   cache->hits = 0;
+   cache->misses = 0;
+   for (cache->num_buckets = 1; cache->num_buckets < 2 * capacity; )
+      cache->num_buckets *= 2;
+   cache->entries = (struct expr_entry *)malloc(capacity *
+                                                sizeof(struct expr_entry));
+   cache->buckets = (int *)malloc(cache->num_buckets * sizeof(int));
+   if (cache->entries == NULL || cache->buckets == NULL) {
+      free(cache->entries);
+      free(cache->buckets);
+      cache->entries = NULL;
+      cache->buckets = NULL;
+      cache->capacity = 0;
+      return -1;
+   }
+   for (i = 0; i < cache->num_buckets; ++i)
+      cache->buckets[i] = -1;
+   return 0;
+}
+
+struct expr_entry *expr_cache_find(struct expr_cache *cache, char *text,
+                                   size_t len) {
+   struct expr_entry *entry;
+   uint64_t hash = text_hash(text, len);
+   int i;
+   for (i = cache->buckets[hash & (cache->num_buckets - 1)]; i >= 0;
+        i = entry->chain) {
+      entry = &cache->entries[i];
+      if (entry->hash == hash && entry->text.len == len &&
+          memcmp(entry->text.data, text, len) == 0) {
+         ++cache->hits;
+         expr_cache_unlink(cache, i);
+         entry->older = cache->newest;
+         if (cache->newest >= 0)
+            cache->entries[cache->newest].newer = i;
+         else
+            cache->oldest = i;
+         cache->newest = i;
+         return entry;
+      }
+   }
+   ++cache->misses;
+   return NULL;
+}
+
+struct expr_entry *expr_cache_add(struct expr_cache *cache, char *text,
+                                  size_t len, char *forms, size_t forms_len) {
+   struct expr_entry *entry;
+   int *link;
+   int i;
+
+   if (cache->capacity == 0 || len == 0)
+      return NULL;
+   if (cache->num_entries < cache->capacity) {
+      i = cache->num_entries++;
+      entry = &cache->entries[i];
+      strbuf_init(&entry->text);
+      strbuf_init(&entry->forms);
+   } else {
+
+      /* Reuse the oldest entry, and its memory, for the new line. */
+
+      i = cache->oldest;
+      entry = &cache->entries[i];
+      for (link = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+           *link != i; link = &cache->entries[*link].chain)
+         ;
+      *link = entry->chain;
+      expr_cache_unlink(cache, i);
+   }
+
+   strbuf_reset(&entry->text);
+   strbuf_append(&entry->text, text, len);
+   strbuf_reset(&entry->forms);
+   strbuf_append(&entry->forms, forms, forms_len);
+   if (entry->text.len != len || entry->forms.len != forms_len) {
+
+      /* Out of memory: keep the slot as the entry for an empty line,
+         which is never looked up, so that it is evicted in turn.     */
+
+      strbuf_reset(&entry->text);
+      strbuf_reset(&entry->forms);
+      len = 0;
+   }
+
+   i = (int)(entry - cache->entries);
+   entry->hash = text_hash(entry->text.data, len);
+   entry->chain = cache->buckets[entry->hash & (cache->num_buckets - 1)];
+   cache->buckets[entry->hash & (cache->num_buckets - 1)] = i;
+   entry->newer = -1;
+   entry->older = cache->newest;
+   if (cache->newest >= 0)
+      cache->entries[cache->newest].newer = i;
+   else
+      cache->oldest = i;
+   cache->newest = i;
+   return len == 0 ? NULL : entry;
+}
+
+void expr_cache_unlink(struct expr_cache *cache, int i) {
+   struct expr_entry *entry = &cache->entries[i];
+   if (entry->newer >= 0)
+      cache->entries[entry->newer].older = entry->older;
+   else
+      cache->newest = entry->older;
+   if (entry->older >= 0)
+      cache->entries[entry->older].newer = entry->newer;
+   else
+      cache->oldest = entry->newer;
+   entry->newer = -1;
+   entry->older = -1;
+}
+
+#ifndef SIMPLE_PARSE_NO_MAIN
+
+void expr_cache_report(long hits, long misses) {
+   fprintf(stderr, "Expression cache: %ld hits, %ld misses\n", hits, misses);
+}
+
+#endif
+
+void expr_cache_free(struct expr_cache *cache) {
+   int i;
+   for (i = 0; i < cache->num_entries; ++i) {
+      strbuf_free(&cache->entries[i].text);
+      strbuf_free(&cache->entries[i].forms);
+   }
+   free(cache->entries);
+   free(cache->buckets);
+   cache->entries = NULL;
+   cache->buckets = NULL;
+   cache->capacity = 0;
+   cache->num_entries = 0;
+}
+
+uint64_t text_hash(const char *text, size_t len) {
+   uint64_t hash = UINT64_C(14695981039346656037);
+   size_t i;
+   for (i = 0; i < len; ++i) {
+      hash ^= (unsigned char)text[i];
+      hash *= UINT64_C(1099511628211);
+   }
+   return hash;
+}
+
+#ifdef DEBUG_STATS
+
+STATS_THREAD_LOCAL struct debug_stats debug_stats;
+volatile sig_atomic_t stats_requested;
+struct debug_stats stats_total;
+struct debug_stats *stats_threads;
+#ifdef USE_THREADS
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void stats_init(void) {
+   struct sigaction action;
+   stats_register();
+   atexit(stats_dump);
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = stats_signal;
+   sigemptyset(&action.sa_mask);
+#ifdef SA_RESTART
+   action.sa_flags = SA_RESTART;
+#endif
+   sigaction(SIGUSR1, &action, NULL);
+}
+
+void stats_register(void) {
+#ifdef USE_THREADS
+   pthread_mutex_lock(&stats_lock);
+#endif
+   debug_stats.next = stats_threads;
+   stats_threads = &debug_stats;
+#ifdef USE_THREADS
+   pthread_mutex_unlock(&stats_lock);
+#endif
+}
+
+void stats_unregister(void) {
+   struct debug_stats **link;
+#ifdef USE_THREADS
+   pthread_mutex_lock(&stats_lock);
+#endif
+   for (link = &stats_threads; *link != NULL; link = &(*link)->next)
+      if (*link == &debug_stats) {
+         *link = debug_stats.next;
+         stats_add(&stats_total, &debug_stats);
+         break;
+      }
+#ifdef USE_THREADS
+   pthread_mutex_unlock(&stats_lock);
+#endif
+}
+
+void stats_add(struct debug_stats *sum, const struct debug_stats *part) {
+   int s;
+   sum->tokens += part->tokens;
+   sum->nodes += part->nodes;
+   sum->arena_bytes += part->arena_bytes;
+   sum->strbuf_bytes += part->strbuf_bytes;
+   sum->lookahead += part->lookahead;
+   for (s = 0; s < NUM_STAT_STAGES; ++s)
+      sum->stage_ns[s] += part->stage_ns[s];
+}
+
+void stats_dump(void) {
+   static const char *stages[NUM_STAT_STAGES] = {
+      "lex", "parse", "compact", "print", "direct"
+   };
+   struct debug_stats sum;
+   struct debug_stats *thread;
+   int s;
+#ifdef USE_THREADS
+   pthread_mutex_lock(&stats_lock);
+#endif
+   sum = stats_total;
+   for (thread = stats_threads; thread != NULL; thread = thread->next)
+      stats_add(&sum, thread);
+#ifdef USE_THREADS
+   pthread_mutex_unlock(&stats_lock);
+#endif
+   fprintf(stderr, "{\"tokens\": %" PRId64 ", \"nodes\": %" PRId64
+           ", \"arena_bytes\": %" PRId64 ", \"strbuf_bytes\": %" PRId64
+           ", \"exprpp_lookahead\": %" PRId64 ", \"stage_ns\": {",
+           sum.tokens, sum.nodes, sum.arena_bytes, sum.strbuf_bytes,
+           sum.lookahead);
+   for (s = 0; s < NUM_STAT_STAGES; ++s)
+      fprintf(stderr, "%s\"%s\": %" PRId64, s == 0 ? "" : ", ", stages[s],
+              sum.stage_ns[s]);
+   fprintf(stderr, "}}\n");
+}
+
+void stats_poll(void) {
+   stats_requested = 0;
+   stats_dump();
+}
+
+void stats_signal(int sig) {
+   (void)sig;
+   stats_requested = 1;
+}
+
+int64_t stats_now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
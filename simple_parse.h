@@ -0,0 +1,154 @@
+/*****************************************************************************/
+/*                      Simple Expression Parser Library                     */
+/*                                                                           */
+/* The lexer, parsers and printers of simple_parse.c can be used from other  */
+/* programs through the functions declared below. Compiling simple_parse.c   */
+/* with the macro SIMPLE_PARSE_NO_MAIN defined leaves out main, and make     */
+/* lib builds the result into the static library libsimple_parse.a and the   */
+/* shared library libsimple_parse.so; both export only the names declared    */
+/* here, all of which start with sp_.                                        */
+/*                                                                           */
+/* A struct sp_parser holds everything needed to work on one expression      */
+/* after another: the arena for trees, the growing token array and the       */
+/* buffers of the forms. Its members are private. sp_parser_new allocates a  */
+/* parser, and returns NULL if memory runs out. Its argument options is a    */
+/* combination of SP_COMPACT, SP_SHARE and SP_SIMPLIFY, which do what the    */
+/* options -a, -d and -s of the program do, and of SP_THREADS(n), which lets */
+/* sp_parse split an expression of many tokens over n threads, as -j n does  */
+/* in interactive mode; the forms come out just as from one thread. Only     */
+/* parsers without SP_COMPACT split anything, and n is ignored where the     */
+/* library was built without threads. Its argument forms is the set of forms */
+/* to be rendered, with bit 1 << f standing for form f, SP_FORM_PAREN        */
+/* through SP_FORM_PREFIX. sp_parser_free releases a parser with everything  */
+/* it holds.                                                                 */
+/*                                                                           */
+/* sp_parse lexes and parses the len bytes at buf as an expression and       */
+/* writes the chosen forms into the parser. The bytes need not be            */
+/* null-terminated, and they have to stay in place until the next sp_parse   */
+/* or sp_reset, since the parse tree points into them. It returns SP_OK, or  */
+/* one of the error codes below. sp_render then passes the text of one form, */
+/* normally one of those chosen, to sink, together with arg. The text is not */
+/* null-terminated and is only valid during the call. A form that was not    */
+/* chosen is printed on demand. sp_render returns whatever sink returns. It  */
+/* returns -1 if nothing has been parsed since the parser was made or reset, */
+/* or if form is not a form, the error code if the last sp_parse failed, and */
+/* SP_ERR_MEMORY if memory runs out while it prints a form that was not      */
+/* chosen. sp_reset forgets the last expression but keeps the memory the     */
+/* parser has taken, so that the next expression can reuse it.               */
+/*                                                                           */
+/* Nothing in the library prints anything. sp_parse stops at the first error */
+/* it finds and returns its code: SP_ERR_CHAR for a character that cannot    */
+/* start a token, SP_ERR_OPERAND where a variable, number or left            */
+/* parenthesis is missing, SP_ERR_RPAREN where a right parenthesis is        */
+/* missing, SP_ERR_TOKEN for a token after the end of an expression,         */
+/* SP_ERR_MEMORY if memory runs out, also while it writes the chosen forms,  */
+/* and SP_ERR_LENGTH, with the offset 0, for an expression longer than       */
+/* INT_MAX bytes, which the tokens cannot point into. Whatever was built up  */
+/* to that point is released in bulk with the rest of the arena by the next  */
+/* sp_parse or sp_reset. sp_error returns the code of the last sp_parse and, */
+/* unless offset is NULL, stores the offset in the input of the token or     */
+/* character at which it stopped; that is the length of the input if the     */
+/* input ended too early. sp_strerror returns a short description of a code, */
+/* such as "operand expected".                                               */
+/*                                                                           */
+/* sp_save_tree writes the tree of the last expression parsed (the           */
+/* simplified tree with SP_SIMPLIFY) to sink in one piece, in the binary     */
+/* form described below, and returns what sink returns. Like sp_render, it   */
+/* returns -1 if nothing has been parsed and the error code if the last      */
+/* sp_parse failed. sp_load_tree takes the place of sp_parse for the size    */
+/* bytes at data holding such a tree: it renders the chosen forms straight   */
+/* from the tree, without lexing or parsing anything, and returns SP_OK,     */
+/* SP_ERR_FORMAT if the bytes do not hold a tree written by sp_save_tree,    */
+/* or SP_ERR_MEMORY; sp_error then reports that code with the offset 0. As   */
+/* with sp_parse, the bytes have to stay in place until the next sp_parse,   */
+/* sp_load_tree or sp_reset, since the tree points into them; a file         */
+/* written by sp_save_tree can thus be mapped into memory and used as it     */
+/* is.                                                                       */
+/*                                                                           */
+/* The tree is made up of the four bytes SPTR and then five little-endian    */
+/* 32-bit numbers: the version, 1, the number of nodes n, the number of      */
+/* atoms, (n + 1) / 2, the number of distinct atoms s and their total        */
+/* length in bytes. Then follow the types of the n nodes in preorder, one    */
+/* byte each, 8 to 12 for ^, *, /, + and - and 13 for an atom, padded with   */
+/* zero bytes to a multiple of four; the index, as a 32-bit number, of the   */
+/* text of every atom, in the same order; the s + 1 offsets of the texts,    */
+/* 32-bit numbers starting at 0 and ending at their total length; and the    */
+/* texts themselves.                                                         */
+/*                                                                           */
+/* sp_edit changes the last expression given to sp_parse or sp_edit,         */
+/* replacing the deleted bytes at offset by the len bytes at text, and       */
+/* parses the result; the new bytes are copied, so they need not stay in     */
+/* place. It returns what sp_parse would return for the edited expression,   */
+/* with the offset for sp_error counted in the edited expression; -1 if      */
+/* nothing has been parsed since the parser was made or reset, or if the     */
+/* tree came from sp_load_tree; and SP_ERR_RANGE, changing nothing, if the   */
+/* deleted bytes reach past the end of the expression. Without SP_COMPACT,   */
+/* only the text between the innermost pair of parentheses around the edit   */
+/* is lexed and parsed again, as long as the parentheses in it still         */
+/* balance, and the rest of the parse tree is kept. Text between parentheses */
+/* that does not parse is kept as it is, so that the edit fixing it is just  */
+/* as cheap. Once an edit has kept part of the tree, sp_render writes the    */
+/* form asked for at every call instead of the forms being written up front. */
+/* An edit outside all parentheses, one leaving them unbalanced, and every   */
+/* edit with SP_COMPACT parse the whole expression again, as sp_parse does.  */
+/* The bytes given to sp_parse still have to stay in place until the next    */
+/* sp_parse or sp_reset, since the parts of the tree that are kept point     */
+/* into them.                                                                */
+/*                                                                           */
+/* A parser must not be used by two threads at once; different parsers may   */
+/* be used by different threads freely.                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef SIMPLE_PARSE_H
+#define SIMPLE_PARSE_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define SP_API __attribute__((visibility("default")))
+#else
+#define SP_API
+#endif
+
+#define SP_FORM_PAREN   0
+#define SP_FORM_POSTFIX 1
+#define SP_FORM_PREFIX  2
+
+#define SP_COMPACT  0x01
+#define SP_SHARE    0x02
+#define SP_SIMPLIFY 0x04
+
+#define SP_THREADS_SHIFT 8
+#define SP_THREADS(n)    ((n) << SP_THREADS_SHIFT)
+
+#define SP_OK           0
+#define SP_ERR_CHAR    -1
+#define SP_ERR_OPERAND -2
+#define SP_ERR_RPAREN  -3
+#define SP_ERR_TOKEN   -4
+#define SP_ERR_MEMORY  -5
+#define SP_ERR_FORMAT  -6
+#define SP_ERR_RANGE   -7
+#define SP_ERR_LENGTH  -8
+
+struct sp_parser;
+
+SP_API struct sp_parser *sp_parser_new(int options, int forms);
+SP_API int sp_parse(struct sp_parser *parser, const char *buf, size_t len);
+SP_API int sp_render(struct sp_parser *parser, int form,
+                     int (*sink)(void *arg, const char *text, size_t len),
+                     void *arg);
+SP_API int sp_error(struct sp_parser *parser, size_t *offset);
+SP_API const char *sp_strerror(int status);
+SP_API int sp_save_tree(struct sp_parser *parser,
+                        int (*sink)(void *arg, const char *data, size_t len),
+                        void *arg);
+SP_API int sp_load_tree(struct sp_parser *parser, const void *data,
+                        size_t size);
+SP_API int sp_edit(struct sp_parser *parser, size_t offset, size_t deleted,
+                   const char *text, size_t len);
+SP_API void sp_reset(struct sp_parser *parser);
+SP_API void sp_parser_free(struct sp_parser *parser);
+
+#endif
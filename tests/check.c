@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+
+int check_failures;
+
+void check_failed(const char *file, int line, const char *cond) {
+   ++check_failures;
+   printf("%s:%d: check failed: %s\n", file, line, cond);
+}
+
+int check_done(const char *name) {
+   if (check_failures == 0) {
+      printf("%s: ok\n", name);
+      return 0;
+   }
+   printf("%s: %d checks failed\n", name, check_failures);
+   return 1;
+}
+
+void check_text_init(struct check_text *text) {
+   text->data = NULL;
+   text->len = 0;
+   text->cap = 0;
+}
+
+void check_text_free(struct check_text *text) {
+   free(text->data);
+   check_text_init(text);
+}
+
+int check_sink(void *arg, const char *data, size_t len) {
+   struct check_text *text = (struct check_text *)arg;
+   char *grown;
+   size_t cap;
+   if (text->len + len + 1 > text->cap) {
+      for (cap = text->cap ? text->cap : 64; cap < text->len + len + 1; )
+         cap *= 2;
+      grown = (char *)realloc(text->data, cap);
+      if (grown == NULL)
+         return -1;
+      text->data = grown;
+      text->cap = cap;
+   }
+   memcpy(text->data + text->len, data, len);
+   text->len += len;
+   text->data[text->len] = '\0';
+   return 0;
+}
+
+char *check_render(struct sp_parser *parser, int form,
+                   struct check_text *text) {
+   text->len = 0;
+   if (check_sink(text, "", 0) != 0 ||
+       sp_render(parser, form, check_sink, text) != 0)
+      return NULL;
+   return text->data;
+}
+
+void check_same_forms(struct sp_parser *expected, struct sp_parser *parser) {
+   struct check_text want;
+   struct check_text text;
+   char *form;
+   int f;
+
+   check_text_init(&want);
+   check_text_init(&text);
+   for (f = SP_FORM_PAREN; f <= SP_FORM_PREFIX; ++f) {
+      form = check_render(expected, f, &want);
+      if (form == NULL) {
+         CHECK(sp_render(parser, f, check_sink, &text) ==
+               sp_error(expected, NULL));
+         continue;
+      }
+      form = check_render(parser, f, &text);
+      CHECK(form != NULL && text.len == want.len &&
+            memcmp(text.data, want.data, want.len) == 0);
+   }
+   check_text_free(&want);
+   check_text_free(&text);
+}
+
+int check_append(struct check_text *text, const char *piece, long count) {
+   size_t len = strlen(piece);
+   if (check_sink(text, "", 0) != 0)
+      return -1;
+   while (count-- > 0)
+      if (check_sink(text, piece, len) != 0)
+         return -1;
+   return 0;
+}
@@ -0,0 +1,48 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Test Helpers                  */
+/*                                                                           */
+/* Shared by the programs in tests/, each of which checks one part of the    */
+/* interface declared in simple_parse.h. make check builds each of them from */
+/* its own file, which includes simple_parse.c so that it can look behind    */
+/* the interface, and tests/check.c; none of them links against              */
+/* libsimple_parse.a. CHECK records a failed condition with its file and     */
+/* line and counts it in check_failures, and check_done prints the verdict   */
+/* of a program and gives its exit status. A struct check_text collects text */
+/* passed to a sink: check_sink appends to one, and check_render renders a   */
+/* form into one, returning it null-terminated, or NULL if sp_render fails.  */
+/* check_same_forms checks that parser renders every form just as expected   */
+/* does, or, where expected cannot render a form, that sp_render on parser   */
+/* returns the code sp_error gives for expected. check_append appends count  */
+/* copies of piece to a struct check_text, so that long inputs and the forms */
+/* expected of them can be built up piece by piece.                          */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stddef.h>
+#include "../simple_parse.h"
+
+struct check_text {
+   char *data;
+   size_t len;
+   size_t cap;
+};
+
+extern int check_failures;
+
+#define CHECK(cond) \
+   ((cond) ? (void)0 : check_failed(__FILE__, __LINE__, #cond))
+
+void check_failed(const char *file, int line, const char *cond);
+int check_done(const char *name);
+void check_text_init(struct check_text *text);
+void check_text_free(struct check_text *text);
+int check_sink(void *arg, const char *data, size_t len);
+char *check_render(struct sp_parser *parser, int form,
+                   struct check_text *text);
+void check_same_forms(struct sp_parser *expected, struct sp_parser *parser);
+int check_append(struct check_text *text, const char *piece, long count);
+
+#endif
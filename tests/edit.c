@@ -0,0 +1,236 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Edit Test                     */
+/*                                                                           */
+/* Applies edits with sp_edit, with and without compact trees and with the   */
+/* forms rendered up front or alone, and checks after every one that the     */
+/* code, the offset of an error and every form are what sp_parse gives for   */
+/* the edited text parsed afresh: first a fixed series of edits inside,      */
+/* across and outside parentheses, some breaking the expression and others   */
+/* fixing it again, then a long series of random edits drawn from a fixed    */
+/* seed. It also checks that sp_edit returns SP_ERR_RANGE for deleted bytes  */
+/* reaching past the end, changing nothing, and -1 when there is nothing to  */
+/* edit.                                                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+#include "check.h"
+
+#define RANDOM_EDITS 3000
+#define MAX_LEN      40
+
+struct edit_case {
+   size_t offset;
+   size_t deleted;
+   const char *text;
+};
+
+static const char start[] = "a*(b+c)-(d/(e-f))^g";
+
+static const struct edit_case edits[] = {
+   { 5, 1, "c*h" },
+   { 3, 0, "(" },
+   { 3, 1, "" },
+   { 13, 1, "e+" },
+   { 14, 1, "" },
+   { 16, 2, "" },
+   { 16, 0, ")" },
+   { 0, 1, "x+y" },
+   { 4, 3, ")*(" },
+   { 4, 3, "(b+" },
+   { 11, 3, "" },
+   { 0, 100, "" },
+   { 0, 0, "(a)" },
+   { 1, 1, "a+(b*(c^d))" },
+   { 8, 1, "1" },
+   { 8, 1, "" }
+};
+
+struct edited {
+   struct check_text text;
+   struct sp_parser *parser;
+   struct sp_parser *fresh;
+};
+
+void check_fixed(int options, int forms);
+void check_random(int options, int forms);
+int edited_init(struct edited *e, int options, int forms, const char *text);
+void edited_free(struct edited *e);
+void edited_apply(struct edited *e, size_t offset, size_t deleted,
+                  const char *text, size_t len);
+void check_range(void);
+
+int main(void) {
+   int forms;
+
+   for (forms = 0; forms <= 7; forms += 7) {
+      check_fixed(0, forms);
+      check_fixed(SP_COMPACT, forms);
+      check_random(0, forms);
+      check_random(SP_COMPACT | SP_SHARE, forms);
+   }
+   check_range();
+   return check_done("edit");
+}
+
+void check_fixed(int options, int forms) {
+   struct edited e;
+   size_t deleted;
+   int i;
+
+   if (edited_init(&e, options, forms, start) < 0)
+      return;
+   for (i = 0; i < (int)(sizeof(edits) / sizeof(edits[0])); ++i) {
+      deleted = edits[i].deleted;
+      if (deleted > e.text.len - edits[i].offset)
+         deleted = e.text.len - edits[i].offset;
+      edited_apply(&e, edits[i].offset, deleted, edits[i].text,
+                   strlen(edits[i].text));
+   }
+   edited_free(&e);
+}
+
+/* Half the random edits keep a valid expression valid: they swap an     */
+/* atom or an operator for another, or put an operator and an operand     */
+/* after an atom or a right parenthesis. The rest insert or delete a few  */
+/* characters at random, which mostly breaks the expression and leaves    */
+/* text between parentheses that does not parse, until a later edit fixes */
+/* it; after four edits in a row that leave it broken, the whole of it is */
+/* replaced by start. The expression is kept short, so that edits often   */
+/* land inside a group that already parses.                               */
+
+void check_random(int options, int forms) {
+   static const char *tails[] = { "+a", "*(b-1)", "^2", "/(a+(b*c))" };
+   static const char atoms[] = "abc1";
+   static const char operators[] = "+-*/^";
+   static const char pieces[] = "ab1+-*^(())";
+   struct edited e;
+   unsigned long seed = 12345;
+   char text[3];
+   const char *insert;
+   size_t offset;
+   size_t deleted;
+   size_t len;
+   size_t k;
+   int broken = 0;
+   int prev;
+   int cls;
+   int i;
+
+   if (edited_init(&e, options, forms, start) < 0)
+      return;
+   for (i = 0; i < RANDOM_EDITS; ++i) {
+      seed = seed * 1103515245 + 12345;
+      offset = (seed >> 16) % (e.text.len + 1);
+      seed = seed * 1103515245 + 12345;
+      cls = offset < e.text.len ?
+            char_class[(unsigned char)e.text.data[offset]] : CC_INVALID;
+      prev = offset > 0 ?
+             char_class[(unsigned char)e.text.data[offset - 1]] : CC_INVALID;
+      insert = text;
+      deleted = 0;
+      len = 0;
+      if ((seed >> 16) % 4 == 0 && (cls == CC_ALPHA || cls == CC_DIGIT)) {
+         text[0] = atoms[(seed >> 20) % (sizeof(atoms) - 1)];
+         deleted = len = 1;
+      } else if ((seed >> 16) % 4 == 1 && cls >= EXP && cls <= SUB) {
+         text[0] = operators[(seed >> 20) % (sizeof(operators) - 1)];
+         deleted = len = 1;
+      } else if ((seed >> 16) % 4 == 2 && e.text.len <= MAX_LEN &&
+                 (prev == CC_ALPHA || prev == CC_DIGIT || prev == RPAREN) &&
+                 cls != CC_ALPHA && cls != CC_DIGIT && cls != LPAREN) {
+         insert = tails[(seed >> 20) % (sizeof(tails) / sizeof(tails[0]))];
+         len = strlen(insert);
+      } else {
+         deleted = (seed >> 20) % 3;
+         if (deleted > e.text.len - offset)
+            deleted = e.text.len - offset;
+         len = e.text.len > MAX_LEN ? 0 : (seed >> 22) % 3;
+         for (k = 0; k < len; ++k) {
+            seed = seed * 1103515245 + 12345;
+            text[k] = pieces[(seed >> 16) % (sizeof(pieces) - 1)];
+         }
+      }
+      edited_apply(&e, offset, deleted, insert, len);
+      broken = sp_error(e.parser, NULL) != SP_OK ? broken + 1 : 0;
+      if (broken == 4) {
+         edited_apply(&e, 0, e.text.len, start, strlen(start));
+         broken = 0;
+      }
+   }
+   edited_free(&e);
+}
+
+/* e->parser is given the expression once and then only edited, while    */
+/* e->fresh parses every edited text, kept in e->text, from scratch.       */
+
+int edited_init(struct edited *e, int options, int forms, const char *text) {
+   check_text_init(&e->text);
+   e->parser = sp_parser_new(options, forms);
+   e->fresh = sp_parser_new(options, forms);
+   CHECK(e->parser != NULL && e->fresh != NULL &&
+         check_sink(&e->text, text, strlen(text)) == 0);
+   if (e->parser == NULL || e->fresh == NULL || e->text.data == NULL) {
+      edited_free(e);
+      return -1;
+   }
+   CHECK(sp_parse(e->parser, start, strlen(start)) == SP_OK);
+   return 0;
+}
+
+void edited_free(struct edited *e) {
+   sp_parser_free(e->parser);
+   sp_parser_free(e->fresh);
+   check_text_free(&e->text);
+}
+
+void edited_apply(struct edited *e, size_t offset, size_t deleted,
+                  const char *text, size_t len) {
+   size_t want_offset;
+   size_t got_offset;
+   int status;
+
+   status = sp_edit(e->parser, offset, deleted, text, len);
+   memmove(e->text.data + offset, e->text.data + offset + deleted,
+           e->text.len - offset - deleted);
+   e->text.len -= deleted;
+   CHECK(check_sink(&e->text, text, len) == 0);
+   memmove(e->text.data + offset + len, e->text.data + offset,
+           e->text.len - len - offset);
+   memcpy(e->text.data + offset, text, len);
+   CHECK(sp_parse(e->fresh, e->text.data, e->text.len) == status);
+   sp_error(e->fresh, &want_offset);
+   CHECK(sp_error(e->parser, &got_offset) == status &&
+         got_offset == want_offset);
+   check_same_forms(e->fresh, e->parser);
+}
+
+void check_range(void) {
+   struct check_text text;
+   struct sp_parser *parser;
+
+   check_text_init(&text);
+   parser = sp_parser_new(0, 7);
+   CHECK(parser != NULL);
+   if (parser == NULL)
+      return;
+   CHECK(sp_edit(parser, 0, 0, "a", 1) == -1);
+   CHECK(sp_parse(parser, "a+(b)", 5) == SP_OK);
+   CHECK(sp_edit(parser, 6, 0, "c", 1) == SP_ERR_RANGE);
+   CHECK(sp_edit(parser, 3, 3, "c", 1) == SP_ERR_RANGE);
+   CHECK(sp_edit(parser, 0, (size_t)-1, "", 0) == SP_ERR_RANGE);
+   CHECK(sp_edit(parser, 5, 1, "", 0) == SP_ERR_RANGE);
+   CHECK(sp_error(parser, NULL) == SP_OK);
+   CHECK(check_render(parser, SP_FORM_POSTFIX, &text) != NULL &&
+         strcmp(text.data, "a b + ") == 0);
+   CHECK(sp_edit(parser, 5, 0, "*c", 2) == SP_OK);
+   CHECK(sp_edit(parser, 3, 1, "d", 1) == SP_OK);
+   CHECK(check_render(parser, SP_FORM_POSTFIX, &text) != NULL &&
+         strcmp(text.data, "a d c * + ") == 0);
+   sp_reset(parser);
+   CHECK(sp_edit(parser, 0, 0, "a", 1) == -1);
+   sp_parser_free(parser);
+   check_text_free(&text);
+}
@@ -0,0 +1,274 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Error Test                    */
+/*                                                                           */
+/* Checks the code and the offset that sp_parse and sp_error give for every  */
+/* kind of malformed expression, with and without compact trees, and that    */
+/* sp_render passes the error on. It then makes realloc fail while the forms */
+/* are written, which sp_parse and sp_render have to report as SP_ERR_MEMORY */
+/* instead of handing on part of a form, and checks the codes and offsets    */
+/* bc_from_expression returns in place of the messages it used to print.     */
+/* BC_MAX_INDEX is lowered to 16, so that programs with too many constants,  */
+/* variables or shared subtrees for bc_compile stay short. An expression     */
+/* longer than INT_MAX bytes is given as a mapping nobody may read, which    */
+/* sp_parse has to refuse without touching it. The functions here are        */
+/* defined before realloc is redirected, so that they call the real one,     */
+/* while every call made by simple_parse.c goes through test_realloc.        */
+/*                                                                           */
+/*****************************************************************************/
+
+/* As in bench/stages.c, the feature test macros are given before the     */
+/* first system header and _DEFAULT_SOURCE is undefined again afterwards.  */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#undef _DEFAULT_SOURCE
+
+int realloc_fails;
+
+void *test_realloc(void *ptr, size_t size) {
+   return realloc_fails ? NULL : realloc(ptr, size);
+}
+
+#define realloc(ptr, size) test_realloc(ptr, size)
+#define BC_MAX_INDEX 16
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+#include "check.h"
+
+struct error_case {
+   const char *input;
+   int status;
+   size_t offset;
+};
+
+static const struct error_case cases[] = {
+   { "", SP_ERR_OPERAND, 0 },
+   { "a+$", SP_ERR_CHAR, 2 },
+   { "a+", SP_ERR_OPERAND, 2 },
+   { "a*(b+)", SP_ERR_OPERAND, 5 },
+   { "(a", SP_ERR_RPAREN, 2 },
+   { "((a+b)*c", SP_ERR_RPAREN, 8 },
+   { "a)", SP_ERR_TOKEN, 1 },
+   { "a b", SP_ERR_CHAR, 1 },
+   { "(a)(b)", SP_ERR_TOKEN, 3 }
+};
+
+void check_cases(int options);
+void check_memory(int options);
+void check_bytecode(void);
+void check_limit(void);
+void check_length(void);
+
+int main(void) {
+   check_cases(0);
+   check_cases(SP_COMPACT);
+   check_cases(SP_COMPACT | SP_SHARE | SP_SIMPLIFY);
+   check_memory(0);
+   check_memory(SP_COMPACT);
+   check_bytecode();
+   check_length();
+   CHECK(strcmp(sp_strerror(SP_ERR_TOKEN), "unexpected token") == 0);
+   CHECK(strcmp(sp_strerror(SP_ERR_MEMORY), "out of memory") == 0);
+   CHECK(strcmp(sp_strerror(-100), "unknown error") == 0);
+   return check_done("errors");
+}
+
+void check_cases(int options) {
+   struct check_text text;
+   struct sp_parser *parser;
+   size_t offset;
+   int i;
+
+   check_text_init(&text);
+   parser = sp_parser_new(options, 7);
+   CHECK(parser != NULL);
+   if (parser == NULL)
+      return;
+   for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); ++i) {
+      CHECK(sp_parse(parser, cases[i].input, strlen(cases[i].input)) ==
+            cases[i].status);
+      offset = (size_t)-1;
+      CHECK(sp_error(parser, &offset) == cases[i].status &&
+            offset == cases[i].offset);
+      CHECK(sp_render(parser, SP_FORM_POSTFIX, check_sink, &text) ==
+            cases[i].status);
+   }
+   CHECK(sp_parse(parser, "a)", 1) == SP_OK &&
+         sp_error(parser, NULL) == SP_OK);
+   sp_reset(parser);
+   CHECK(sp_render(parser, SP_FORM_PAREN, check_sink, &text) == -1);
+   sp_parser_free(parser);
+   check_text_free(&text);
+}
+
+/* A chain of one-letter atoms grows every buffer of the parser; the same  */
+/* number of tokens with long names then needs longer forms and nothing    */
+/* else, so that it is the forms that run out of memory.                   */
+
+void check_memory(int options) {
+   struct check_text shorter;
+   struct check_text longer;
+   struct check_text text;
+   struct sp_parser *parser;
+   size_t offset;
+   int status;
+
+   check_text_init(&shorter);
+   check_text_init(&longer);
+   check_text_init(&text);
+   CHECK(check_append(&shorter, "a+", 999) == 0 &&
+         check_append(&shorter, "a", 1) == 0 &&
+         check_append(&longer, "abcdefghijklmnopqrstuvwxyz+", 999) == 0 &&
+         check_append(&longer, "a", 1) == 0);
+
+   parser = sp_parser_new(options, 7);
+   CHECK(parser != NULL);
+   if (parser != NULL) {
+      CHECK(sp_parse(parser, shorter.data, shorter.len) == SP_OK);
+      realloc_fails = 1;
+      status = sp_parse(parser, longer.data, longer.len);
+      realloc_fails = 0;
+      CHECK(status == SP_ERR_MEMORY);
+      CHECK(sp_error(parser, &offset) == SP_ERR_MEMORY && offset == 0);
+      CHECK(sp_parse(parser, longer.data, longer.len) == SP_OK);
+      sp_parser_free(parser);
+   }
+
+   /* A form that was not chosen is printed into a buffer of its own. */
+
+   parser = sp_parser_new(options, 1 << SP_FORM_POSTFIX);
+   CHECK(parser != NULL);
+   if (parser != NULL) {
+      CHECK(sp_parse(parser, shorter.data, shorter.len) == SP_OK);
+      realloc_fails = 1;
+      status = sp_render(parser, SP_FORM_PREFIX, check_sink, &text);
+      realloc_fails = 0;
+      CHECK(status == SP_ERR_MEMORY && text.len == 0);
+      CHECK(sp_render(parser, SP_FORM_PREFIX, check_sink, &text) == 0 &&
+            text.len == 2 * shorter.len);
+      sp_parser_free(parser);
+   }
+   check_text_free(&shorter);
+   check_text_free(&longer);
+   check_text_free(&text);
+}
+
+void check_bytecode(void) {
+   struct bytecode bc;
+   int offset;
+
+   CHECK(bc_from_expression("a)", 0, 0, &bc, &offset) == SP_ERR_TOKEN &&
+         offset == 1);
+   CHECK(bc_from_expression("a*(b+", 0, 0, &bc, &offset) == SP_ERR_OPERAND &&
+         offset == 5);
+   CHECK(bc_from_expression("1+b*99999999999999999999", 1, 0, &bc,
+                            &offset) == BC_ERR_NUMBER && offset == 4);
+   CHECK(bc_from_expression("1+b*99999999999999999999", 0, 0, &bc,
+                            &offset) == 0);
+   bc_free(&bc);
+   check_limit();
+}
+
+/* With BC_MAX_INDEX lowered to 16, 15 constants, variables or shared     */
+/* subtrees still fit into a program, but 16 do not.                      */
+
+void check_limit(void) {
+   static const char operators[] = "+-*/^";
+   struct check_text input;
+   struct bytecode bc;
+   int offset;
+   int count;
+   int i;
+
+   check_text_init(&input);
+   for (count = BC_MAX_INDEX - 1; count <= BC_MAX_INDEX; ++count) {
+      input.len = 0;
+      CHECK(check_append(&input, "a", 1) == 0 &&
+            check_append(&input, "+1", count) == 0);
+      CHECK(bc_from_expression(input.data, 1, 0, &bc, &offset) ==
+            (count < BC_MAX_INDEX ? 0 : BC_ERR_LIMIT));
+      if (count < BC_MAX_INDEX) {
+         CHECK(bc.num_consts == count);
+         bc_free(&bc);
+      } else
+         CHECK(offset == 0);
+
+      input.len = 0;
+      CHECK(check_append(&input, "a", 1) == 0);
+      for (i = 1; i < count; ++i)
+         CHECK(check_append(&input, "+", 1) == 0 &&
+               check_sink(&input, "bcdefghijklmnop" + i - 1, 1) == 0);
+      CHECK(bc_from_expression(input.data, 0, 0, &bc, &offset) ==
+            (count < BC_MAX_INDEX ? 0 : BC_ERR_LIMIT));
+      if (count < BC_MAX_INDEX) {
+         CHECK(bc.vars.num_vars == count);
+         bc_free(&bc);
+      }
+
+      /* (a+b)*(a+b) + (a-b)*(a-b) + ... with every operator between
+         each ordered pair of a, b and c shares count subtrees.        */
+
+      input.len = 0;
+      for (i = 0; i < count; ++i) {
+         if (i != 0)
+            CHECK(check_append(&input, "+", 1) == 0);
+         CHECK(check_append(&input, "(", 1) == 0 &&
+               check_sink(&input, &"abcacb"[i / 5 % 6], 1) == 0 &&
+               check_sink(&input, &operators[i % 5], 1) == 0 &&
+               check_sink(&input, &"bcabac"[i / 5 % 6], 1) == 0 &&
+               check_append(&input, ")*(", 1) == 0 &&
+               check_sink(&input, &"abcacb"[i / 5 % 6], 1) == 0 &&
+               check_sink(&input, &operators[i % 5], 1) == 0 &&
+               check_sink(&input, &"bcabac"[i / 5 % 6], 1) == 0 &&
+               check_append(&input, ")", 1) == 0);
+      }
+      CHECK(bc_from_expression(input.data, 0, 1, &bc, &offset) ==
+            (count < BC_MAX_INDEX ? 0 : BC_ERR_LIMIT));
+      if (count < BC_MAX_INDEX) {
+         CHECK(bc.num_temps == count);
+         bc_free(&bc);
+      }
+   }
+   check_text_free(&input);
+
+   /* A program read from a file may not declare that many either. */
+
+   CHECK(bc_from_expression("a+1", 0, 0, &bc, &offset) == 0);
+   if (bc.num_consts == 1) {
+      bc.num_consts = BC_MAX_INDEX;
+      CHECK(bc_check(&bc) < 0);
+      bc.num_consts = 1;
+      bc.vars.num_vars = BC_MAX_INDEX;
+      CHECK(bc_check(&bc) < 0);
+      bc.vars.num_vars = 1;
+      CHECK(bc_check(&bc) == 0);
+   }
+   bc_free(&bc);
+}
+
+/* Without room for that much address space, there is nothing to check.   */
+
+void check_length(void) {
+   struct sp_parser *parser;
+   size_t len = (size_t)INT_MAX + 1;
+   size_t offset;
+   char *data;
+
+   data = (char *)mmap(NULL, len, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (data == MAP_FAILED)
+      return;
+   parser = sp_parser_new(0, 7);
+   CHECK(parser != NULL);
+   if (parser != NULL) {
+      CHECK(sp_parse(parser, data, len) == SP_ERR_LENGTH);
+      CHECK(sp_error(parser, &offset) == SP_ERR_LENGTH && offset == 0);
+      CHECK(sp_render(parser, SP_FORM_POSTFIX, check_sink, NULL) ==
+            SP_ERR_LENGTH);
+      CHECK(sp_parse(parser, "a+b", 3) == SP_OK);
+      sp_parser_free(parser);
+   }
+   munmap(data, len);
+   CHECK(strcmp(sp_strerror(SP_ERR_LENGTH), "expression too long") == 0);
+}
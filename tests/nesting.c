@@ -0,0 +1,150 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Nesting Test                  */
+/*                                                                           */
+/* Parses expressions nested DEPTH levels deep, far deeper than a parser     */
+/* recursing once per level could go on the C stack: a sum under DEPTH pairs */
+/* of parentheses, a subtraction nested to the right through parentheses and */
+/* a chain of DEPTH right-associative ^ operators. Each is parsed into a     */
+/* parse tree and into a compact tree, shared and simplified too, and every  */
+/* form is checked, both rendered up front and rendered alone. An unclosed   */
+/* parenthesis that deep has to be reported where the input ends, and the    */
+/* bytecode compiled for the deep expressions has to give their values.      */
+/*                                                                           */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+#include "check.h"
+
+#define DEPTH 300000L
+
+void check_forms(struct check_text *input, const char *paren,
+                 const char *post, const char *pre);
+void check_value(struct check_text *input, double value);
+
+int main(void) {
+   struct check_text input;
+   struct check_text paren;
+   struct check_text post;
+   struct check_text pre;
+   struct sp_parser *parser;
+   size_t offset;
+   int status;
+
+   check_text_init(&input);
+   check_text_init(&paren);
+   check_text_init(&post);
+   check_text_init(&pre);
+
+   CHECK(check_append(&input, "(", DEPTH) == 0 &&
+         check_append(&input, "a+b", 1) == 0 &&
+         check_append(&input, ")", DEPTH) == 0);
+   check_forms(&input, "a+b", "a b + ", "+ a b ");
+   check_value(&input, 3);
+
+   input.len = 0;
+   paren.len = 0;
+   post.len = 0;
+   pre.len = 0;
+   CHECK(check_append(&input, "a-(", DEPTH - 1) == 0 &&
+         check_append(&input, "a-a", 1) == 0 &&
+         check_append(&input, ")", DEPTH - 1) == 0 &&
+         check_append(&post, "a ", DEPTH + 1) == 0 &&
+         check_append(&post, "- ", DEPTH) == 0 &&
+         check_append(&pre, "- a ", DEPTH) == 0 &&
+         check_append(&pre, "a ", 1) == 0);
+   check_forms(&input, input.data, post.data, pre.data);
+
+   input.len = 0;
+   post.len = 0;
+   pre.len = 0;
+   CHECK(check_append(&input, "a^", DEPTH) == 0 &&
+         check_append(&input, "a", 1) == 0 &&
+         check_append(&paren, "a^(", DEPTH - 1) == 0 &&
+         check_append(&paren, "a^a", 1) == 0 &&
+         check_append(&paren, ")", DEPTH - 1) == 0 &&
+         check_append(&post, "a ", DEPTH + 1) == 0 &&
+         check_append(&post, "^ ", DEPTH) == 0 &&
+         check_append(&pre, "^ a ", DEPTH) == 0 &&
+         check_append(&pre, "a ", 1) == 0);
+   check_forms(&input, paren.data, post.data, pre.data);
+   check_value(&input, 1);
+
+   input.len = 0;
+   CHECK(check_append(&input, "(", DEPTH) == 0 &&
+         check_append(&input, "a", 1) == 0);
+   parser = sp_parser_new(SP_COMPACT, 7);
+   CHECK(parser != NULL);
+   if (parser != NULL) {
+      status = sp_parse(parser, input.data, input.len);
+      CHECK(status == SP_ERR_RPAREN);
+      CHECK(sp_error(parser, &offset) == SP_ERR_RPAREN &&
+            offset == input.len);
+      sp_parser_free(parser);
+   }
+
+   check_text_free(&input);
+   check_text_free(&paren);
+   check_text_free(&post);
+   check_text_free(&pre);
+   return check_done("nesting");
+}
+
+/* Every combination of options and of rendering the forms up front or     */
+/* alone has to give the same three forms.                                 */
+
+void check_forms(struct check_text *input, const char *paren,
+                 const char *post, const char *pre) {
+   static const int options[] = {
+      0, SP_COMPACT, SP_COMPACT | SP_SHARE, SP_COMPACT | SP_SIMPLIFY
+   };
+   struct check_text text;
+   struct sp_parser *parser;
+   char *form;
+   int forms;
+   int i;
+
+   check_text_init(&text);
+   for (i = 0; i < (int)(sizeof(options) / sizeof(options[0])); ++i)
+      for (forms = 0; forms <= 7; forms += 7) {
+         parser = sp_parser_new(options[i], forms);
+         CHECK(parser != NULL);
+         if (parser == NULL)
+            continue;
+         CHECK(sp_parse(parser, input->data, input->len) == SP_OK);
+         form = check_render(parser, SP_FORM_PAREN, &text);
+         CHECK(form != NULL && strcmp(form, paren) == 0);
+         form = check_render(parser, SP_FORM_POSTFIX, &text);
+         CHECK(form != NULL && strcmp(form, post) == 0);
+         form = check_render(parser, SP_FORM_PREFIX, &text);
+         CHECK(form != NULL && strcmp(form, pre) == 0);
+         sp_parser_free(parser);
+      }
+   check_text_free(&text);
+}
+
+/* With a set to 1 and b to 2, as far as the expression has them.          */
+
+void check_value(struct check_text *input, double value) {
+   struct bytecode bc;
+   union eval_value row[2];
+   union eval_value *stack;
+   int status;
+   int offset;
+   int i;
+
+   status = bc_from_expression(input->data, 0, 0, &bc, &offset);
+   CHECK(status == 0);
+   if (status != 0)
+      return;
+   for (i = 0; i < bc.vars.num_vars; ++i)
+      row[i].d = bc.vars.names[i][0] == 'a' ? 1 : 2;
+   stack = (union eval_value *)malloc((bc.max_depth + bc.num_temps + 1) *
+                                      sizeof(union eval_value));
+   CHECK(stack != NULL);
+   if (stack != NULL)
+      CHECK(bc_run_double(&bc, row, stack) == value);
+   free(stack);
+   bc_free(&bc);
+}
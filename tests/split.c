@@ -0,0 +1,151 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Split Test                    */
+/*                                                                           */
+/* Parses expressions several times SPLIT_MIN_TOKENS tokens long with        */
+/* parsers given SP_THREADS and with a parser working alone, and checks      */
+/* that the forms, and the code and offset of an error, come out the same:   */
+/* for chains split at + and -, at * and / and under ^, for every set of     */
+/* forms chosen up front, and after an edit of the split tree. Every parser  */
+/* first splits an expression into two chunks, so that the chunks grow      */
+/* while the first ones are still in use, and the test looks behind the     */
+/* interface to make sure that the long expressions were split at all.       */
+/*                                                                           */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+#include "check.h"
+
+#define REPEAT 16000L
+
+void check_same(struct check_text *input, struct check_text *two,
+                int split);
+void check_edit(void);
+
+int main(void) {
+   struct check_text input;
+   struct check_text two;
+
+   check_text_init(&input);
+   check_text_init(&two);
+   CHECK(check_append(&two, "a+", SPLIT_MIN_TOKENS) == 0 &&
+         check_append(&two, "a", 1) == 0);
+   CHECK(check_append(&input, "a*(b+c)-d/e+", REPEAT) == 0 &&
+         check_append(&input, "f", 1) == 0);
+   check_same(&input, &two, 1);
+
+   input.len = 0;
+   CHECK(check_append(&input, "(a+b)*c/", REPEAT) == 0 &&
+         check_append(&input, "d^(e-f)", 1) == 0);
+   check_same(&input, &two, 1);
+
+   input.len = 0;
+   CHECK(check_append(&input, "a^b^c*d-", REPEAT) == 0 &&
+         check_append(&input, "e", 1) == 0);
+   check_same(&input, &two, 1);
+
+   /* Errors: an unclosed parenthesis, a missing operand in the middle and
+      a right parenthesis too many, none of which the split may hide.  */
+
+   input.len = 0;
+   CHECK(check_append(&input, "(", 1) == 0 &&
+         check_append(&input, "a*b+c-", REPEAT) == 0 &&
+         check_append(&input, "d", 1) == 0);
+   check_same(&input, &two, 0);
+
+   input.len = 0;
+   CHECK(check_append(&input, "a*b+c-", REPEAT) == 0 &&
+         check_append(&input, "+", 1) == 0 &&
+         check_append(&input, "a*b+c-", REPEAT) == 0 &&
+         check_append(&input, "d", 1) == 0);
+   check_same(&input, &two, 0);
+
+   input.len = 0;
+   CHECK(check_append(&input, "a*b+c-", REPEAT) == 0 &&
+         check_append(&input, "d)-", 1) == 0 &&
+         check_append(&input, "a*b+c-", REPEAT) == 0 &&
+         check_append(&input, "d", 1) == 0);
+   check_same(&input, &two, 0);
+
+   check_edit();
+   check_text_free(&input);
+   check_text_free(&two);
+   return check_done("split");
+}
+
+/* Every number of threads, and every set of forms chosen up front, has    */
+/* to give what a parser working alone gives.                              */
+
+void check_same(struct check_text *input, struct check_text *two,
+                int split) {
+   static const int threads[] = { 2, 3, 4, 8 };
+   struct sp_parser *alone;
+   struct sp_parser *parser;
+   size_t offset;
+   size_t alone_offset;
+   int status;
+   int forms;
+   int i;
+
+   for (forms = 0; forms <= 7; ++forms) {
+      alone = sp_parser_new(0, forms);
+      CHECK(alone != NULL);
+      if (alone == NULL)
+         continue;
+      status = sp_parse(alone, input->data, input->len);
+      CHECK((status == SP_OK) == split);
+      sp_error(alone, &alone_offset);
+      for (i = 0; i < (int)(sizeof(threads) / sizeof(threads[0])); ++i) {
+         parser = sp_parser_new(SP_THREADS(threads[i]), forms);
+         CHECK(parser != NULL);
+         if (parser == NULL)
+            continue;
+         CHECK(sp_parse(parser, two->data, two->len) == SP_OK);
+         CHECK(sp_parse(parser, input->data, input->len) == status);
+         CHECK(sp_error(parser, &offset) == status &&
+               offset == alone_offset);
+         if (split)
+            CHECK(parser->split != NULL && parser->split->num_chunks > 1);
+         check_same_forms(alone, parser);
+         sp_parser_free(parser);
+      }
+      sp_parser_free(alone);
+   }
+}
+
+/* An edit inside a group of the split tree only reparses the group, and  */
+/* has to give what parsing the edited text from scratch gives.           */
+
+void check_edit(void) {
+   struct check_text input;
+   struct check_text edited;
+   struct sp_parser *alone;
+   struct sp_parser *parser;
+   size_t offset;
+
+   check_text_init(&input);
+   check_text_init(&edited);
+   CHECK(check_append(&input, "a*(b+c)-d/e+", REPEAT) == 0 &&
+         check_append(&input, "f", 1) == 0);
+   offset = 12 * (REPEAT / 2) + 3;
+   CHECK(check_sink(&edited, input.data, offset) == 0 &&
+         check_sink(&edited, "x^y", 3) == 0 &&
+         check_sink(&edited, input.data + offset + 1,
+                    input.len - offset - 1) == 0);
+   alone = sp_parser_new(0, 7);
+   parser = sp_parser_new(SP_THREADS(4), 7);
+   CHECK(alone != NULL && parser != NULL);
+   if (alone != NULL && parser != NULL) {
+      CHECK(sp_parse(alone, edited.data, edited.len) == SP_OK);
+      CHECK(sp_parse(parser, input.data, input.len) == SP_OK);
+      CHECK(parser->split != NULL && parser->split->num_chunks > 1);
+      CHECK(sp_edit(parser, offset, 1, "x^y", 3) == SP_OK);
+      check_same_forms(alone, parser);
+      CHECK(sp_edit(parser, input.len + 3, 1, "z", 1) == SP_ERR_RANGE);
+   }
+   sp_parser_free(alone);
+   sp_parser_free(parser);
+   check_text_free(&input);
+   check_text_free(&edited);
+}
@@ -0,0 +1,233 @@
+/*****************************************************************************/
+/*                    Simple Expression Parser Tree Test                     */
+/*                                                                           */
+/* Saves the trees of a few expressions with sp_save_tree, under every       */
+/* combination of options, and loads them back with sp_load_tree into        */
+/* parsers of every kind, which have to render the forms, and save the       */
+/* bytes, that parsing the expression afresh gives; a tree saved after an    */
+/* edit has to hold the edited expression. Then it damages a saved tree in   */
+/* every way sp_load_tree checks for, each of which has to give              */
+/* SP_ERR_FORMAT with the offset 0, and checks what sp_save_tree and sp_edit */
+/* return for parsers that have nothing to save or no text to edit.          */
+/*                                                                           */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define SIMPLE_PARSE_NO_MAIN
+#include "../simple_parse.c"
+#include "check.h"
+
+static const int options[] = {
+   0, SP_COMPACT, SP_COMPACT | SP_SHARE, SP_COMPACT | SP_SIMPLIFY,
+   SP_COMPACT | SP_SHARE | SP_SIMPLIFY
+};
+
+#define NUM_OPTIONS ((int)(sizeof(options) / sizeof(options[0])))
+
+void check_round_trip(const char *input, size_t len);
+void check_edited(void);
+void check_damaged(void);
+void check_format(const unsigned char *data, size_t size);
+
+int main(void) {
+   struct check_text input;
+
+   check_round_trip("a", 1);
+   check_round_trip("a+b*c", 5);
+   check_round_trip("(a+b)*(a+b)^2-xy/y", 18);
+   check_round_trip("1+2*3-0*b+18446744073709551616", 30);
+   check_text_init(&input);
+   CHECK(check_append(&input, "(a+b)*c-", 10000) == 0 &&
+         check_append(&input, "d", 1) == 0);
+   check_round_trip(input.data, input.len);
+   check_text_free(&input);
+   check_edited();
+   check_damaged();
+   return check_done("tree");
+}
+
+/* The tree saved by a parser with any options, loaded by a parser with    */
+/* any options, asked for all forms up front or for none. A loader given   */
+/* SP_SIMPLIFY simplifies what it loads, so the forms and the tree saved   */
+/* again are those of a parser simplifying if either of the two did.       */
+
+void check_round_trip(const char *input, size_t len) {
+   struct check_text saved;
+   struct check_text expected;
+   struct check_text again;
+   struct sp_parser *saver;
+   struct sp_parser *loader;
+   struct sp_parser *fresh;
+   int forms;
+   int i;
+   int k;
+
+   check_text_init(&saved);
+   check_text_init(&expected);
+   check_text_init(&again);
+   for (i = 0; i < NUM_OPTIONS; ++i) {
+      saver = sp_parser_new(options[i], 7);
+      CHECK(saver != NULL);
+      if (saver == NULL)
+         continue;
+      saved.len = 0;
+      CHECK(sp_parse(saver, input, len) == SP_OK);
+      CHECK(sp_save_tree(saver, check_sink, &saved) == 0);
+      CHECK(saved.len > TREE_HEADER && memcmp(saved.data, "SPTR", 4) == 0);
+      for (k = 0; k < NUM_OPTIONS; ++k) {
+         fresh = sp_parser_new(SP_COMPACT |
+                               ((options[i] | options[k]) & SP_SIMPLIFY), 7);
+         CHECK(fresh != NULL);
+         if (fresh == NULL)
+            continue;
+         expected.len = 0;
+         CHECK(sp_parse(fresh, input, len) == SP_OK);
+         CHECK(sp_save_tree(fresh, check_sink, &expected) == 0);
+         for (forms = 0; forms <= 7; forms += 7) {
+            loader = sp_parser_new(options[k], forms);
+            CHECK(loader != NULL);
+            if (loader == NULL)
+               continue;
+            CHECK(sp_load_tree(loader, saved.data, saved.len) == SP_OK);
+            CHECK(sp_error(loader, NULL) == SP_OK);
+            check_same_forms(fresh, loader);
+            again.len = 0;
+            CHECK(sp_save_tree(loader, check_sink, &again) == 0 &&
+                  again.len == expected.len &&
+                  memcmp(again.data, expected.data, expected.len) == 0);
+            CHECK(sp_edit(loader, 0, 0, "a", 1) == -1);
+            sp_parser_free(loader);
+         }
+         sp_parser_free(fresh);
+      }
+      sp_parser_free(saver);
+   }
+   check_text_free(&saved);
+   check_text_free(&expected);
+   check_text_free(&again);
+}
+
+/* An edit that kept part of the parse tree, saved and loaded again.       */
+
+void check_edited(void) {
+   struct check_text saved;
+   struct sp_parser *fresh;
+   struct sp_parser *parser;
+   struct sp_parser *loader;
+
+   check_text_init(&saved);
+   fresh = sp_parser_new(SP_COMPACT, 7);
+   parser = sp_parser_new(0, 7);
+   loader = sp_parser_new(SP_COMPACT, 7);
+   CHECK(fresh != NULL && parser != NULL && loader != NULL);
+   if (fresh != NULL && parser != NULL && loader != NULL) {
+      CHECK(sp_parse(fresh, "a*(b-c^d)+e", 11) == SP_OK);
+      CHECK(sp_parse(parser, "a*(b+c)+e", 9) == SP_OK);
+      CHECK(sp_edit(parser, 4, 2, "-c^d", 4) == SP_OK);
+      CHECK(sp_save_tree(parser, check_sink, &saved) == 0);
+      CHECK(sp_load_tree(loader, saved.data, saved.len) == SP_OK);
+      check_same_forms(fresh, loader);
+   }
+   sp_parser_free(fresh);
+   sp_parser_free(parser);
+   sp_parser_free(loader);
+   check_text_free(&saved);
+}
+
+/* The tree of a+b*c is the header; the types + a * b c, padded to eight   */
+/* bytes; the indices 0, 1 and 2 of the atoms; the offsets 0 to 3 of the   */
+/* texts; and the texts abc.                                               */
+
+#define TYPES   TREE_HEADER
+#define ATOMS   (TYPES + 8)
+#define OFFSETS (ATOMS + 12)
+#define TEXTS   (OFFSETS + 16)
+#define SIZE    (TEXTS + 3)
+
+void check_damaged(void) {
+   struct check_text saved;
+   struct check_text text;
+   struct sp_parser *parser;
+   unsigned char tree[SIZE + 1];
+   unsigned char damaged[SIZE + 1];
+
+   check_text_init(&saved);
+   check_text_init(&text);
+   parser = sp_parser_new(SP_COMPACT, 7);
+   CHECK(parser != NULL);
+   if (parser == NULL)
+      return;
+   CHECK(sp_save_tree(parser, check_sink, &saved) == -1);
+   CHECK(sp_parse(parser, "a+", 2) == SP_ERR_OPERAND);
+   CHECK(sp_save_tree(parser, check_sink, &saved) == SP_ERR_OPERAND);
+   CHECK(sp_parse(parser, "a+b*c", 5) == SP_OK);
+   CHECK(sp_save_tree(parser, check_sink, &saved) == 0 && saved.len == SIZE);
+   sp_parser_free(parser);
+   if (saved.len != SIZE)
+      return;
+   memcpy(tree, saved.data, SIZE);
+   tree[SIZE] = 0;
+   CHECK(tree[TYPES] == NADD && tree[TYPES + 1] == NATOM &&
+         tree[TYPES + 2] == NMUL && memcmp(tree + TEXTS, "abc", 3) == 0);
+
+   check_format(tree, SIZE - 1);
+   check_format(tree, SIZE + 1);
+   check_format(tree, 3);
+
+#define DAMAGE(offset, value) \
+   (memcpy(damaged, tree, SIZE), damaged[offset] = (value), \
+    check_format(damaged, SIZE))
+
+   DAMAGE(0, 'X');
+   DAMAGE(4, TREE_VERSION + 1);
+   DAMAGE(8, 4);
+   DAMAGE(12, 2);
+   DAMAGE(16, 4);
+   DAMAGE(20, 2);
+   DAMAGE(TYPES, 7);
+   DAMAGE(TYPES, NATOM);
+   DAMAGE(TYPES + 1, NADD);
+   DAMAGE(TYPES + 5, 1);
+   DAMAGE(ATOMS + 4, 3);
+   DAMAGE(OFFSETS, 1);
+   DAMAGE(OFFSETS + 4, 3);
+   DAMAGE(OFFSETS + 12, 2);
+   DAMAGE(TEXTS + 1, '+');
+
+#undef DAMAGE
+
+   /* The undamaged tree still loads, and the damaged ones have not left
+      anything behind that sp_render could show.                       */
+
+   parser = sp_parser_new(0, 7);
+   CHECK(parser != NULL);
+   if (parser != NULL) {
+      CHECK(sp_load_tree(parser, tree, SIZE) == SP_OK);
+      CHECK(check_render(parser, SP_FORM_POSTFIX, &text) != NULL &&
+            strcmp(text.data, "a b c * + ") == 0);
+      sp_parser_free(parser);
+   }
+   check_text_free(&saved);
+   check_text_free(&text);
+}
+
+void check_format(const unsigned char *data, size_t size) {
+   struct check_text text;
+   struct sp_parser *parser;
+   size_t offset;
+
+   check_text_init(&text);
+   parser = sp_parser_new(0, 7);
+   CHECK(parser != NULL);
+   if (parser != NULL) {
+      CHECK(sp_parse(parser, "a)", 2) == SP_ERR_TOKEN);
+      CHECK(sp_load_tree(parser, data, size) == SP_ERR_FORMAT);
+      offset = (size_t)-1;
+      CHECK(sp_error(parser, &offset) == SP_ERR_FORMAT && offset == 0);
+      CHECK(sp_render(parser, SP_FORM_PREFIX, check_sink, &text) ==
+            SP_ERR_FORMAT && text.len == 0);
+      CHECK(sp_save_tree(parser, check_sink, &text) == SP_ERR_FORMAT);
+      sp_parser_free(parser);
+   }
+   check_text_free(&text);
+}